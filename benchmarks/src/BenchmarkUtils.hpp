@@ -0,0 +1,62 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+
+namespace caff {
+
+    // Noise is the worst case for both conversion and encoding, which keeps results from depending on content
+    inline std::vector<uint8_t> randomBytes(size_t size, uint32_t seed = 42) {
+        std::vector<uint8_t> bytes(size);
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> distribution(0, 255);
+        std::generate(bytes.begin(), bytes.end(), [&] { return static_cast<uint8_t>(distribution(generator)); });
+        return bytes;
+    }
+
+    // Runs |function| once to warm up, then |iterations| times, and returns the mean time per run in microseconds
+    template <typename Function> double measureMicros(int iterations, Function && function) {
+        function();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            function();
+        }
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / iterations;
+    }
+
+    // A diagonal gradient scrolling under a moving block of noise, so every frame has both motion and detail to encode.
+    // |noise| holds 256x256 bytes
+    inline void drawMovingPattern(webrtc::I420Buffer * buffer, int index, std::vector<uint8_t> const & noise) {
+        for (int y = 0; y < buffer->height(); ++y) {
+            uint8_t * row = buffer->MutableDataY() + y * buffer->StrideY();
+            for (int x = 0; x < buffer->width(); ++x) {
+                row[x] = static_cast<uint8_t>(x + y + index * 4);
+            }
+        }
+
+        int const blockSize = 256;
+        int const left = (index * 8) % (buffer->width() - blockSize);
+        int const top = (buffer->height() - blockSize) / 2;
+        for (int y = 0; y < blockSize; ++y) {
+            uint8_t * row = buffer->MutableDataY() + (top + y) * buffer->StrideY() + left;
+            std::copy_n(noise.data() + ((index + y) % blockSize) * blockSize, blockSize, row);
+        }
+
+        int const chromaHeight = buffer->ChromaHeight();
+        int const chromaWidth = buffer->ChromaWidth();
+        for (int y = 0; y < chromaHeight; ++y) {
+            std::fill_n(buffer->MutableDataU() + y * buffer->StrideU(), chromaWidth, static_cast<uint8_t>(96 + y / 4));
+            std::fill_n(buffer->MutableDataV() + y * buffer->StrideV(), chromaWidth, static_cast<uint8_t>(160 - y / 4));
+        }
+    }
+
+} // namespace caff
@@ -0,0 +1,415 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+// Runs a Y4M or raw I420 clip through VideoCapturer and X264Encoder, the same path a broadcast takes, and reports
+// encode latency percentiles, achieved fps, bitrate, and PSNR and SSIM against the encoder's input. Every setting is
+// fixed on the command line, so runs with different presets, threading modes and CRFs can be compared directly.
+//
+//     bench-encoder clip.y4m [options]
+//     bench-encoder clip.yuv --size 1280x720 --fps 60 [options]
+//
+// Options:
+//     --size WxH          frame size of a raw clip
+//     --fps N             frame rate of a raw clip, or to override the one in a Y4M header
+//     --frames N          stop after N source frames
+//     --bitrate KBPS      target bitrate (default 4000)
+//     --preset LEVEL      hold a preset: 0 ultrafast, 1 superfast, 2 veryfast, 3 faster (default: adapt to the CPU)
+//     --crf X             fixed CRF (default: chosen from resolution and bitrate)
+//     --threading MODE    single, sliced, or frame:N with a budget of N frames of delay (default single)
+//     --profile NAME      baseline, main or high (default baseline)
+//     --realtime          feed frames at the clip's frame rate instead of as fast as possible
+
+#include "BenchmarkUtils.hpp"
+#include "EncoderControl.hpp"
+#include "VideoCapturer.hpp"
+#include "X264Encoder.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "media/base/h264_profile_level_id.h"
+#include "media/base/mediaconstants.h"
+
+using namespace caff;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string path;
+        int width = 0;
+        int height = 0;
+        double fps = 0.0;
+        long frames = -1;
+        uint32_t bitrateKbps = 4000;
+        int32_t speedLevel = -1;
+        float crf = 0.0f;
+        caff_EncoderThreading threading = caff_EncoderThreadingSingle;
+        int32_t maxLatencyFrames = 0;
+        webrtc::H264::Profile profile = webrtc::H264::kProfileConstrainedBaseline;
+        bool isRealtime = false;
+    };
+
+    [[noreturn]] void usage(char const * error) {
+        std::fprintf(stderr, "%s\nSee the top of bench-encoder.cpp for usage\n", error);
+        std::exit(1);
+    }
+
+    Options parseOptions(int argc, char ** argv) {
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> char const * {
+                if (i + 1 >= argc) {
+                    usage(("Missing value for " + arg).c_str());
+                }
+                return argv[++i];
+            };
+
+            if (arg == "--size") {
+                if (std::sscanf(value(), "%dx%d", &options.width, &options.height) != 2) {
+                    usage("--size must look like 1280x720");
+                }
+            } else if (arg == "--fps") {
+                options.fps = std::atof(value());
+            } else if (arg == "--frames") {
+                options.frames = std::atol(value());
+            } else if (arg == "--bitrate") {
+                options.bitrateKbps = static_cast<uint32_t>(std::atol(value()));
+            } else if (arg == "--preset") {
+                options.speedLevel = std::atoi(value());
+            } else if (arg == "--crf") {
+                options.crf = static_cast<float>(std::atof(value()));
+            } else if (arg == "--threading") {
+                std::string mode = value();
+                if (mode == "single") {
+                    options.threading = caff_EncoderThreadingSingle;
+                } else if (mode == "sliced") {
+                    options.threading = caff_EncoderThreadingSliced;
+                } else if (mode.compare(0, 6, "frame:") == 0) {
+                    options.threading = caff_EncoderThreadingFrame;
+                    options.maxLatencyFrames = std::atoi(mode.c_str() + 6);
+                } else {
+                    usage("--threading must be single, sliced or frame:N");
+                }
+            } else if (arg == "--profile") {
+                std::string profile = value();
+                if (profile == "baseline") {
+                    options.profile = webrtc::H264::kProfileConstrainedBaseline;
+                } else if (profile == "main") {
+                    options.profile = webrtc::H264::kProfileMain;
+                } else if (profile == "high") {
+                    options.profile = webrtc::H264::kProfileHigh;
+                } else {
+                    usage("--profile must be baseline, main or high");
+                }
+            } else if (arg == "--realtime") {
+                options.isRealtime = true;
+            } else if (arg.compare(0, 2, "--") == 0 || !options.path.empty()) {
+                usage(("Unexpected argument " + arg).c_str());
+            } else {
+                options.path = arg;
+            }
+        }
+
+        if (options.path.empty()) {
+            usage("No clip given");
+        }
+        return options;
+    }
+
+    // Reads 4:2:0 frames from a Y4M file, or from a headerless file of back-to-back I420 frames
+    class ClipReader {
+    public:
+        explicit ClipReader(Options & options) : file(options.path, std::ios::binary) {
+            if (!file) {
+                usage(("Can't open " + options.path).c_str());
+            }
+
+            char magic[9] = {};
+            file.read(magic, sizeof(magic) - 1);
+            isY4m = file && std::strcmp(magic, "YUV4MPEG") == 0;
+            if (isY4m) {
+                std::string header;
+                std::getline(file, header);
+                parseY4mHeader(header, options);
+            } else {
+                file.seekg(0);
+            }
+
+            if (options.width <= 0 || options.height <= 0 || options.fps <= 0.0) {
+                usage("Raw clips need --size and --fps");
+            }
+            frameBytes = options.width * options.height + 2 * ((options.width + 1) / 2) * ((options.height + 1) / 2);
+        }
+
+        bool readFrame(std::vector<uint8_t> & frame) {
+            if (isY4m) {
+                std::string frameHeader;
+                if (!std::getline(file, frameHeader) || frameHeader.compare(0, 5, "FRAME") != 0) {
+                    return false;
+                }
+            }
+            frame.resize(frameBytes);
+            file.read(reinterpret_cast<char *>(frame.data()), frameBytes);
+            return file.gcount() == static_cast<std::streamsize>(frameBytes);
+        }
+
+    private:
+        void parseY4mHeader(std::string const & header, Options & options) {
+            double clipFps = 0.0;
+            size_t start = 0;
+            while (start < header.size()) {
+                auto end = header.find(' ', start);
+                if (end == std::string::npos) {
+                    end = header.size();
+                }
+                auto token = header.substr(start, end - start);
+                start = end + 1;
+                if (token.empty()) {
+                    continue;
+                }
+
+                switch (token[0]) {
+                case 'W':
+                    options.width = std::atoi(token.c_str() + 1);
+                    break;
+                case 'H':
+                    options.height = std::atoi(token.c_str() + 1);
+                    break;
+                case 'F': {
+                    int numerator = 0;
+                    int denominator = 0;
+                    if (std::sscanf(token.c_str() + 1, "%d:%d", &numerator, &denominator) == 2 && denominator > 0) {
+                        clipFps = static_cast<double>(numerator) / denominator;
+                    }
+                    break;
+                }
+                case 'C':
+                    // 10 bit variants are C420p10 and so on
+                    if (token.compare(1, 3, "420") != 0 || token.compare(1, 5, "420p1") == 0) {
+                        usage(("Only 4:2:0 Y4M clips are supported, not " + token).c_str());
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (options.fps <= 0.0) {
+                options.fps = clipFps;
+            }
+        }
+
+        std::ifstream file;
+        bool isY4m = false;
+        size_t frameBytes = 0;
+    };
+
+    // Collects the size, quality and latency of every encoded frame
+    class ResultCallback : public webrtc::EncodedImageCallback {
+    public:
+        explicit ResultCallback(X264Encoder & encoder) : encoder(encoder) {}
+
+        virtual Result OnEncodedImage(
+                webrtc::EncodedImage const & encodedImage,
+                webrtc::CodecSpecificInfo const * codecSpecificInfo,
+                webrtc::RTPFragmentationHeader const * fragmentation) override {
+            bytes += encodedImage._length;
+            auto quality = encoder.getLastFrameQuality();
+            psnrs.push_back(quality.psnr);
+            ssims.push_back(quality.ssim);
+
+            auto submitted = submitTimes.find(encodedImage.capture_time_ms_);
+            if (submitted != submitTimes.end()) {
+                std::chrono::duration<double, std::milli> latency = Clock::now() - submitted->second;
+                latencies.push_back(latency.count());
+                submitTimes.erase(submitted);
+            }
+            return Result(Result::OK);
+        }
+
+        X264Encoder & encoder;
+        std::map<int64_t, Clock::time_point> submitTimes;
+        uint64_t bytes = 0;
+        std::vector<double> latencies;
+        std::vector<double> psnrs;
+        std::vector<double> ssims;
+    };
+
+    // Hands frames from the capturer to the encoder, opening it at the size of the first frame
+    class EncoderSink : public rtc::VideoSinkInterface<webrtc::VideoFrame> {
+    public:
+        EncoderSink(X264Encoder & encoder, ResultCallback & callback, Options const & options)
+            : encoder(encoder), callback(callback), options(options) {}
+
+        // The capturer aligns timestamps to the system clock, which would squeeze a clip fed faster than real time.
+        // Frames are restamped with their time in the clip so rate control sees the clip's real cadence.
+        void setSourceTimestamp(int64_t timestampUs) { sourceTimestampUs = timestampUs; }
+
+        virtual void OnFrame(webrtc::VideoFrame const & capturedFrame) override {
+            if (!isInitialized) {
+                webrtc::VideoCodec settings;
+                settings.codecType = webrtc::kVideoCodecH264;
+                settings.width = static_cast<uint16_t>(capturedFrame.width());
+                settings.height = static_cast<uint16_t>(capturedFrame.height());
+                settings.maxFramerate = static_cast<uint32_t>(options.fps + 0.5);
+                settings.startBitrate = options.bitrateKbps;
+                settings.maxBitrate = options.bitrateKbps;
+                if (encoder.InitEncode(&settings, static_cast<int32_t>(std::thread::hardware_concurrency()), 1200) !=
+                    WEBRTC_VIDEO_CODEC_OK) {
+                    usage("Failed to initialize the encoder");
+                }
+
+                webrtc::BitrateAllocation allocation;
+                allocation.SetBitrate(0, 0, options.bitrateKbps * 1000);
+                encoder.SetRateAllocation(allocation, settings.maxFramerate);
+                isInitialized = true;
+            }
+
+            webrtc::VideoFrame frame(
+                    capturedFrame.video_frame_buffer(), webrtc::kVideoRotation_0, sourceTimestampUs);
+            frame.set_timestamp(static_cast<uint32_t>(sourceTimestampUs * 90 / 1000));
+            callback.submitTimes[frame.render_time_ms()] = Clock::now();
+            encoder.Encode(frame, nullptr, nullptr);
+            ++encodedFrames;
+        }
+
+        uint64_t encodedFrames = 0;
+
+    private:
+        X264Encoder & encoder;
+        ResultCallback & callback;
+        Options const & options;
+        bool isInitialized = false;
+        int64_t sourceTimestampUs = 0;
+    };
+
+    double percentile(std::vector<double> values, double fraction) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        auto index = std::min(values.size() - 1, static_cast<size_t>(fraction * values.size()));
+        return values[index];
+    }
+
+    double mean(std::vector<double> const & values) {
+        double sum = 0.0;
+        for (auto value : values) {
+            sum += value;
+        }
+        return values.empty() ? 0.0 : sum / values.size();
+    }
+
+    char const * threadingName(Options const & options) {
+        switch (options.threading) {
+        case caff_EncoderThreadingSliced:
+            return "sliced";
+        case caff_EncoderThreadingFrame:
+            return "frame";
+        case caff_EncoderThreadingSingle:
+        default:
+            return "single";
+        }
+    }
+} // namespace
+
+int main(int argc, char ** argv) {
+    auto options = parseOptions(argc, argv);
+    ClipReader reader(options);
+
+    auto encoderControl = std::make_shared<EncoderControl>();
+    encoderControl->setThreading(options.threading, options.maxLatencyFrames);
+
+    cricket::VideoCodec codec(cricket::kH264CodecName);
+    codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+    auto profileId = webrtc::H264::ProfileLevelIdToString(
+            webrtc::H264::ProfileLevelId(options.profile, webrtc::H264::kLevel3_1));
+    codec.SetParam(cricket::kH264FmtpProfileLevelId, profileId.value());
+
+    X264Encoder encoder(codec, encoderControl);
+    X264Encoder::OfflineOptions offlineOptions;
+    offlineOptions.speedLevel = options.speedLevel;
+    offlineOptions.crf = options.crf;
+    offlineOptions.measureQuality = true;
+    encoder.setOfflineOptions(offlineOptions);
+
+    ResultCallback callback(encoder);
+    encoder.RegisterEncodeCompleteCallback(&callback);
+
+    EncoderSink sink(encoder, callback, options);
+    VideoCapturer capturer;
+    capturer.SetFramerateLimit(static_cast<int32_t>(options.fps + 0.5));
+    capturer.EnableFrameAdaption(false);
+    // Calm stretches of the clip would otherwise be captured at 30 fps, making runs incomparable
+    capturer.setMotionAdaptation(false);
+    capturer.Start(cricket::VideoFormat(
+            options.width, options.height, cricket::VideoFormat::FpsToInterval(options.fps), cricket::FOURCC_I420));
+    capturer.AddOrUpdateSink(&sink, rtc::VideoSinkWants());
+
+    std::vector<uint8_t> frame;
+    long sourceFrames = 0;
+    auto start = Clock::now();
+    while ((options.frames < 0 || sourceFrames < options.frames) && reader.readFrame(frame)) {
+        auto timestamp = std::chrono::microseconds(static_cast<int64_t>(sourceFrames * 1'000'000 / options.fps));
+        if (options.isRealtime) {
+            std::this_thread::sleep_until(start + timestamp);
+        }
+
+        sink.setSourceTimestamp(timestamp.count());
+        capturer.sendVideo(
+                webrtc::VideoType::kI420, frame.data(), frame.size(), options.width, options.height, timestamp);
+        ++sourceFrames;
+    }
+    std::chrono::duration<double> elapsed = Clock::now() - start;
+
+    capturer.RemoveSink(&sink);
+    encoder.Release();
+
+    if (sourceFrames == 0) {
+        usage("The clip has no complete frames");
+    }
+
+    double clipSeconds = sourceFrames / options.fps;
+    std::printf(
+            "%dx%d at %.2f fps, captured at %d fps, %ld source frames, %llu encoded, %llu output\n\n",
+            options.width,
+            options.height,
+            options.fps,
+            capturer.getFramerate(),
+            sourceFrames,
+            static_cast<unsigned long long>(sink.encodedFrames),
+            static_cast<unsigned long long>(callback.latencies.size()));
+    std::printf(
+            "%-8s %-10s %6s %6s %8s %10s %9s %9s %9s %8s %8s\n",
+            "preset",
+            "threading",
+            "crf",
+            "fps",
+            "kbps",
+            "p50 ms",
+            "p95 ms",
+            "p99 ms",
+            "max ms",
+            "PSNR",
+            "SSIM");
+    std::printf(
+            "%-8d %-10s %6.1f %6.1f %8.1f %10.2f %9.2f %9.2f %9.2f %8.2f %8.4f\n",
+            encoderControl->getSpeedStats().level,
+            threadingName(options),
+            options.crf,
+            sink.encodedFrames / elapsed.count(),
+            callback.bytes * 8.0 / clipSeconds / 1000.0,
+            percentile(callback.latencies, 0.5),
+            percentile(callback.latencies, 0.95),
+            percentile(callback.latencies, 0.99),
+            percentile(callback.latencies, 1.0),
+            mean(callback.psnrs),
+            mean(callback.ssims));
+
+    return 0;
+}
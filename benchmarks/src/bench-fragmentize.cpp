@@ -0,0 +1,106 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+// Compares rtpFragmentize, which points the encoded image at x264's output, against copying every NAL unit into a
+// separate buffer behind a fresh 4 byte start code, for frames shaped like real x264 output
+
+#include "BenchmarkUtils.hpp"
+#include "X264Encoder.hpp"
+
+#include <cstring>
+
+using namespace caff;
+
+namespace {
+    struct FrameShape {
+        char const * name;
+        size_t headerBytes;  // SPS, PPS and SEI on key frames
+        size_t sliceCount;
+        size_t sliceBytes;
+    };
+
+    // Lays out NAL units back to back the way x264 does, each with a 4 byte length prefix
+    std::vector<x264_nal_t> layOutNals(FrameShape const & shape, std::vector<uint8_t> & output) {
+        std::vector<size_t> sizes;
+        if (shape.headerBytes > 0) {
+            sizes.push_back(shape.headerBytes);
+        }
+        sizes.insert(sizes.end(), shape.sliceCount, shape.sliceBytes);
+
+        size_t total = 0;
+        for (auto size : sizes) {
+            total += size;
+        }
+        output = randomBytes(total);
+
+        std::vector<x264_nal_t> nals;
+        size_t offset = 0;
+        for (auto size : sizes) {
+            x264_nal_t nal = {};
+            nal.p_payload = output.data() + offset;
+            nal.i_payload = static_cast<int>(size);
+            nals.push_back(nal);
+            offset += size;
+        }
+        return nals;
+    }
+
+    // What fragmentizing cost before: a full copy of the frame
+    void copyFragmentize(
+            webrtc::EncodedImage * encodedImage,
+            std::vector<uint8_t> * buffer,
+            std::vector<x264_nal_t> const & nals,
+            webrtc::RTPFragmentationHeader * fragHeader) {
+        uint8_t const startCode[4] = { 0, 0, 0, 1 };
+        size_t requiredSize = 0;
+        for (auto const & nal : nals) {
+            requiredSize += nal.i_payload;
+        }
+        buffer->resize(requiredSize);
+
+        fragHeader->VerifyAndAllocateFragmentationHeader(nals.size());
+        size_t length = 0;
+        for (size_t frag = 0; frag < nals.size(); ++frag) {
+            size_t naluSize = nals[frag].i_payload - sizeof(startCode);
+            memcpy(buffer->data() + length, startCode, sizeof(startCode));
+            length += sizeof(startCode);
+            memcpy(buffer->data() + length, nals[frag].p_payload + sizeof(startCode), naluSize);
+            fragHeader->fragmentationOffset[frag] = length;
+            fragHeader->fragmentationLength[frag] = naluSize;
+            length += naluSize;
+        }
+        encodedImage->_buffer = buffer->data();
+        encodedImage->_size = buffer->size();
+        encodedImage->_length = length;
+    }
+} // namespace
+
+int main() {
+    int constexpr iterations = 2000;
+
+    FrameShape const shapes[] = {
+        { "720p delta, 1 slice", 0, 1, 12 * 1024 },
+        { "720p key, 1 slice", 700, 1, 90 * 1024 },
+        { "1080p key, 4 slices", 700, 4, 80 * 1024 },
+        { "1080p key, 1200B slices", 700, 270, 1200 },
+    };
+
+    std::printf("%-26s %12s %12s %12s\n", "frame", "bytes", "copy us", "in place us");
+
+    for (auto const & shape : shapes) {
+        std::vector<uint8_t> output;
+        auto nals = layOutNals(shape, output);
+
+        webrtc::EncodedImage encodedImage;
+        webrtc::RTPFragmentationHeader fragHeader;
+        std::vector<uint8_t> buffer;
+
+        auto copy = measureMicros(iterations, [&] { copyFragmentize(&encodedImage, &buffer, nals, &fragHeader); });
+        auto inPlace = measureMicros(iterations, [&] {
+            rtpFragmentize(&encodedImage, &buffer, static_cast<uint32_t>(nals.size()), nals.data(), &fragHeader);
+        });
+
+        std::printf("%-26s %12zu %12.2f %12.2f\n", shape.name, output.size(), copy, inPlace);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+// Encodes the same 720p clip in H.264 packetization mode 0, where every slice must fit in one RTP packet, and mode 1,
+// where whole-frame slices are split into FU-A packets, and compares bitrate, slices per frame and encode time
+
+#include "BenchmarkUtils.hpp"
+#include "X264Encoder.hpp"
+
+#include "media/base/mediaconstants.h"
+
+using namespace caff;
+
+namespace {
+    struct ModeCase {
+        char const * packetizationMode;
+        char const * name;
+    };
+
+    class StatsCallback : public webrtc::EncodedImageCallback {
+    public:
+        virtual Result OnEncodedImage(
+                webrtc::EncodedImage const & encodedImage,
+                webrtc::CodecSpecificInfo const * codecSpecificInfo,
+                webrtc::RTPFragmentationHeader const * fragmentation) override {
+            ++frames;
+            bytes += encodedImage._length;
+            nalUnits += fragmentation->fragmentationVectorSize;
+            return Result(Result::OK);
+        }
+
+        uint64_t frames = 0;
+        uint64_t bytes = 0;
+        uint64_t nalUnits = 0;
+    };
+} // namespace
+
+int main() {
+    int constexpr width = 1280;
+    int constexpr height = 720;
+    int constexpr fps = 30;
+    int constexpr frameCount = 300;
+    size_t constexpr maxPayloadSize = 1200;
+
+    ModeCase const cases[] = { { "0", "single NAL" }, { "1", "non-interleaved" } };
+    uint32_t const bitrates[] = { 2500, 6000 };
+
+    std::vector<rtc::scoped_refptr<webrtc::I420Buffer>> clip;
+    auto noise = randomBytes(256 * 256);
+    for (int i = 0; i < 64; ++i) {
+        auto buffer = webrtc::I420Buffer::Create(width, height);
+        drawMovingPattern(buffer.get(), i, noise);
+        clip.push_back(buffer);
+    }
+
+    std::printf("%dx%d at %d fps, %d frames, %zu byte payloads\n\n", width, height, fps, frameCount, maxPayloadSize);
+    std::printf(
+            "%-16s %12s %12s %14s %16s\n", "mode", "target kbps", "output kbps", "NALs per frame", "encode us/frame");
+
+    for (auto bitrate : bitrates) {
+        for (auto const & modeCase : cases) {
+            cricket::VideoCodec codec(cricket::kH264CodecName);
+            codec.SetParam(cricket::kH264FmtpPacketizationMode, modeCase.packetizationMode);
+            X264Encoder encoder(codec, nullptr);
+
+            StatsCallback callback;
+            encoder.RegisterEncodeCompleteCallback(&callback);
+
+            webrtc::VideoCodec settings;
+            settings.codecType = webrtc::kVideoCodecH264;
+            settings.width = width;
+            settings.height = height;
+            settings.maxFramerate = fps;
+            settings.startBitrate = bitrate;
+            settings.maxBitrate = bitrate;
+            if (encoder.InitEncode(&settings, 1, maxPayloadSize) != WEBRTC_VIDEO_CODEC_OK) {
+                std::printf("%-16s failed to initialize\n", modeCase.name);
+                continue;
+            }
+
+            int index = 0;
+            auto encodeMicros = measureMicros(frameCount, [&] {
+                webrtc::VideoFrame frame(clip[index % clip.size()], webrtc::kVideoRotation_0, index * (1000000 / fps));
+                frame.set_timestamp(static_cast<uint32_t>(index) * (90000 / fps));
+                ++index;
+                encoder.Encode(frame, nullptr, nullptr);
+            });
+            encoder.Release();
+
+            double outputKbps = callback.bytes * 8.0 * fps / callback.frames / 1000.0;
+            double nalsPerFrame = static_cast<double>(callback.nalUnits) / callback.frames;
+            std::printf(
+                    "%-16s %12u %12.1f %14.1f %16.1f\n",
+                    modeCase.name,
+                    bitrate,
+                    outputKbps,
+                    nalsPerFrame,
+                    encodeMicros);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+// Compares converting to I420 and then scaling against scaling before conversion, for every caff_VideoFormat, on one
+// thread and split across a worker pool
+
+#include "BenchmarkUtils.hpp"
+#include "VideoConversion.hpp"
+#include "WorkerPool.hpp"
+#include "caffeine.h"
+
+#include <thread>
+
+#include "api/video/i420_buffer.h"
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+
+using namespace caff;
+
+struct FormatName {
+    caff_VideoFormat format;
+    char const * name;
+};
+
+static FormatName const formats[] = {
+    { caff_VideoFormatI420, "I420" },         { caff_VideoFormatIyuv, "IYUV" },
+    { caff_VideoFormatRgb24, "RGB24" },       { caff_VideoFormatAbgr, "ABGR" },
+    { caff_VideoFormatArgb, "ARGB" },         { caff_VideoFormatArgb4444, "ARGB4444" },
+    { caff_VideoFormatRgb565, "RGB565" },     { caff_VideoFormatArgb1555, "ARGB1555" },
+    { caff_VideoFormatYuy2, "YUY2" },         { caff_VideoFormatYv12, "YV12" },
+    { caff_VideoFormatUyvy, "UYVY" },         { caff_VideoFormatMjpeg, "MJPEG" },
+    { caff_VideoFormatNv21, "NV21" },         { caff_VideoFormatNv12, "NV12" },
+    { caff_VideoFormatBgra, "BGRA" },
+};
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+int main() {
+    int constexpr iterations = 100;
+    Resolution const sources[] = { { 1920, 1080 }, { 2560, 1440 }, { 3440, 1440 }, { 3840, 2160 } };
+    Resolution const target = { 1280, 720 };
+
+    size_t threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    WorkerPool workerPool(threadCount);
+    std::printf("Worker pool: %zu threads plus the calling thread\n\n", threadCount);
+
+    std::printf(
+            "%-10s %-10s %14s %14s %14s %14s\n",
+            "format",
+            "source",
+            "two-pass us",
+            "two-pass mt us",
+            "fused us",
+            "fused mt us");
+
+    for (auto const & source : sources) {
+        auto unscaled = webrtc::I420Buffer::Create(source.width, source.height);
+        // Ultrawide sources keep their aspect ratio
+        auto scaled = webrtc::I420Buffer::Create(source.width * target.height / source.height / 2 * 2, target.height);
+        std::vector<uint8_t> scratch;
+
+        for (auto const & entry : formats) {
+            auto format = static_cast<webrtc::VideoType>(entry.format);
+            char sourceName[16];
+            std::snprintf(sourceName, sizeof(sourceName), "%dx%d", source.width, source.height);
+
+            if (entry.format == caff_VideoFormatMjpeg) {
+                // Random bytes are not a decodable JPEG
+                std::printf("%-10s %-10s %14s\n", entry.name, sourceName, "skipped");
+                continue;
+            }
+
+            auto frameBytes = webrtc::CalcBufferSize(format, source.width, source.height);
+            auto frame = randomBytes(frameBytes);
+
+            auto twoPass = [&](WorkerPool * pool) {
+                return measureMicros(iterations, [&] {
+                    convertToI420(
+                            format,
+                            frame.data(),
+                            0,
+                            0,
+                            source.width,
+                            source.height,
+                            frameBytes,
+                            webrtc::kVideoRotation_0,
+                            unscaled.get(),
+                            pool);
+                    scaleI420(*unscaled, scaled.get(), pool);
+                });
+            };
+            auto twoPassSingle = twoPass(nullptr);
+            auto twoPassParallel = twoPass(&workerPool);
+
+            if (!canScaleBeforeConversion(format)) {
+                std::printf(
+                        "%-10s %-10s %14.1f %14.1f %14s %14s\n",
+                        entry.name,
+                        sourceName,
+                        twoPassSingle,
+                        twoPassParallel,
+                        "n/a",
+                        "n/a");
+                continue;
+            }
+
+            auto fused = [&](WorkerPool * pool) {
+                return measureMicros(iterations, [&] {
+                    scaleAndConvertToI420(
+                            format,
+                            frame.data(),
+                            packedRowBytes(format, source.width),
+                            source.width,
+                            source.height,
+                            scratch,
+                            scaled.get(),
+                            pool);
+                });
+            };
+            auto fusedSingle = fused(nullptr);
+            auto fusedParallel = fused(&workerPool);
+
+            std::printf(
+                    "%-10s %-10s %14.1f %14.1f %14.1f %14.1f\n",
+                    entry.name,
+                    sourceName,
+                    twoPassSingle,
+                    twoPassParallel,
+                    fusedSingle,
+                    fusedParallel);
+        }
+    }
+
+    return 0;
+}
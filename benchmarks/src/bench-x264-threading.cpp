@@ -0,0 +1,138 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+// Encodes the same 720p60 clip with each caff_EncoderThreading mode and reports throughput and the delay from handing
+// a frame to the encoder until its encoded image comes back. Frames are submitted as fast as the encoder takes them, so
+// in a live broadcast the added delay is the "delay frames" column times the frame interval, not the measured time
+
+#include "BenchmarkUtils.hpp"
+#include "EncoderControl.hpp"
+#include "X264Encoder.hpp"
+#include "caffeine.h"
+
+#include <thread>
+#include <unordered_map>
+
+#include "media/base/mediaconstants.h"
+
+using namespace caff;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct ThreadingCase {
+        caff_EncoderThreading mode;
+        int32_t maxLatencyFrames;
+        char const * name;
+    };
+
+    struct Submission {
+        Clock::time_point time;
+        int index;
+    };
+
+    // Records when each frame comes back out of the encoder, keyed by RTP timestamp
+    class LatencyCallback : public webrtc::EncodedImageCallback {
+    public:
+        virtual Result OnEncodedImage(
+                webrtc::EncodedImage const & encodedImage,
+                webrtc::CodecSpecificInfo const * codecSpecificInfo,
+                webrtc::RTPFragmentationHeader const * fragmentation) override {
+            auto submitted = submitTimes.find(encodedImage._timeStamp);
+            if (submitted != submitTimes.end()) {
+                std::chrono::duration<double, std::milli> latency = Clock::now() - submitted->second.time;
+                latencies.push_back(latency.count());
+                maxDelayFrames = std::max(maxDelayFrames, currentIndex - submitted->second.index);
+                submitTimes.erase(submitted);
+            }
+            return Result(Result::OK);
+        }
+
+        std::unordered_map<uint32_t, Submission> submitTimes;
+        std::vector<double> latencies;
+        int currentIndex = 0;
+        int maxDelayFrames = 0;
+    };
+} // namespace
+
+int main() {
+    int constexpr width = 1280;
+    int constexpr height = 720;
+    int constexpr fps = 60;
+    int constexpr frameCount = 600;
+    int32_t const cores = static_cast<int32_t>(std::max(std::thread::hardware_concurrency(), 1u));
+
+    ThreadingCase const cases[] = {
+        { caff_EncoderThreadingSingle, 0, "single" },   { caff_EncoderThreadingSliced, 0, "sliced" },
+        { caff_EncoderThreadingFrame, 1, "frame x1" },  { caff_EncoderThreadingFrame, 2, "frame x2" },
+        { caff_EncoderThreadingFrame, 4, "frame x4" },
+    };
+
+    std::vector<rtc::scoped_refptr<webrtc::I420Buffer>> clip;
+    auto noise = randomBytes(256 * 256);
+    for (int i = 0; i < 64; ++i) {
+        auto buffer = webrtc::I420Buffer::Create(width, height);
+        drawMovingPattern(buffer.get(), i, noise);
+        clip.push_back(buffer);
+    }
+
+    webrtc::VideoCodec settings;
+    settings.codecType = webrtc::kVideoCodecH264;
+    settings.width = width;
+    settings.height = height;
+    settings.maxFramerate = fps;
+    settings.startBitrate = 4000;
+    settings.maxBitrate = 6000;
+
+    std::printf("%dx%d, %d frames, %d cores\n\n", width, height, frameCount, cores);
+    std::printf(
+            "%-10s %12s %16s %16s %13s\n", "mode", "encode fps", "mean latency ms", "p95 latency ms", "delay frames");
+
+    for (auto const & threadingCase : cases) {
+        auto encoderControl = std::make_shared<EncoderControl>();
+        encoderControl->setThreading(threadingCase.mode, threadingCase.maxLatencyFrames);
+
+        cricket::VideoCodec codec(cricket::kH264CodecName);
+        codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+        X264Encoder encoder(codec, encoderControl);
+
+        LatencyCallback callback;
+        encoder.RegisterEncodeCompleteCallback(&callback);
+        if (encoder.InitEncode(&settings, cores, 1200) != WEBRTC_VIDEO_CODEC_OK) {
+            std::printf("%-10s failed to initialize\n", threadingCase.name);
+            continue;
+        }
+
+        auto start = Clock::now();
+        for (int i = 0; i < frameCount; ++i) {
+            uint32_t rtpTimestamp = static_cast<uint32_t>(i) * (90000 / fps);
+            webrtc::VideoFrame frame(clip[i % clip.size()], webrtc::kVideoRotation_0, i * (1000000 / fps));
+            frame.set_timestamp(rtpTimestamp);
+
+            callback.submitTimes[rtpTimestamp] = { Clock::now(), i };
+            callback.currentIndex = i;
+            encoder.Encode(frame, nullptr, nullptr);
+        }
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+        encoder.Release();
+
+        // Frames still inside the encoder's pipeline at the end are not counted
+        auto & latencies = callback.latencies;
+        std::sort(latencies.begin(), latencies.end());
+        double mean = 0.0;
+        for (auto latency : latencies) {
+            mean += latency;
+        }
+        mean = latencies.empty() ? 0.0 : mean / latencies.size();
+        double p95 = latencies.empty() ? 0.0 : latencies[latencies.size() * 95 / 100];
+
+        std::printf(
+                "%-10s %12.1f %16.2f %16.2f %13d\n",
+                threadingCase.name,
+                frameCount / elapsed.count(),
+                mean,
+                p95,
+                callback.maxDelayFrames);
+    }
+
+    return 0;
+}
@@ -137,6 +137,102 @@ typedef enum caff_ConnectionQuality {
 } caff_ConnectionQuality;
 
 
+//! What to discard when the asynchronous video queue is full
+/*!
+\see caff_setAsyncVideo()
+*/
+typedef enum caff_VideoDropPolicy {
+    caff_VideoDropPolicyOldest, //!< Discard the oldest queued frame to make room for the new one
+    caff_VideoDropPolicyNewest, //!< Discard the frame being sent
+
+    //! Used for bounds checking
+    caff_VideoDropPolicyLast = caff_VideoDropPolicyNewest
+} caff_VideoDropPolicy;
+
+
+//! How the video encoder spreads its work across CPU cores
+/*!
+\see caff_setEncoderThreading()
+*/
+typedef enum caff_EncoderThreading {
+    caff_EncoderThreadingSingle, //!< Encode on a single thread
+    caff_EncoderThreadingSliced, //!< Split each frame into slices encoded in parallel. Adds no latency
+    caff_EncoderThreadingFrame,  //!< Encode several frames in parallel. Scales better, but delays each frame
+
+    //! Used for bounds checking
+    caff_EncoderThreadingLast = caff_EncoderThreadingFrame
+} caff_EncoderThreading;
+
+
+//! The kind of picture a game produces, which decides how the video encoder spends bits and CPU time
+/*!
+\see caff_setGameContentProfile()
+*/
+typedef enum caff_ContentProfile {
+    caff_ContentProfileDefault,    //!< Balanced settings, used for games without a profile
+    caff_ContentProfileFastMotion, //!< Shooters, racing and other fast action. Spends more bits on each frame
+    caff_ContentProfileStatic,     //!< Card, board and strategy games. Limits framerate and encoder CPU time
+
+    //! Used for bounds checking
+    caff_ContentProfileLast = caff_ContentProfileStatic
+} caff_ContentProfile;
+
+
+//! Whether video is encoded as screen content: desktops, code editors, and slow-moving games like strategy titles
+/*!
+\see caff_setScreenContentMode()
+*/
+typedef enum caff_ScreenContentMode {
+    caff_ScreenContentOff,  //!< Always encode as camera-like video
+    caff_ScreenContentOn,   //!< Always encode as screen content
+    caff_ScreenContentAuto, //!< Switch to screen content while little of the picture changes from frame to frame
+
+    //! Used for bounds checking
+    caff_ScreenContentLast = caff_ScreenContentAuto
+} caff_ScreenContentMode;
+
+
+//! A part of the picture that should be encoded at a different quality than the rest
+/*!
+Positions are fractions of the frame size, so regions stay in place when the encoder scales the video.
+
+\see caff_setVideoRegionsOfInterest()
+*/
+typedef struct caff_VideoRegion {
+    float x;        //!< Left edge, from 0 (left of the frame) to 1
+    float y;        //!< Top edge, from 0 (top of the frame) to 1
+    float width;    //!< Width, as a fraction of the frame width
+    float height;   //!< Height, as a fraction of the frame height
+    float qpOffset; //!< Change in quantizer, from -12 to 12. Negative values give the region more bits
+} caff_VideoRegion;
+
+
+//! Counters describing the video pipeline of the current broadcast
+/*!
+\see caff_getVideoStats()
+*/
+typedef struct caff_VideoStats {
+    uint64_t bufferPoolHits;        //!< Frames whose I420 buffer was recycled from the buffer pool
+    uint64_t bufferPoolMisses;      //!< Frames that needed a newly allocated I420 buffer
+    uint32_t queueDepth;            //!< Frames waiting in the asynchronous video queue
+    uint64_t queueDroppedFrames;    //!< Frames discarded because the asynchronous video queue was full
+    uint64_t acceptedFrames;        //!< Frames kept by the framerate limiter
+    uint64_t decimatedFrames;       //!< Frames discarded by the framerate limiter to hold the target framerate
+    uint64_t lateFrames;            //!< Kept frames that arrived too late for their place in the output cadence, from a
+                                    //!< source that otherwise keeps up with the target framerate
+    uint64_t elidedFrames;          //!< Frames identical to the previous one that were not converted or encoded
+    uint64_t repeatedFrames;        //!< Frames identical to the previous one that were re-sent without conversion
+    int32_t encoderSpeedLevel;      //!< x264 preset: 0 ultrafast, 1 superfast, 2 veryfast, 3 faster, or -1
+    uint64_t encoderSpeedIncreases; //!< Switches to a faster preset because encoding could not keep up
+    uint64_t encoderSpeedDecreases; //!< Switches to a slower preset because encoding had time to spare
+    bool isScreenContent;           //!< Whether video is currently encoded as screen content
+    int32_t captureFramerate;       //!< Framerate video is captured at, lowered to 30 fps while little moves
+    int64_t firstFrameMicros;       //!< Time from the first frame sent until the encoder's first output, or -1
+    int32_t targetKbps;             //!< Bitrate WebRTC asks of the encoder, following bandwidth estimation, or 0
+    int32_t targetFramerate;        //!< Framerate WebRTC asks of the encoder, or 0
+} caff_VideoStats;
+
+
 enum {
     //! Tells caff_sendVideo() to generate a frame timestamp from the current system time
     caff_TimestampGenerate = -1ll
@@ -204,6 +300,31 @@ This is called when the stream failed
 typedef void (*caff_BroadcastFailedCallback)(void * userData, caff_Result error);
 
 
+//! Video plane release callback
+/*!
+This is called once libcaffeine no longer needs the planes passed to caff_sendVideoPlanes(). It may be called from any
+thread, and may be called before caff_sendVideoPlanes() returns.
+
+\param userData is the pointer provided to caff_sendVideoPlanes()
+
+\see caff_sendVideoPlanes()
+*/
+typedef void (*caff_VideoPlanesReleaseCallback)(void * userData);
+
+
+//! Key frame request callback
+/*!
+This is called when a viewer needs a key frame to start or resume decoding video sent with caff_sendEncodedVideo(). The
+application should make the next frame it encodes a key frame (IDR). It is called from a libcaffeine thread and must
+not block.
+
+\param userData is the pointer provided to caff_setEncodedVideo()
+
+\see caff_setEncodedVideo()
+*/
+typedef void (*caff_KeyFrameRequestCallback)(void * userData);
+
+
 //! Get a string representation of an error enum
 /*!
 \param result the result code
@@ -497,6 +618,9 @@ to be strictly synchronized.
 For best results, \p height should be `720` and \p format should be ::caff_VideoFormatI420. This will avoid costs of
 rescaling and reformatting by WebRTC.
 
+If asynchronous video is enabled with caff_setAsyncVideo(), the frame is copied and the rest of the work happens on a
+libcaffeine thread.
+
 \param instanceHandle the instance returned by caff_createInstance()
 \param format the format of the raw pixel data
 \param framePixels the raw pixel data
@@ -519,6 +643,247 @@ CAFFEINE_API void caff_sendVideo(
         int64_t timestampMicros);
 
 
+//! Broadcasts a frame of video whose rows are padded
+/*!
+This behaves like caff_sendVideo(), but the rows of the frame may be further apart than the width of the image, as is
+common for GPU readback and capture surfaces. Only single-plane formats are accepted; for planar formats with padded
+rows, use caff_sendVideoPlanes(), which takes a stride for each plane.
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param format the format of the raw pixel data. Must be one of ::caff_VideoFormatRgb24, ::caff_VideoFormatAbgr,
+    ::caff_VideoFormatArgb, ::caff_VideoFormatBgra, ::caff_VideoFormatArgb4444, ::caff_VideoFormatRgb565,
+    ::caff_VideoFormatArgb1555, ::caff_VideoFormatYuy2, or ::caff_VideoFormatUyvy
+\param framePixels the raw pixel data, starting with the first pixel of the top row
+\param frameTotalBytes the number of bytes of pixel data, including padding between rows. The final row does not need
+    to be padded
+\param stride the number of bytes between the starts of consecutive rows
+\param width the frame width
+\param height the frame height
+\param timestampMicros the timestamp for the video frame. You can pass ::caff_TimestampGenerate to use the current
+    system time
+
+\see caff_sendVideo()
+\see caff_sendVideoPlanes()
+*/
+CAFFEINE_API void caff_sendVideoStrided(
+        caff_InstanceHandle instanceHandle,
+        caff_VideoFormat format,
+        uint8_t const * framePixels,
+        size_t frameTotalBytes,
+        int32_t stride,
+        int32_t width,
+        int32_t height,
+        int64_t timestampMicros);
+
+
+//! Broadcasts a frame of planar video without copying it
+/*!
+This behaves like caff_sendVideo(), but takes the frame as separate planes owned by the application. Frames in
+::caff_VideoFormatI420, ::caff_VideoFormatIyuv, or ::caff_VideoFormatYv12 are handed to the encoder as-is, so the
+application must not modify or free the planes until \p releaseCallback is called. Frames in ::caff_VideoFormatNv12 or
+::caff_VideoFormatNv21 are converted to I420 before \p releaseCallback is called.
+
+If asynchronous video is enabled with caff_setAsyncVideo(), the planes are queued by reference rather than copied.
+
+\p releaseCallback is called exactly once for every call to this function, including when the frame is dropped or the
+broadcast is offline.
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param format the format of the planes. Must be one of ::caff_VideoFormatI420, ::caff_VideoFormatIyuv,
+    ::caff_VideoFormatYv12, ::caff_VideoFormatNv12, or ::caff_VideoFormatNv21
+\param planes the Y, U, and V planes, in that order regardless of the format's memory layout. For biplanar formats,
+    `planes[1]` is the interleaved chroma plane and `planes[2]` is ignored
+\param strides the number of bytes between the starts of consecutive rows of each plane
+\param width the frame width
+\param height the frame height
+\param timestampMicros the timestamp for the video frame. You can pass ::caff_TimestampGenerate to use the current
+    system time
+\param releaseCallback called when libcaffeine no longer references the planes
+\param releaseUserData an arbitrary pointer passed unmodified to \p releaseCallback
+
+\see caff_sendVideo()
+\see caff_VideoPlanesReleaseCallback
+*/
+CAFFEINE_API void caff_sendVideoPlanes(
+        caff_InstanceHandle instanceHandle,
+        caff_VideoFormat format,
+        uint8_t const * const planes[3],
+        int32_t const strides[3],
+        int32_t width,
+        int32_t height,
+        int64_t timestampMicros,
+        caff_VideoPlanesReleaseCallback releaseCallback,
+        void * releaseUserData);
+
+
+//! Broadcast video the application has already encoded
+/*!
+When enabled, libcaffeine does not encode video itself. Access units sent with caff_sendEncodedVideo() are packetized
+and sent as they are, which avoids encoding the same content twice when the application is also recording it.
+
+The application's encoder must produce H.264 in the Constrained Baseline, Main or High profile, without B-frames. Rate
+control is left to the application, so its encoder should stay within the bitrate and framerate allowed for
+broadcasts.
+
+Raw frames sent with caff_sendVideo(), caff_sendVideoStrided() or caff_sendVideoPlanes() are still needed for the lobby
+screenshot, but are not encoded. Sending one every few seconds is enough.
+
+Changes take effect on the next call to caff_startBroadcast().
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param enabled whether video is sent encoded. Video is encoded by libcaffeine by default
+\param keyFrameRequestCallback called when the application should encode a key frame. May be `NULL`, in which case the
+    application should send key frames at least every two seconds
+\param userData an arbitrary pointer passed unmodified to \p keyFrameRequestCallback
+
+\see caff_sendEncodedVideo()
+*/
+CAFFEINE_API void caff_setEncodedVideo(
+        caff_InstanceHandle instanceHandle,
+        bool enabled,
+        caff_KeyFrameRequestCallback keyFrameRequestCallback,
+        void * userData);
+
+
+//! Broadcasts a frame of encoded video
+/*!
+This should be called instead of caff_sendVideo() when encoded video is enabled with caff_setEncodedVideo(), on the same
+thread and with the same timing. Each call sends one complete access unit.
+
+The first frame, and the first after a key frame request or a change in frame size, should be a key frame with SPS and
+PPS. Until a key frame arrives, and after any frame is lost on its way to the network, frames are dropped. Key frames
+whose SPS has a different profile than the one negotiated are dropped as well.
+
+Frames are held to the same limits as raw video. Frames larger than the broadcast's frame size, normally 1280x720, are
+dropped, since they can't be scaled. Frames sent faster than the broadcast's framerate are dropped too; unless they are
+non-reference frames, video then waits for a key frame. To follow bandwidth estimation, read the target bitrate and
+framerate from caff_getVideoStats() and configure the encoder to match.
+
+Calling this while the broadcast is offline will have no effect.
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param data one H.264 access unit in Annex B format, with each NAL unit preceded by a start code. It is copied before
+    this function returns
+\param dataBytes the number of bytes in \p data
+\param width the frame width
+\param height the frame height
+\param isKeyFrame whether the access unit is an IDR frame
+\param timestampMicros the capture timestamp of the frame. You can pass ::caff_TimestampGenerate to use the current
+    system time
+
+\see caff_setEncodedVideo()
+\see caff_getVideoStats()
+*/
+CAFFEINE_API void caff_sendEncodedVideo(
+        caff_InstanceHandle instanceHandle,
+        uint8_t const * data,
+        size_t dataBytes,
+        int32_t width,
+        int32_t height,
+        bool isKeyFrame,
+        int64_t timestampMicros);
+
+
+//! Move video processing off the application's thread
+/*!
+When enabled, caff_sendVideo() and caff_sendVideoPlanes() only queue the frame; conversion, scaling, and screenshot
+encoding happen on a dedicated libcaffeine thread. This keeps stalls in that work from blocking the application's
+video output thread, at the cost of up to \p queueDepth frames of latency.
+
+Changes take effect on the next call to caff_startBroadcast().
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param enabled whether to process video asynchronously. Video is processed synchronously by default
+\param queueDepth the maximum number of frames waiting to be processed. Must be positive when \p enabled is `true`
+\param dropPolicy which frame to discard when a frame is sent while the queue is full
+
+\see caff_getVideoStats()
+*/
+CAFFEINE_API void caff_setAsyncVideo(
+        caff_InstanceHandle instanceHandle, bool enabled, size_t queueDepth, caff_VideoDropPolicy dropPolicy);
+
+
+//! Set the frame size at which video is converted and scaled on several threads
+/*!
+Frames with at least \p minPixels pixels (`width * height`) are split into bands of rows that are processed in
+parallel. Smaller frames are processed on a single thread, where the cost of handing off work would outweigh the
+gain. By default, frames of 2560x1440 and larger are processed in parallel.
+
+Changes take effect on the next call to caff_startBroadcast().
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param minPixels the smallest frame, in pixels, to process in parallel. Pass `0` to always use a single thread
+*/
+CAFFEINE_API void caff_setParallelVideoThreshold(caff_InstanceHandle instanceHandle, int64_t minPixels);
+
+
+//! Choose how the video encoder uses multiple CPU cores
+/*!
+The encoder never uses more threads than WebRTC reports CPU cores. With ::caff_EncoderThreadingFrame, every thread past
+the first delays each frame by one frame interval, so the thread count is also limited to `maxLatencyFrames + 1`.
+
+Changes take effect the next time the encoder is initialized, normally at the start of the next broadcast.
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param mode the threading mode. The default is ::caff_EncoderThreadingSingle
+\param maxLatencyFrames the number of frames of delay allowed in ::caff_EncoderThreadingFrame mode. Ignored by the
+    other modes
+*/
+CAFFEINE_API void caff_setEncoderThreading(
+        caff_InstanceHandle instanceHandle, caff_EncoderThreading mode, int32_t maxLatencyFrames);
+
+
+//! Choose the encoder settings used while broadcasting a game
+/*!
+Each profile adjusts the encoder's quality target, adaptive quantization, the slowest preset it may use, and the
+capture framerate. Games without a profile use ::caff_ContentProfileDefault.
+
+If \p gameId is the game currently being broadcast (see caff_setGameId()), the new settings apply within a frame.
+Likewise, changing the game mid-broadcast switches to the new game's profile. Profiles are kept for the lifetime of the
+instance.
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param gameId a game ID from caff_enumerateGames()
+\param profile the profile to use for \p gameId
+*/
+CAFFEINE_API void caff_setGameContentProfile(
+        caff_InstanceHandle instanceHandle, char const * gameId, caff_ContentProfile profile);
+
+
+//! Choose parts of the picture that get more or fewer bits
+/*!
+Regions such as a facecam overlay or scoreboard text can be given a negative quantizer offset, so they stay sharp when
+the bitrate is low. The rest of the picture is offset the other way to make up for it, so the overall bitrate stays
+about the same.
+
+The regions apply to every frame encoded after this call, until they are replaced. To follow moving content, call this
+before sending each frame that changes them. Where regions overlap, the lowest offset wins.
+
+Regions are ignored for video sent with caff_sendEncodedVideo().
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param regions the regions, or `NULL` to clear them. Every field must be a finite number; regions reaching past the edges
+    of the frame are cut off at them
+\param regionCount the number of regions in \p regions
+*/
+CAFFEINE_API void caff_setVideoRegionsOfInterest(
+        caff_InstanceHandle instanceHandle, caff_VideoRegion const * regions, size_t regionCount);
+
+
+//! Choose whether video is encoded as screen content
+/*!
+Screen content is encoded with a cheaper motion search, weaker deblocking to keep text sharp, and a framerate cap.
+When bandwidth or CPU time runs short, the framerate is lowered before the resolution. With ::caff_ScreenContentAuto,
+the mode follows how much of each captured frame changed over the last few seconds.
+
+Changes apply within a frame, including mid-broadcast. Ignored for video sent with caff_sendEncodedVideo().
+
+\param instanceHandle the instance returned by caff_createInstance()
+\param mode the screen content mode. The default is ::caff_ScreenContentOff
+*/
+CAFFEINE_API void caff_setScreenContentMode(caff_InstanceHandle instanceHandle, caff_ScreenContentMode mode);
+
+
 //! Set the game ID for the broadcast
 /*!
 This should be called during an active broadcast to update the user's stage with a new game ID (or none, if no longer
@@ -574,6 +939,17 @@ broadcaster and the Caffeine servers.
 CAFFEINE_API caff_ConnectionQuality caff_getConnectionQuality(caff_InstanceHandle instanceHandle);
 
 
+//! Get counters describing the video pipeline
+/*!
+\param instanceHandle the instance returned by caff_createInstance()
+\param stats filled in with the counters for the current broadcast
+
+\return - caff_ResultSuccess if \p stats was filled in
+        - caff_ResultFailure if the broadcast is offline
+*/
+CAFFEINE_API caff_Result caff_getVideoStats(caff_InstanceHandle instanceHandle, caff_VideoStats * stats);
+
+
 //! End a Caffeine broadcast
 /*!
 This signals the server to end the broadcast and closes the RTC connection.
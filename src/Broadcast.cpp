@@ -8,26 +8,17 @@
 #include <thread>
 
 #include "AudioDevice.hpp"
+#include "ContentProfile.hpp"
 #include "PeerConnectionObserver.hpp"
 #include "Policy.hpp"
 #include "RestApi.hpp"
+#include "Screenshot.hpp"
 #include "SessionDescriptionObserver.hpp"
 #include "Utils.hpp"
 #include "VideoCapturer.hpp"
+#include "VideoConversion.hpp"
 #include "caffeine.h"
 
-#include "libyuv.h"
-
-// Uncomment this to save png & jpg copies of the screenshot to the working directory
-//#define SAVE_SCREENSHOT
-
-#ifndef SAVE_SCREENSHOT
-#    define STBI_WRITE_NO_STDIO
-#endif
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
 #include "api/mediastreaminterface.h"
 #include "api/peerconnectioninterface.h"
 
@@ -35,13 +26,18 @@ using namespace std::chrono_literals;
 
 namespace caff {
 
+    // How often a frame is sampled to see whether the lobby screenshot is out of date
+    auto constexpr screenshotCheckInterval = 5s;
+
     Broadcast::Broadcast(
             SharedCredentials & sharedCredentials,
             std::string username,
             std::string title,
             caff_Rating rating,
             std::string gameId,
+            VideoOptions videoOptions,
             AudioDevice * audioDevice,
+            std::shared_ptr<EncoderControl> encoderControl,
             webrtc::PeerConnectionFactoryInterface * factory)
         : isScreenshotNeeded(true)
         , sharedCredentials(sharedCredentials)
@@ -51,8 +47,15 @@ namespace caff {
         , rating(rating)
         , gameId(gameId)
         , feedId(rtc::CreateRandomUuid())
+        , videoOptions(videoOptions)
         , audioDevice(audioDevice)
-        , factory(factory) {}
+        , encoderControl(std::move(encoderControl))
+        , isEncodedVideo(this->encoderControl->isEncodedVideoEnabled())
+        , factory(factory)
+        , contentHintQueue("caffeine-content-hint")
+        , screenshotQueue("caffeine-screenshot") {
+        this->encoderControl->setCurrentGame(this->gameId);
+    }
 
     Broadcast::~Broadcast() {}
 
@@ -185,6 +188,17 @@ namespace caff {
 
         int targetMinBitrate = targetMaxBitrate * 3 / 4;
 
+        if (videoOptions.isAsync) {
+            LOG_DEBUG(
+                    "Queueing video asynchronously: depth = %zu, drop %s",
+                    videoOptions.queueDepth,
+                    videoOptions.dropPolicy == caff_VideoDropPolicyOldest ? "oldest" : "newest");
+            videoQueue = std::make_unique<VideoQueue>(
+                    videoOptions.queueDepth, videoOptions.dropPolicy, [this](QueuedFrame const & frame) {
+                        processQueuedFrame(frame);
+                    });
+        }
+
         broadcastThread = std::thread([=] {
             setupSubscription();
 
@@ -192,9 +206,20 @@ namespace caff {
             videoCapturer = new VideoCapturer;
             videoCapturer->SetFramerateLimit(targetFps);
             videoCapturer->SetFrameSizeLimit(targetFrameWidth, targetFrameHeight);
-            videoCapturer->EnableFrameAdaption(false);
+            // Lets the quality scaler and CPU overuse detection lower the resolution instead of dropping frames
+            videoCapturer->EnableFrameAdaption(true);
+            videoCapturer->setParallelPixelThreshold(videoOptions.parallelPixelThreshold);
+            videoCapturer->setRawVideoEncoded(!isEncodedVideo);
+            // Set before the source is created, so a broadcast that starts as screen content is encoded as such from
+            // the first frame
+            isScreenContent = encoderControl->getScreenContentMode() == caff_ScreenContentOn;
+            videoCapturer->setScreencast(isScreenContent);
+            // Lets the encoder factory open x264 while signaling is still going on. Frames from larger sources are
+            // scaled down to the target size, so it is the most likely size for WebRTC to ask for
+            encoderControl->setExpectedVideo(
+                    { targetFrameWidth, targetFrameHeight, targetMaxBitrate / 1000, targetFps, isScreenContent });
             auto videoSource = factory->CreateVideoSource(videoCapturer);
-            auto videoTrack = factory->CreateVideoTrack("external_video", videoSource);
+            videoTrack = factory->CreateVideoTrack("external_video", videoSource);
 
             LOG_DEBUG("Creating audio track");
             cricket::AudioOptions audioOptions;
@@ -431,6 +456,11 @@ namespace caff {
             }
         }
 
+        if (gameIdChanged) {
+            // The encoder and capturer pick up the new game's content profile on their next frame
+            encoderControl->setCurrentGame(id);
+        }
+
         if (gameIdChanged && isOnline()) {
             updateFeed();
         }
@@ -461,6 +491,7 @@ namespace caff {
                 failedCallback(caff_ResultBroadcastFailed);
                 return;
             }
+            isScreenshotRefreshEnabled = true;
         } catch (...) {
             // Already logged
             failedCallback(caff_ResultBroadcastFailed);
@@ -512,6 +543,24 @@ namespace caff {
 
             interval = 0ms;
 
+            auto poolStats = videoCapturer->getBufferPoolStats();
+            LOG_DEBUG(
+                    "Video buffer pool: %llu hits, %llu misses",
+                    static_cast<unsigned long long>(poolStats.hits),
+                    static_cast<unsigned long long>(poolStats.misses));
+            auto cadenceStats = videoCapturer->getCadenceStats();
+            LOG_DEBUG(
+                    "Video cadence at %d fps: %llu accepted, %llu decimated, %llu late",
+                    videoCapturer->getFramerate(),
+                    static_cast<unsigned long long>(cadenceStats.acceptedFrames),
+                    static_cast<unsigned long long>(cadenceStats.decimatedFrames),
+                    static_cast<unsigned long long>(cadenceStats.lateFrames));
+            auto repeatStats = videoCapturer->getRepeatStats();
+            LOG_DEBUG(
+                    "Video repeats: %llu elided, %llu repeated",
+                    static_cast<unsigned long long>(repeatStats.elidedFrames),
+                    static_cast<unsigned long long>(repeatStats.repeatedFrames));
+
             LOG_DEBUG("Updating webrtc stats");
             peerConnection->GetStats(
                     statsObserver,
@@ -562,6 +611,9 @@ namespace caff {
     void Broadcast::stop() {
         state = State::Stopping;
         subscription = nullptr;
+        if (videoQueue) {
+            videoQueue->stop();
+        }
         if (broadcastThread.joinable()) {
             broadcastThread.join();
         }
@@ -584,70 +636,291 @@ namespace caff {
         if (!isOnline()) {
             return;
         }
+        encoderControl->recordFrameSent();
+        if (videoQueue) {
+            videoQueue->pushFrame(format, frameData, frameBytes, width, height, timestamp);
+        } else {
+            processVideo(format, frameData, frameBytes, width, height, timestamp);
+        }
+    }
+
+    void Broadcast::sendVideoStrided(
+            caff_VideoFormat format,
+            uint8_t const * frameData,
+            int32_t stride,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        if (!isOnline()) {
+            return;
+        }
+        encoderControl->recordFrameSent();
+        if (videoQueue) {
+            auto rowBytes = packedRowBytes(static_cast<webrtc::VideoType>(format), width);
+            videoQueue->pushStridedFrame(format, frameData, stride, rowBytes, width, height, timestamp);
+        } else {
+            processVideoStrided(format, frameData, stride, width, height, timestamp);
+        }
+    }
+
+    void Broadcast::sendVideoPlanes(
+            caff_VideoFormat format,
+            uint8_t const * const planes[3],
+            int32_t const strides[3],
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp,
+            std::shared_ptr<void> planesOwner) {
+        if (!isOnline()) {
+            return;
+        }
+        encoderControl->recordFrameSent();
+        if (videoQueue) {
+            videoQueue->pushPlanes(format, planes, strides, width, height, timestamp, std::move(planesOwner));
+        } else {
+            processVideoPlanes(format, planes, strides, width, height, timestamp, std::move(planesOwner));
+        }
+    }
+
+    void Broadcast::processVideo(
+            caff_VideoFormat format,
+            uint8_t const * frameData,
+            size_t frameBytes,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
         if (auto result = checkAspectRatio(width, height)) {
             failedCallback(result);
             return;
         }
+        if (isEncodedVideo && !isScreenshotFrameWanted()) {
+            return;
+        }
+        updateVideoContent();
         auto rtcFormat = static_cast<webrtc::VideoType>(format);
         auto i420frame = videoCapturer->sendVideo(rtcFormat, frameData, frameBytes, width, height, timestamp);
+        offerScreenshotFrame(i420frame);
+    }
+
+    void Broadcast::processVideoStrided(
+            caff_VideoFormat format,
+            uint8_t const * frameData,
+            int32_t stride,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        if (auto result = checkAspectRatio(width, height)) {
+            failedCallback(result);
+            return;
+        }
+        if (isEncodedVideo && !isScreenshotFrameWanted()) {
+            return;
+        }
+        updateVideoContent();
+        auto rtcFormat = static_cast<webrtc::VideoType>(format);
+        auto i420frame = videoCapturer->sendVideoStrided(rtcFormat, frameData, stride, width, height, timestamp);
+        offerScreenshotFrame(i420frame);
+    }
+
+    void Broadcast::processVideoPlanes(
+            caff_VideoFormat format,
+            uint8_t const * const planes[3],
+            int32_t const strides[3],
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp,
+            std::shared_ptr<void> planesOwner) {
+        if (auto result = checkAspectRatio(width, height)) {
+            failedCallback(result);
+            return;
+        }
+        if (isEncodedVideo && !isScreenshotFrameWanted()) {
+            return;
+        }
+        updateVideoContent();
+        auto rtcFormat = static_cast<webrtc::VideoType>(format);
+        auto i420frame = videoCapturer->sendVideoPlanes(
+                rtcFormat, planes, strides, width, height, timestamp, std::move(planesOwner));
+        offerScreenshotFrame(i420frame);
+    }
+
+    void Broadcast::sendEncodedVideo(
+            uint8_t const * data,
+            size_t dataBytes,
+            int32_t width,
+            int32_t height,
+            bool isKeyFrame,
+            std::chrono::microseconds timestamp) {
+        if (!isOnline()) {
+            return;
+        }
+        if (!isEncodedVideo) {
+            LOG_DEBUG("Encoded video sent without calling caff_setEncodedVideo before the broadcast started");
+            return;
+        }
+        if (auto result = checkAspectRatio(width, height)) {
+            failedCallback(result);
+            return;
+        }
+        encoderControl->recordFrameSent();
+        videoCapturer->sendEncodedVideo(data, dataBytes, width, height, isKeyFrame, timestamp);
+    }
+
+    void Broadcast::updateVideoContent() {
+        bool const isScreen = wantsScreenContent();
+        bool const isScreenChanged = isScreen != isScreenContent;
+        if (!isScreenChanged && encoderControl->getContentProfileGeneration() == capturerContentProfileGeneration) {
+            return;
+        }
+
+        if (isScreenChanged) {
+            LOG_DEBUG("Switching video to %s content", isScreen ? "screen" : "camera-like");
+            isScreenContent = isScreen;
+            // A new content hint makes WebRTC read IsScreencast again and reconfigure the encoder in screensharing
+            // mode, which also makes it lower the framerate rather than the resolution under load. Setting the hint
+            // blocks on the signaling thread, so both are done on a queue of their own instead of the capture thread.
+            // The track keeps its source, and with it the capturer, alive until the task has run
+            contentHintQueue.PostTask([capturer = videoCapturer, track = videoTrack, isScreen] {
+                capturer->setScreencast(isScreen);
+                track->set_content_hint(
+                        isScreen ? webrtc::VideoTrackInterface::ContentHint::kDetailed
+                                 : webrtc::VideoTrackInterface::ContentHint::kFluid);
+            });
+        }
+
+        // Screen content replaces the game's profile for as long as it lasts
+        auto profile = encoderControl->getContentProfile(&capturerContentProfileGeneration);
+        auto const & tuning = isScreen ? screenContentTuning() : contentTuningFor(profile);
+        videoCapturer->setContentFramerateLimit(tuning.maxFramerate);
+    }
+
+    bool Broadcast::wantsScreenContent() const {
+        switch (encoderControl->getScreenContentMode()) {
+        case caff_ScreenContentOn:
+            return true;
+        case caff_ScreenContentAuto:
+            return videoCapturer->isScreenContentDetected();
+        case caff_ScreenContentOff:
+        default:
+            return false;
+        }
+    }
+
+    void Broadcast::processQueuedFrame(QueuedFrame const & frame) {
+        if (!isOnline()) {
+            return;
+        }
+        if (frame.isPlanar()) {
+            processVideoPlanes(
+                    frame.format,
+                    frame.planes,
+                    frame.strides,
+                    frame.width,
+                    frame.height,
+                    frame.timestamp,
+                    frame.planesOwner);
+        } else {
+            processVideo(
+                    frame.format, frame.data.data(), frame.data.size(), frame.width, frame.height, frame.timestamp);
+        }
+    }
+
+    caff_Result Broadcast::getVideoStats(caff_VideoStats * stats) {
+        if (!isOnline()) {
+            return caff_ResultFailure;
+        }
+
+        *stats = {};
+        auto poolStats = videoCapturer->getBufferPoolStats();
+        stats->bufferPoolHits = poolStats.hits;
+        stats->bufferPoolMisses = poolStats.misses;
+        auto cadenceStats = videoCapturer->getCadenceStats();
+        stats->acceptedFrames = cadenceStats.acceptedFrames;
+        stats->decimatedFrames = cadenceStats.decimatedFrames;
+        stats->lateFrames = cadenceStats.lateFrames;
+        auto repeatStats = videoCapturer->getRepeatStats();
+        stats->elidedFrames = repeatStats.elidedFrames;
+        stats->repeatedFrames = repeatStats.repeatedFrames;
+        stats->isScreenContent = isScreenContent;
+        stats->captureFramerate = videoCapturer->getFramerate();
+        if (videoQueue) {
+            auto queueStats = videoQueue->getStats();
+            stats->queueDepth = queueStats.depth;
+            stats->queueDroppedFrames = queueStats.droppedFrames;
+        }
+        return caff_ResultSuccess;
+    }
+
+    // Mirrors the checks in offerScreenshotFrame, so raw frames sent alongside encoded video are only converted when
+    // a screenshot could use them
+    bool Broadcast::isScreenshotFrameWanted() const {
+        return isScreenshotNeeded ||
+               (isScreenshotRefreshEnabled && std::chrono::steady_clock::now() >= nextScreenshotCheck);
+    }
+
+    void Broadcast::offerScreenshotFrame(rtc::scoped_refptr<webrtc::I420BufferInterface> frame) {
+        if (!frame) {
+            return;
+        }
 
         bool expected = true;
-        if (i420frame && isScreenshotNeeded.compare_exchange_strong(expected, false)) {
-            try {
-                screenshotPromise.set_value(createScreenshot(i420frame));
-                LOG_DEBUG("Screenshot promise set");
-            } catch (std::exception ex) {
-                LOG_ERROR("Failed to create screenshot: %s", ex.what());
-                screenshotPromise.set_exception(std::current_exception());
-            } catch (...) {
-                LOG_ERROR("Failed to create screenshot");
-                screenshotPromise.set_exception(std::current_exception());
-            }
+        if (isScreenshotNeeded.compare_exchange_strong(expected, false)) {
+            // Encoding takes long enough to stall the application's video thread, so it gets its own
+            screenshotQueue.PostTask([this, frame] {
+                try {
+                    lastScreenshotSignature = computeLumaSignature(*frame);
+                    lastScreenshotTime = std::chrono::steady_clock::now();
+                    screenshotPromise.set_value(createScreenshot(frame));
+                    LOG_DEBUG("Screenshot promise set");
+                } catch (std::exception ex) {
+                    LOG_ERROR("Failed to create screenshot: %s", ex.what());
+                    screenshotPromise.set_exception(std::current_exception());
+                } catch (...) {
+                    LOG_ERROR("Failed to create screenshot");
+                    screenshotPromise.set_exception(std::current_exception());
+                }
+            });
+            return;
         }
+
+        if (!isScreenshotRefreshEnabled) {
+            return;
+        }
+
+        // Only a clock read on the video thread; everything else happens on the screenshot queue
+        auto now = std::chrono::steady_clock::now();
+        if (now < nextScreenshotCheck) {
+            return;
+        }
+        nextScreenshotCheck = now + screenshotCheckInterval;
+        screenshotQueue.PostTask([this, frame] { refreshScreenshot(frame); });
     }
 
-    static void writeScreenshot(void * context, void * data, int size) {
-        auto screenshot = reinterpret_cast<ScreenshotData *>(context);
-        auto pixels = reinterpret_cast<uint8_t *>(data);
-        screenshot->insert(screenshot->end(), pixels, pixels + size);
-    }
-
-    ScreenshotData Broadcast::createScreenshot(rtc::scoped_refptr<webrtc::I420Buffer> buffer) {
-        if (!buffer) {
-            throw std::runtime_error("No buffer for screenshot");
-        }
-        auto const width = buffer->width();
-        auto const height = buffer->height();
-        auto constexpr channels = 3;
-        auto const destStride = width * channels;
-
-        std::vector<uint8_t> raw;
-        raw.resize(destStride * height);
-
-        auto ret = libyuv::I420ToRAW(
-                buffer->DataY(),
-                buffer->StrideY(),
-                buffer->DataU(),
-                buffer->StrideU(),
-                buffer->DataV(),
-                buffer->StrideV(),
-                &raw[0],
-                destStride,
-                width,
-                height);
-        if (ret != 0) {
-            throw std::runtime_error("Failed to convert I420 to RAW");
-        }
-#ifdef SAVE_SCREENSHOT
-        ret = stbi_write_png("screenshot.png", width, height, channels, &raw[0], destStride);
-        ret = stbi_write_jpg("screenshot.jpg", width, height, channels, &raw[0], 95);
-#endif
-        ScreenshotData screenshot;
-        ret = stbi_write_jpg_to_func(writeScreenshot, &screenshot, width, height, channels, &raw[0], 95);
-        if (ret == 0) {
-            throw std::runtime_error("Failed to convert RAW to JPEG");
-        }
-        return screenshot;
+    void Broadcast::refreshScreenshot(rtc::scoped_refptr<webrtc::I420BufferInterface> frame) {
+        if (!isOnline()) {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto signature = computeLumaSignature(*frame);
+        if (!isScreenshotRefreshWanted(signature, lastScreenshotSignature, now - lastScreenshotTime)) {
+            return;
+        }
+        auto distance = lumaSignatureDistance(signature, lastScreenshotSignature);
+
+        try {
+            if (updateScreenshot(broadcastId.value(), createScreenshot(frame), sharedCredentials)) {
+                LOG_DEBUG("Refreshed screenshot after scene change (difference %.1f)", distance);
+            } else {
+                LOG_WARNING("Failed to refresh screenshot");
+            }
+        } catch (std::exception ex) {
+            LOG_WARNING("Failed to refresh screenshot: %s", ex.what());
+        }
+
+        // Also back off after failures, rather than retrying every check
+        lastScreenshotSignature = signature;
+        lastScreenshotTime = now;
     }
 
     caff_ConnectionQuality Broadcast::getConnectionQuality() {
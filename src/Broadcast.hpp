@@ -5,16 +5,22 @@
 #include <atomic>
 #include <functional>
 #include <future>
+#include <limits>
+#include <memory>
 #include <vector>
 
+#include "EncoderControl.hpp"
 #include "ErrorLogging.hpp"
+#include "Screenshot.hpp"
 #include "StatsObserver.hpp"
+#include "VideoQueue.hpp"
 #include "WebsocketApi.hpp"
 
 #include "absl/types/optional.h"
-#include "api/video/i420_buffer.h"
+#include "api/video/video_frame_buffer.h"
 #include "common_types.h"
 #include "rtc_base/scoped_ref_ptr.h"
+#include "rtc_base/task_queue.h"
 
 ASSERT_MATCH(caff_VideoFormatUnknown, webrtc::VideoType::kUnknown);
 ASSERT_MATCH(caff_VideoFormatI420, webrtc::VideoType::kI420);
@@ -37,12 +43,24 @@ namespace webrtc {
     class PeerConnectionFactoryInterface;
     class MediaStreamInterface;
     class PeerConnectionInterface;
+    class VideoTrackInterface;
 } // namespace webrtc
 
 namespace caff {
     class AudioDevice;
     class VideoCapturer;
 
+    // Above 1440p, single-threaded conversion and scaling take a large part of a 60fps frame budget
+    int64_t constexpr defaultParallelVideoPixels = 2560 * 1440;
+
+    // Video pipeline settings chosen by the application; they take effect on the next broadcast
+    struct VideoOptions {
+        bool isAsync = false;
+        size_t queueDepth = 0;
+        caff_VideoDropPolicy dropPolicy = caff_VideoDropPolicyOldest;
+        int64_t parallelPixelThreshold = defaultParallelVideoPixels;
+    };
+
     // TODO: separate Broadcast & Feed/Stream functionality
     class Broadcast : public std::enable_shared_from_this<Broadcast> {
     public:
@@ -52,7 +70,9 @@ namespace caff {
                 std::string title,
                 caff_Rating rating,
                 std::string gameId,
+                VideoOptions videoOptions,
                 AudioDevice * audioDevice,
+                std::shared_ptr<EncoderControl> encoderControl,
                 webrtc::PeerConnectionFactoryInterface * factory);
 
         virtual ~Broadcast();
@@ -72,8 +92,31 @@ namespace caff {
                 int32_t width,
                 int32_t height,
                 std::chrono::microseconds timestamp);
+        void sendVideoStrided(
+                caff_VideoFormat format,
+                uint8_t const * frameData,
+                int32_t stride,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+        void sendVideoPlanes(
+                caff_VideoFormat format,
+                uint8_t const * const planes[3],
+                int32_t const strides[3],
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp,
+                std::shared_ptr<void> planesOwner);
+        void sendEncodedVideo(
+                uint8_t const * data,
+                size_t dataBytes,
+                int32_t width,
+                int32_t height,
+                bool isKeyFrame,
+                std::chrono::microseconds timestamp);
 
         caff_ConnectionQuality getConnectionQuality();
+        caff_Result getVideoStats(caff_VideoStats * stats);
 
         std::string const & getClientId() const {
             return clientId;
@@ -88,6 +131,13 @@ namespace caff {
 
         std::promise<ScreenshotData> screenshotPromise;
         std::atomic<bool> isScreenshotNeeded;
+
+        // Periodic screenshot refresh. The check time is only touched on the video thread, the rest only on the
+        // screenshot queue.
+        std::atomic<bool> isScreenshotRefreshEnabled{ false };
+        std::chrono::steady_clock::time_point nextScreenshotCheck;
+        std::chrono::steady_clock::time_point lastScreenshotTime;
+        LumaSignature lastScreenshotSignature{};
         std::mutex mutex;
 
         std::function<void(caff_Result)> failedCallback;
@@ -108,19 +158,62 @@ namespace caff {
         SubscriptionState subscriptionState{};
         std::promise<bool> subscriptionOpened;
 
+        VideoOptions videoOptions;
+        std::unique_ptr<VideoQueue> videoQueue;
+
         AudioDevice * audioDevice;
         VideoCapturer * videoCapturer;
+        std::shared_ptr<EncoderControl> encoderControl;
+        // Whether the application sends encoded video, in which case raw frames are only used for screenshots
+        bool const isEncodedVideo;
+        // Content profile generation last applied to the capturer. Only touched on the video thread
+        uint64_t capturerContentProfileGeneration = std::numeric_limits<uint64_t>::max();
+        // Whether video is being encoded as screen content. Only changed on the video thread
+        std::atomic<bool> isScreenContent{ false };
         webrtc::PeerConnectionFactoryInterface * factory;
         rtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection;
+        rtc::scoped_refptr<webrtc::VideoTrackInterface> videoTrack;
         rtc::scoped_refptr<StatsObserver> statsObserver;
 
+        // Declared last so they are torn down, finishing any running task, before the members they use
+        rtc::TaskQueue contentHintQueue;
+        rtc::TaskQueue screenshotQueue;
+
         bool requireState(State expectedState) const;
         bool transitionState(State oldState, State newState);
         bool isOnline() const;
 
         variant<std::string, caff_Result> createFeed(std::string const & offer);
         void startHeartbeat();
-        ScreenshotData createScreenshot(rtc::scoped_refptr<webrtc::I420Buffer> buffer);
+        void processVideo(
+                caff_VideoFormat format,
+                uint8_t const * frameData,
+                size_t frameBytes,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+        void processVideoStrided(
+                caff_VideoFormat format,
+                uint8_t const * frameData,
+                int32_t stride,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+        void processVideoPlanes(
+                caff_VideoFormat format,
+                uint8_t const * const planes[3],
+                int32_t const strides[3],
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp,
+                std::shared_ptr<void> planesOwner);
+        void processQueuedFrame(QueuedFrame const & frame);
+        // Applies the current content profile and screen content mode to the capturer and the video track
+        void updateVideoContent();
+        bool wantsScreenContent() const;
+        bool isScreenshotFrameWanted() const;
+        void offerScreenshotFrame(rtc::scoped_refptr<webrtc::I420BufferInterface> frame);
+        void refreshScreenshot(rtc::scoped_refptr<webrtc::I420BufferInterface> frame);
         caffql::FeedInput currentFeedInput();
         std::string fullTitle();
         bool updateFeed();
@@ -4,6 +4,7 @@
 
 #include "caffeine.h"
 
+#include <cmath>
 #include <vector>
 
 #include "Broadcast.hpp"
@@ -11,6 +12,7 @@
 #include "Instance.hpp"
 #include "LogSink.hpp"
 #include "Utils.hpp"
+#include "VideoConversion.hpp"
 
 #include "rtc_base/ssladapter.h"
 
@@ -298,6 +300,100 @@ CAFFEINE_API caff_Result caff_startBroadcast(
 CATCHALL_RETURN(caff_ResultBroadcastFailed)
 
 
+CAFFEINE_API void caff_setAsyncVideo(
+        caff_InstanceHandle instanceHandle, bool enabled, size_t queueDepth, caff_VideoDropPolicy dropPolicy) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_ENUM(caff_VideoDropPolicy, dropPolicy);
+    if (enabled) {
+        CHECK_POSITIVE(queueDepth);
+    }
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->setAsyncVideo(enabled, queueDepth, dropPolicy);
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setParallelVideoThreshold(caff_InstanceHandle instanceHandle, int64_t minPixels) try {
+    CHECK_PTR(instanceHandle);
+    CAFF_CHECK(minPixels >= 0);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->setParallelVideoThreshold(minPixels);
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setEncoderThreading(
+        caff_InstanceHandle instanceHandle, caff_EncoderThreading mode, int32_t maxLatencyFrames) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_ENUM(caff_EncoderThreading, mode);
+    CAFF_CHECK(maxLatencyFrames >= 0);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->getEncoderControl().setThreading(mode, maxLatencyFrames);
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setGameContentProfile(
+        caff_InstanceHandle instanceHandle, char const * gameId, caff_ContentProfile profile) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_PTR(gameId);
+    CHECK_ENUM(caff_ContentProfile, profile);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->getEncoderControl().setGameContentProfile(gameId, profile);
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setEncodedVideo(
+        caff_InstanceHandle instanceHandle,
+        bool enabled,
+        caff_KeyFrameRequestCallback keyFrameRequestCallback,
+        void * userData) try {
+    CHECK_PTR(instanceHandle);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->getEncoderControl().setEncodedVideo(enabled, keyFrameRequestCallback, userData);
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setVideoRegionsOfInterest(
+        caff_InstanceHandle instanceHandle, caff_VideoRegion const * regions, size_t regionCount) try {
+    CHECK_PTR(instanceHandle);
+    if (regionCount > 0) {
+        CHECK_PTR(regions);
+    }
+
+    std::vector<caff_VideoRegion> regionList;
+    if (regions) {
+        regionList.assign(regions, regions + regionCount);
+    }
+    for (auto const & region : regionList) {
+        CAFF_CHECK(std::isfinite(region.x) && std::isfinite(region.y));
+        CAFF_CHECK(std::isfinite(region.width) && std::isfinite(region.height));
+        CAFF_CHECK(std::isfinite(region.qpOffset));
+    }
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->getEncoderControl().setRegionsOfInterest(std::move(regionList));
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_setScreenContentMode(caff_InstanceHandle instanceHandle, caff_ScreenContentMode mode) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_ENUM(caff_ScreenContent, mode);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    instance->getEncoderControl().setScreenContentMode(mode);
+}
+CATCHALL
+
+
 CAFFEINE_API void caff_setGameId(caff_InstanceHandle instanceHandle, char const * gameId) try {
     CHECK_PTR(instanceHandle);
     std::string idStr;
@@ -393,6 +489,123 @@ CAFFEINE_API void caff_sendVideo(
 CATCHALL
 
 
+CAFFEINE_API void caff_sendVideoStrided(
+        caff_InstanceHandle instanceHandle,
+        caff_VideoFormat format,
+        uint8_t const * frameData,
+        size_t frameBytes,
+        int32_t stride,
+        int32_t width,
+        int32_t height,
+        int64_t timestampMicros) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_PTR(frameData);
+    CHECK_POSITIVE(width);
+    CHECK_POSITIVE(height);
+    CHECK_ENUM(caff_VideoFormat, format);
+
+    auto rowBytes = packedRowBytes(static_cast<webrtc::VideoType>(format), width);
+    CAFF_CHECK(rowBytes > 0);
+    CAFF_CHECK(stride >= rowBytes);
+    CAFF_CHECK(frameBytes >= static_cast<size_t>(stride) * (height - 1) + static_cast<size_t>(rowBytes));
+
+    if (timestampMicros == caff_TimestampGenerate) {
+        timestampMicros = rtc::TimeMicros();
+    }
+    auto timestamp = std::chrono::microseconds(timestampMicros);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    auto broadcast = instance->getBroadcast();
+    if (broadcast) {
+        broadcast->sendVideoStrided(format, frameData, stride, width, height, timestamp);
+    } else {
+        LOG_DEBUG("Sending video without an active broadcast. (This is probably OK if the stream just ended)");
+    }
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_sendVideoPlanes(
+        caff_InstanceHandle instanceHandle,
+        caff_VideoFormat format,
+        uint8_t const * const planes[3],
+        int32_t const strides[3],
+        int32_t width,
+        int32_t height,
+        int64_t timestampMicros,
+        caff_VideoPlanesReleaseCallback releaseCallback,
+        void * releaseUserData) try {
+    CHECK_PTR(releaseCallback);
+    // The deleter runs when the last reference goes away, no matter which path (including exceptions) that happens on
+    std::shared_ptr<void> planesOwner(nullptr, [=](void *) { releaseCallback(releaseUserData); });
+
+    CHECK_PTR(instanceHandle);
+    CHECK_PTR(planes);
+    CHECK_PTR(strides);
+    CHECK_POSITIVE(width);
+    CHECK_POSITIVE(height);
+    CHECK_ENUM(caff_VideoFormat, format);
+
+    bool const isBiplanar = format == caff_VideoFormatNv12 || format == caff_VideoFormatNv21;
+    bool const isTriplanar =
+            format == caff_VideoFormatI420 || format == caff_VideoFormatIyuv || format == caff_VideoFormatYv12;
+    CAFF_CHECK(isBiplanar || isTriplanar);
+
+    CHECK_PTR(planes[0]);
+    CHECK_PTR(planes[1]);
+    CHECK_POSITIVE(strides[0]);
+    CHECK_POSITIVE(strides[1]);
+    if (isTriplanar) {
+        CHECK_PTR(planes[2]);
+        CHECK_POSITIVE(strides[2]);
+    }
+
+    if (timestampMicros == caff_TimestampGenerate) {
+        timestampMicros = rtc::TimeMicros();
+    }
+    auto timestamp = std::chrono::microseconds(timestampMicros);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    auto broadcast = instance->getBroadcast();
+    if (broadcast) {
+        broadcast->sendVideoPlanes(format, planes, strides, width, height, timestamp, std::move(planesOwner));
+    } else {
+        LOG_DEBUG("Sending video without an active broadcast. (This is probably OK if the stream just ended)");
+    }
+}
+CATCHALL
+
+
+CAFFEINE_API void caff_sendEncodedVideo(
+        caff_InstanceHandle instanceHandle,
+        uint8_t const * data,
+        size_t dataBytes,
+        int32_t width,
+        int32_t height,
+        bool isKeyFrame,
+        int64_t timestampMicros) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_PTR(data);
+    CHECK_POSITIVE(dataBytes);
+    CHECK_POSITIVE(width);
+    CHECK_POSITIVE(height);
+
+    if (timestampMicros == caff_TimestampGenerate) {
+        timestampMicros = rtc::TimeMicros();
+    }
+    auto timestamp = std::chrono::microseconds(timestampMicros);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    auto broadcast = instance->getBroadcast();
+    if (broadcast) {
+        broadcast->sendEncodedVideo(data, dataBytes, width, height, isKeyFrame, timestamp);
+    } else {
+        LOG_DEBUG("Sending video without an active broadcast. (This is probably OK if the stream just ended)");
+    }
+}
+CATCHALL
+
+
 CAFFEINE_API caff_ConnectionQuality caff_getConnectionQuality(caff_InstanceHandle instanceHandle) try {
     CHECK_PTR(instanceHandle);
 
@@ -407,6 +620,32 @@ CAFFEINE_API caff_ConnectionQuality caff_getConnectionQuality(caff_InstanceHandl
 CATCHALL_RETURN(caff_ConnectionQualityUnknown)
 
 
+CAFFEINE_API caff_Result caff_getVideoStats(caff_InstanceHandle instanceHandle, caff_VideoStats * stats) try {
+    CHECK_PTR(instanceHandle);
+    CHECK_PTR(stats);
+
+    auto instance = reinterpret_cast<Instance *>(instanceHandle);
+    auto broadcast = instance->getBroadcast();
+    if (!broadcast) {
+        return caff_ResultFailure;
+    }
+
+    auto result = broadcast->getVideoStats(stats);
+    if (result == caff_ResultSuccess) {
+        auto speedStats = instance->getEncoderControl().getSpeedStats();
+        stats->encoderSpeedLevel = speedStats.level;
+        stats->encoderSpeedIncreases = speedStats.increases;
+        stats->encoderSpeedDecreases = speedStats.decreases;
+        stats->firstFrameMicros = instance->getEncoderControl().getFirstFrameLatency().count();
+        auto rateTarget = instance->getEncoderControl().getRateTarget();
+        stats->targetKbps = rateTarget.kbps;
+        stats->targetFramerate = rateTarget.framerate;
+    }
+    return result;
+}
+CATCHALL_RETURN(caff_ResultFailure)
+
+
 CAFFEINE_API void caff_endBroadcast(caff_InstanceHandle instanceHandle) try {
     CHECK_PTR(instanceHandle);
     auto instance = reinterpret_cast<Instance *>(instanceHandle);
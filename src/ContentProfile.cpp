@@ -0,0 +1,35 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "ContentProfile.hpp"
+
+namespace caff {
+
+    // Speed levels index the preset ladder in X264Encoder.cpp: 1 is superfast, 3 is faster, the slowest
+    ContentTuning const contentTunings[] = {
+        // Balanced settings for everything without a profile
+        { "default", 0.0f, 1.0f, 3, 0 },
+        // Motion blurs detail anyway, so bits go to keeping the picture stable instead of to flat areas
+        { "fast motion", -1.0f, 0.8f, 3, 0 },
+        // Little changes between frames, so motion search and extra frames buy almost nothing. Weaker AQ keeps bits
+        // in text and UI edges rather than moving them into flat backgrounds
+        { "static", -1.0f, 0.6f, 1, 30 },
+    };
+
+    static_assert(
+            sizeof(contentTunings) / sizeof(contentTunings[0]) == caff_ContentProfileLast + 1,
+            "Every content profile needs an entry in contentTunings");
+
+    ContentTuning const & contentTuningFor(caff_ContentProfile profile) {
+        if (profile < 0 || profile > caff_ContentProfileLast) {
+            profile = caff_ContentProfileDefault;
+        }
+        return contentTunings[profile];
+    }
+
+    ContentTuning const & screenContentTuning() {
+        // Same budget as the static profile. X264Encoder adds the settings specific to text and UI on top
+        static ContentTuning const tuning = { "screen", -1.0f, 0.6f, 1, 30 };
+        return tuning;
+    }
+
+} // namespace caff
@@ -0,0 +1,26 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+
+#include "caffeine.h"
+
+namespace caff {
+
+    // Encoder settings for one caff_ContentProfile. Applications map game IDs to profiles with
+    // caff_setGameContentProfile, and the encoder switches settings whenever the current game's profile changes
+    struct ContentTuning {
+        char const * name;
+        float crfOffset;         // added to the CRF chosen from the resolution and bitrate
+        float aqStrength;        // x264 adaptive quantization strength. Only applied when x264 is opened
+        int32_t maxSpeedLevel;   // slowest rung of the x264 preset ladder the encoder may adapt to
+        int32_t maxFramerate;    // capture framerate cap, or 0 to keep the broadcast's own limit
+    };
+
+    ContentTuning const & contentTuningFor(caff_ContentProfile profile);
+
+    // Used instead of the game's profile while video is encoded as screen content (see caff_setScreenContentMode)
+    ContentTuning const & screenContentTuning();
+
+} // namespace caff
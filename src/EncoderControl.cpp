@@ -0,0 +1,182 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "EncoderControl.hpp"
+
+namespace caff {
+
+    void EncoderControl::setThreading(caff_EncoderThreading mode, int32_t maxLatencyFrames) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threading = { mode, maxLatencyFrames };
+    }
+
+    EncoderControl::Threading EncoderControl::getThreading() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return threading;
+    }
+
+    void EncoderControl::recordSpeedLevel(int32_t level) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (speedStats.level >= 0) {
+            // Lower levels are faster presets
+            if (level < speedStats.level) {
+                ++speedStats.increases;
+            } else if (level > speedStats.level) {
+                ++speedStats.decreases;
+            }
+        }
+        speedStats.level = level;
+    }
+
+    EncoderControl::SpeedStats EncoderControl::getSpeedStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return speedStats;
+    }
+
+    void EncoderControl::resetSpeedStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        speedStats = { -1, 0, 0 };
+    }
+
+    void EncoderControl::setGameContentProfile(std::string const & gameId, caff_ContentProfile profile) {
+        std::lock_guard<std::mutex> lock(mutex);
+        gameContentProfiles[gameId] = profile;
+        updateContentProfile();
+    }
+
+    void EncoderControl::setCurrentGame(std::string const & gameId) {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentGameId = gameId;
+        updateContentProfile();
+    }
+
+    caff_ContentProfile EncoderControl::getContentProfile(uint64_t * generation) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        *generation = contentProfileGeneration;
+        return contentProfile;
+    }
+
+    uint64_t EncoderControl::getContentProfileGeneration() const { return contentProfileGeneration; }
+
+    void EncoderControl::setRegionsOfInterest(std::vector<caff_VideoRegion> regions) {
+        std::lock_guard<std::mutex> lock(mutex);
+        regionsOfInterest = std::move(regions);
+        ++regionsOfInterestGeneration;
+    }
+
+    std::vector<caff_VideoRegion> EncoderControl::getRegionsOfInterest(uint64_t * generation) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        *generation = regionsOfInterestGeneration;
+        return regionsOfInterest;
+    }
+
+    uint64_t EncoderControl::getRegionsOfInterestGeneration() const { return regionsOfInterestGeneration; }
+
+    void EncoderControl::setEncodedVideo(
+            bool enabled, caff_KeyFrameRequestCallback keyFrameRequestCallback, void * userData) {
+        std::lock_guard<std::mutex> lock(mutex);
+        isEncodedVideoRequested = enabled;
+        this->keyFrameRequestCallback = keyFrameRequestCallback;
+        keyFrameRequestUserData = userData;
+    }
+
+    void EncoderControl::latchEncodedVideo() {
+        std::lock_guard<std::mutex> lock(mutex);
+        isEncodedVideo = isEncodedVideoRequested;
+    }
+
+    bool EncoderControl::isEncodedVideoEnabled() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return isEncodedVideo;
+    }
+
+    void EncoderControl::requestKeyFrame() {
+        caff_KeyFrameRequestCallback callback;
+        void * userData;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            callback = keyFrameRequestCallback;
+            userData = keyFrameRequestUserData;
+        }
+        // Called without the lock, so the application may change settings from inside the callback
+        if (callback) {
+            callback(userData);
+        }
+    }
+
+    void EncoderControl::setExpectedVideo(ExpectedVideo const & video) {
+        std::lock_guard<std::mutex> lock(mutex);
+        expectedVideo = video;
+    }
+
+    EncoderControl::ExpectedVideo EncoderControl::getExpectedVideo() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return expectedVideo;
+    }
+
+    void EncoderControl::recordRateTarget(int32_t kbps, int32_t framerate) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rateTarget = { kbps, framerate };
+    }
+
+    EncoderControl::RateTarget EncoderControl::getRateTarget() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rateTarget;
+    }
+
+    void EncoderControl::resetRateTarget() {
+        std::lock_guard<std::mutex> lock(mutex);
+        rateTarget = { 0, 0 };
+    }
+
+    void EncoderControl::recordFrameSent() {
+        if (isFrameSent) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!isFrameSent) {
+            firstFrameSentTime = std::chrono::steady_clock::now();
+            isFrameSent = true;
+        }
+    }
+
+    void EncoderControl::recordFrameEncoded() {
+        if (isFrameEncoded) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        // Output without a frame sent first doesn't belong to this broadcast
+        if (isFrameEncoded || !isFrameSent) {
+            return;
+        }
+        firstFrameLatency = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - firstFrameSentTime);
+        isFrameEncoded = true;
+    }
+
+    std::chrono::microseconds EncoderControl::getFirstFrameLatency() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return firstFrameLatency;
+    }
+
+    void EncoderControl::resetFirstFrameLatency() {
+        std::lock_guard<std::mutex> lock(mutex);
+        isFrameSent = false;
+        isFrameEncoded = false;
+        firstFrameLatency = std::chrono::microseconds(-1);
+    }
+
+    void EncoderControl::setScreenContentMode(caff_ScreenContentMode mode) { screenContentMode = mode; }
+
+    caff_ScreenContentMode EncoderControl::getScreenContentMode() const { return screenContentMode; }
+
+    // Must be called with |mutex| held
+    void EncoderControl::updateContentProfile() {
+        auto found = gameContentProfiles.find(currentGameId);
+        auto profile = found != gameContentProfiles.end() ? found->second : caff_ContentProfileDefault;
+        if (profile != contentProfile) {
+            contentProfile = profile;
+            ++contentProfileGeneration;
+        }
+    }
+
+} // namespace caff
@@ -0,0 +1,137 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "caffeine.h"
+
+namespace caff {
+
+    // Encoder options set through the C API, and encoder state reported back through it. One of these is shared by an
+    // instance and every encoder its factory creates, so settings can be changed from the application's thread while
+    // WebRTC's encoder thread reads them.
+    class EncoderControl {
+    public:
+        struct Threading {
+            caff_EncoderThreading mode;
+            int32_t maxLatencyFrames;
+        };
+
+        struct SpeedStats {
+            int32_t level;  // -1 until an encoder has started
+            uint64_t increases;
+            uint64_t decreases;
+        };
+
+        // What the broadcast expects WebRTC to initialize the encoder with. Known before the first frame, so the
+        // encoder can be opened while signaling is still going on
+        struct ExpectedVideo {
+            int32_t width;  // 0 when unknown
+            int32_t height;
+            int32_t maxKbps;
+            int32_t framerate;
+            bool isScreenContent;
+        };
+
+        // What WebRTC currently asks the encoder for, following bandwidth estimation
+        struct RateTarget {
+            int32_t kbps;  // 0 until the encoder has been given a rate
+            int32_t framerate;
+        };
+
+        void setThreading(caff_EncoderThreading mode, int32_t maxLatencyFrames);
+        Threading getThreading() const;
+
+        // Called by the encoder whenever it picks a preset. An encoder created later in the same broadcast, e.g. for
+        // a new resolution, starts from the last level recorded
+        void recordSpeedLevel(int32_t level);
+        SpeedStats getSpeedStats() const;
+        // Called at the start of each broadcast
+        void resetSpeedStats();
+
+        void setGameContentProfile(std::string const & gameId, caff_ContentProfile profile);
+        // Called by the broadcast whenever its game changes
+        void setCurrentGame(std::string const & gameId);
+        // Profile of the current game, and the generation it belongs to
+        caff_ContentProfile getContentProfile(uint64_t * generation) const;
+        // Changes whenever the current game's profile does. Cheap enough to check on every frame
+        uint64_t getContentProfileGeneration() const;
+
+        void setRegionsOfInterest(std::vector<caff_VideoRegion> regions);
+        // Current regions, and the generation they belong to
+        std::vector<caff_VideoRegion> getRegionsOfInterest(uint64_t * generation) const;
+        // Changes whenever the regions do. Cheap enough to check on every frame
+        uint64_t getRegionsOfInterestGeneration() const;
+
+        // Whether the application sends video it encoded itself, which is passed through instead of encoded again
+        void setEncodedVideo(bool enabled, caff_KeyFrameRequestCallback keyFrameRequestCallback, void * userData);
+        // Called at the start of each broadcast. Fixes the setting above for the broadcast and every encoder created
+        // during it, so an encoder WebRTC recreates mid-broadcast still matches the frames the capturer sends
+        void latchEncodedVideo();
+        // Whether the current broadcast sends encoded video, as latched at its start
+        bool isEncodedVideoEnabled() const;
+        // Asks the application for a key frame. Called on WebRTC's encoder thread
+        void requestKeyFrame();
+
+        void setExpectedVideo(ExpectedVideo const & video);
+        ExpectedVideo getExpectedVideo() const;
+
+        // Called by the encoder whenever WebRTC sets its rate. Reported to the application, which has to follow it
+        // itself when it sends encoded video
+        void recordRateTarget(int32_t kbps, int32_t framerate);
+        RateTarget getRateTarget() const;
+        // Called at the start of each broadcast
+        void resetRateTarget();
+
+        // Time from the first frame the application sends in a broadcast until the encoder first outputs anything.
+        // Both calls happen on every frame and only take the lock the first time
+        void recordFrameSent();
+        void recordFrameEncoded();
+        // -1 until the first frame has been encoded
+        std::chrono::microseconds getFirstFrameLatency() const;
+        // Called at the start of each broadcast
+        void resetFirstFrameLatency();
+
+        // Read by the broadcast on every frame, so it is a plain atomic rather than guarded by the mutex
+        void setScreenContentMode(caff_ScreenContentMode mode);
+        caff_ScreenContentMode getScreenContentMode() const;
+
+    private:
+        mutable std::mutex mutex;
+        Threading threading{ caff_EncoderThreadingSingle, 0 };
+        SpeedStats speedStats{ -1, 0, 0 };
+
+        void updateContentProfile();
+
+        std::map<std::string, caff_ContentProfile> gameContentProfiles;
+        std::string currentGameId;
+        caff_ContentProfile contentProfile = caff_ContentProfileDefault;
+        std::atomic<uint64_t> contentProfileGeneration{ 0 };
+
+        std::vector<caff_VideoRegion> regionsOfInterest;
+        std::atomic<uint64_t> regionsOfInterestGeneration{ 0 };
+
+        bool isEncodedVideoRequested = false;
+        bool isEncodedVideo = false;
+        caff_KeyFrameRequestCallback keyFrameRequestCallback = nullptr;
+        void * keyFrameRequestUserData = nullptr;
+
+        std::atomic<caff_ScreenContentMode> screenContentMode{ caff_ScreenContentOff };
+
+        ExpectedVideo expectedVideo{ 0, 0, 0, 0, false };
+        RateTarget rateTarget{ 0, 0 };
+
+        std::atomic<bool> isFrameSent{ false };
+        std::atomic<bool> isFrameEncoded{ false };
+        std::chrono::steady_clock::time_point firstFrameSentTime;
+        std::chrono::microseconds firstFrameLatency{ -1 };
+    };
+
+} // namespace caff
@@ -0,0 +1,66 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "EncoderSpeedController.hpp"
+
+namespace caff {
+
+    using namespace std::chrono_literals;
+
+    SmoothedThreshold::Settings constexpr loadSettings{
+        // About 16 frames at 60 fps
+        250ms,
+        // The next slower preset costs up to about twice as much, so it only fits if encoding uses under half the
+        // budget
+        0.4,
+        10s,
+        // Above this load encoding can't absorb a slow frame without falling behind
+        0.85,
+    };
+
+    // Frames measured after a reset before the load is trusted
+    int32_t constexpr minSamples = 30;
+
+    // Time after a reset before any change, so the new preset's cost shows up in the load
+    auto constexpr settleTime = 2s;
+
+    EncoderSpeedController::EncoderSpeedController() : load(loadSettings) {}
+
+    EncoderSpeedController::Adjustment EncoderSpeedController::onFrameEncoded(
+            std::chrono::microseconds now,
+            std::chrono::microseconds encodeTime,
+            std::chrono::microseconds frameInterval) {
+        if (frameInterval <= 0us) {
+            return Adjustment::None;
+        }
+        if (!hasStarted) {
+            reset(now);
+        }
+
+        auto level = load.update(now, static_cast<double>(encodeTime.count()) / frameInterval.count());
+        ++sampleCount;
+
+        if (sampleCount < minSamples || now - settledAt < settleTime) {
+            return Adjustment::None;
+        }
+
+        switch (level) {
+        case SmoothedThreshold::Level::High:
+            reset(now);
+            return Adjustment::Faster;
+        case SmoothedThreshold::Level::SustainedLow:
+            reset(now);
+            return Adjustment::Slower;
+        case SmoothedThreshold::Level::Between:
+        default:
+            return Adjustment::None;
+        }
+    }
+
+    void EncoderSpeedController::reset(std::chrono::microseconds now) {
+        hasStarted = true;
+        load.reset();
+        sampleCount = 0;
+        settledAt = now;
+    }
+
+} // namespace caff
@@ -0,0 +1,41 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "SmoothedThreshold.hpp"
+
+namespace caff {
+
+    // Decides when the encoder should switch to a faster or slower preset, by comparing how long each frame takes to
+    // encode with the time available for it. A faster preset is asked for as soon as encoding uses most of the frame
+    // interval; a slower one only after a long stretch of spare time, so the encoder doesn't oscillate between two
+    // presets. After every change the load is measured afresh before deciding again.
+    class EncoderSpeedController {
+    public:
+        enum class Adjustment { None, Faster, Slower };
+
+        EncoderSpeedController();
+
+        // Records a frame that took |encodeTime| to encode, with |frameInterval| between frames, at time |now|
+        Adjustment onFrameEncoded(
+                std::chrono::microseconds now,
+                std::chrono::microseconds encodeTime,
+                std::chrono::microseconds frameInterval);
+
+        // Starts measuring from scratch. The encoder calls this whenever its preset changes
+        void reset(std::chrono::microseconds now);
+
+        // Smoothed share of the frame interval spent encoding
+        double getLoad() const { return load.getValue(); }
+
+    private:
+        SmoothedThreshold load;
+        int32_t sampleCount = 0;
+        bool hasStarted = false;
+        std::chrono::microseconds settledAt{};
+    };
+
+} // namespace caff
@@ -0,0 +1,125 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "FrameCadence.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace caff {
+    using namespace std::chrono_literals;
+
+    // Gaps longer than this (paused capture, a stalled game) start a new clock instead of counting as late frames
+    auto constexpr resyncGap = 1s;
+
+    // Weight of each new frame interval in the source interval estimate, as 1 / n
+    int constexpr intervalSmoothing = 8;
+
+    // Fraction of the prediction error that is applied to each smoothed timestamp, as 1 / n
+    int constexpr jitterSmoothing = 4;
+
+    // Fraction of each kept frame's offset from its tick that the output clock is pulled by, as 1 / n. This lets the
+    // clock lock onto sources that run slightly slow or fast (e.g. 59.94 Hz at 30 fps) instead of slipping a frame
+    // every few seconds.
+    int constexpr phaseSmoothing = 16;
+
+    // Slack on the tick interval, as 1 / n, within which the source still counts as keeping up with the output rate.
+    // Covers tick intervals rounded to whole microseconds and sources like 59.94 Hz at 60 fps
+    int constexpr sourceRateTolerance = 64;
+
+    FrameCadence::FrameCadence(int32_t framerate) : framerate(framerate) {}
+
+    void FrameCadence::setFramerate(int32_t framerate) {
+        this->framerate = framerate;
+        hasOrigin = false;
+    }
+
+    std::chrono::microseconds FrameCadence::tickTime(int64_t index) const {
+        return origin + std::chrono::microseconds(index * 1'000'000 / framerate);
+    }
+
+    int64_t FrameCadence::nearestTick(std::chrono::microseconds time) const {
+        auto elapsed = (time - origin).count();
+        return (elapsed * framerate + 500'000) / 1'000'000;
+    }
+
+    void FrameCadence::resync(std::chrono::microseconds time) {
+        hasOrigin = true;
+        origin = time;
+        nextTickIndex = 1;
+    }
+
+    std::chrono::microseconds FrameCadence::smooth(std::chrono::microseconds timestamp) {
+        auto delta = timestamp - lastTimestamp;
+        bool const isContinuous = hasLastTimestamp && delta > 0us && delta < resyncGap;
+        hasLastTimestamp = true;
+        lastTimestamp = timestamp;
+
+        if (!isContinuous) {
+            sourceInterval = 0us;
+            lastSmoothedTimestamp = timestamp;
+            return timestamp;
+        }
+
+        if (sourceInterval == 0us) {
+            sourceInterval = delta;
+        } else {
+            sourceInterval += (delta - sourceInterval) / intervalSmoothing;
+        }
+
+        // Errors of more than half a frame are real discontinuities (e.g. the source skipped a frame), not jitter
+        auto predicted = lastSmoothedTimestamp + sourceInterval;
+        auto error = timestamp - predicted;
+        if (std::abs(error.count()) > sourceInterval.count() / 2) {
+            lastSmoothedTimestamp = timestamp;
+        } else {
+            lastSmoothedTimestamp = predicted + error / jitterSmoothing;
+        }
+        return lastSmoothedTimestamp;
+    }
+
+    bool FrameCadence::acceptFrame(std::chrono::microseconds timestamp, std::chrono::microseconds * smoothedTimestamp) {
+        auto previousSmoothed = lastSmoothedTimestamp;
+        auto previousSourceInterval = sourceInterval;
+        auto smoothed = smooth(timestamp);
+        *smoothedTimestamp = smoothed;
+
+        auto tick = tickTime(nextTickIndex);
+        auto interval = tickTime(nextTickIndex + 1) - tick;
+        // Going back by more than a tick means the caller's clock restarted. A repeated or slightly earlier timestamp
+        // is just an early frame, and is decimated like one
+        bool const isClockRestarted = smoothed < previousSmoothed - interval;
+        if (!hasOrigin || isClockRestarted || smoothed - tick > resyncGap) {
+            resync(smoothed);
+            ++acceptedFrames;
+            return true;
+        }
+
+        // Keep the frame if the next one is expected to land further from the tick than this one. Until the source
+        // interval is known, only frames at or past the tick qualify.
+        auto halfSourceInterval = std::min(sourceInterval, interval) / 2;
+        if (smoothed < tick - halfSourceInterval) {
+            ++decimatedFrames;
+            return false;
+        }
+
+        if (smoothed > tick + interval / 2) {
+            // One or more ticks went by without a frame. Line the clock back up with this frame. A source slower than
+            // the output rate misses ticks all the time, so only a source known to keep up counts the frame as late
+            bool const isSourceKeepingUp = previousSourceInterval > 0us &&
+                                           previousSourceInterval <= interval + interval / sourceRateTolerance;
+            if (isSourceKeepingUp) {
+                ++lateFrames;
+            }
+            nextTickIndex = nearestTick(smoothed);
+        } else {
+            origin += (smoothed - tick) / phaseSmoothing;
+        }
+
+        ++nextTickIndex;
+        ++acceptedFrames;
+        return true;
+    }
+
+    FrameCadence::Stats FrameCadence::getStats() const { return { acceptedFrames, decimatedFrames, lateFrames }; }
+
+} // namespace caff
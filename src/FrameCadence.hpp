@@ -0,0 +1,60 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace caff {
+
+    // Decimates incoming frames to a steady output framerate. Output ticks are laid out on an ideal clock, and the
+    // frame nearest each tick is kept, so a 60 Hz source at 30 fps keeps every other frame instead of an uneven mix.
+    // Caller timestamps are smoothed before use, so small jitter doesn't move frames across tick boundaries.
+    //
+    // acceptFrame must always be called from the same thread. Stats can be read from any thread.
+    class FrameCadence {
+    public:
+        struct Stats {
+            uint64_t acceptedFrames;
+            uint64_t decimatedFrames;
+            // Accepted, but more than half a tick after the tick they were meant for, from a source that otherwise keeps
+            // up with the output rate. A slower source, e.g. 24 fps at 30, misses ticks by design and isn't counted
+            uint64_t lateFrames;
+        };
+
+        explicit FrameCadence(int32_t framerate);
+
+        // Resets the output clock
+        void setFramerate(int32_t framerate);
+
+        // Returns true if the frame should be delivered, with its jitter-smoothed timestamp in |smoothedTimestamp|
+        bool acceptFrame(std::chrono::microseconds timestamp, std::chrono::microseconds * smoothedTimestamp);
+
+        Stats getStats() const;
+
+    private:
+        std::chrono::microseconds smooth(std::chrono::microseconds timestamp);
+        std::chrono::microseconds tickTime(int64_t index) const;
+        int64_t nearestTick(std::chrono::microseconds time) const;
+        void resync(std::chrono::microseconds time);
+
+        int32_t framerate;
+
+        // Jitter filter
+        bool hasLastTimestamp = false;
+        std::chrono::microseconds lastTimestamp{};
+        std::chrono::microseconds lastSmoothedTimestamp{};
+        std::chrono::microseconds sourceInterval{};
+
+        // Output clock. Ticks are computed from the origin rather than accumulated, so rounding doesn't drift.
+        bool hasOrigin = false;
+        std::chrono::microseconds origin{};
+        int64_t nextTickIndex = 0;
+
+        std::atomic<uint64_t> acceptedFrames{ 0 };
+        std::atomic<uint64_t> decimatedFrames{ 0 };
+        std::atomic<uint64_t> lateFrames{ 0 };
+    };
+
+} // namespace caff
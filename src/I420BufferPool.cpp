@@ -0,0 +1,43 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "I420BufferPool.hpp"
+
+#include <algorithm>
+
+#include "ErrorLogging.hpp"
+
+namespace caff {
+
+    I420BufferPool::I420BufferPool(size_t maxBuffers) : maxBuffers(maxBuffers) {}
+
+    rtc::scoped_refptr<webrtc::I420Buffer> I420BufferPool::createBuffer(int32_t width, int32_t height) {
+        // If the pool holds the only reference, nobody downstream is using the buffer anymore
+        auto isFree = [](rtc::scoped_refptr<PooledBuffer> const & buffer) { return buffer->HasOneRef(); };
+
+        auto match = std::find_if(buffers.begin(), buffers.end(), [&](auto const & buffer) {
+            return isFree(buffer) && buffer->width() == width && buffer->height() == height;
+        });
+        if (match != buffers.end()) {
+            ++hits;
+            return *match;
+        }
+
+        ++misses;
+        if (buffers.size() >= maxBuffers) {
+            // Make room by evicting an idle buffer of a different resolution
+            auto idle = std::find_if(buffers.begin(), buffers.end(), isFree);
+            if (idle == buffers.end()) {
+                LOG_WARNING("All %zu pooled video buffers are in use", maxBuffers);
+                return nullptr;
+            }
+            buffers.erase(idle);
+        }
+
+        rtc::scoped_refptr<PooledBuffer> buffer = new PooledBuffer(width, height);
+        buffers.push_back(buffer);
+        return buffer;
+    }
+
+    I420BufferPool::Stats I420BufferPool::getStats() const { return { hits, misses }; }
+
+} // namespace caff
@@ -0,0 +1,45 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "rtc_base/refcountedobject.h"
+#include "rtc_base/scoped_ref_ptr.h"
+
+namespace caff {
+
+    // Recycles I420 buffers once WebRTC lets go of them. This works like webrtc::I420BufferPool, but buffers of
+    // different resolutions can live side by side so the conversion and scaling stages can share a pool.
+    //
+    // createBuffer must always be called from the same thread. Buffers can be released from any thread.
+    class I420BufferPool {
+    public:
+        struct Stats {
+            uint64_t hits;
+            uint64_t misses;
+        };
+
+        explicit I420BufferPool(size_t maxBuffers);
+        I420BufferPool(I420BufferPool const &) = delete;
+        I420BufferPool & operator=(I420BufferPool const &) = delete;
+
+        // Returns nullptr if every buffer in the pool is still in use
+        rtc::scoped_refptr<webrtc::I420Buffer> createBuffer(int32_t width, int32_t height);
+
+        Stats getStats() const;
+
+    private:
+        using PooledBuffer = rtc::RefCountedObject<webrtc::I420Buffer>;
+
+        std::vector<rtc::scoped_refptr<PooledBuffer>> buffers;
+        size_t const maxBuffers;
+
+        std::atomic<uint64_t> hits{ 0 };
+        std::atomic<uint64_t> misses{ 0 };
+    };
+
+} // namespace caff
@@ -4,6 +4,7 @@
 
 #include "AudioDevice.hpp"
 #include "Broadcast.hpp"
+#include "PassthroughEncoder.hpp"
 #include "X264Encoder.hpp"
 
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
@@ -16,22 +17,47 @@
 #include "media/base/mediaconstants.h"
 #include "modules/audio_processing/include/audio_processing.h"
 #include "rtc_base/thread.h"
+#include "system_wrappers/include/cpu_info.h"
 
 namespace caff {
 
+    // Largest RTP payload WebRTC asks the encoder for: its video MTU
+    size_t constexpr expectedMaxPayloadSize = 1200;
+
     // TODO: Use hardware encoding on low powered cpu or high quality GPU
     class EncoderFactory : public webrtc::VideoEncoderFactory {
     public:
+        explicit EncoderFactory(std::shared_ptr<EncoderControl> encoderControl)
+            : encoderControl(std::move(encoderControl)) {}
+
         virtual ~EncoderFactory() {}
 
+        // In order of preference. The remote answer decides which one is used, and X264Encoder encodes to match. None
+        // of them use B-frames. Packetization mode 1 lets whole-frame slices be split into FU-A packets; mode 0 needs a
+        // slice per packet and is only a fallback, which encoded video from the application can't use
         virtual std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override {
-            auto profileId =
-                    webrtc::H264::ProfileLevelId(webrtc::H264::kProfileConstrainedBaseline, webrtc::H264::kLevel3_1);
-            auto name = cricket::kH264CodecName;
-            auto profile_string = webrtc::H264::ProfileLevelIdToString(profileId);
-            std::map<std::string, std::string> parameters = { { cricket::kH264FmtpProfileLevelId,
-                                                                profile_string.value() } };
-            return { webrtc::SdpVideoFormat(name, parameters) };
+            webrtc::H264::Profile const profiles[] = { webrtc::H264::kProfileHigh,
+                                                       webrtc::H264::kProfileMain,
+                                                       webrtc::H264::kProfileConstrainedBaseline };
+            std::vector<char const *> packetizationModes = { "1" };
+            if (!encoderControl->isEncodedVideoEnabled()) {
+                packetizationModes.push_back("0");
+            }
+            std::vector<webrtc::SdpVideoFormat> formats;
+            for (auto profile : profiles) {
+                auto profileId = webrtc::H264::ProfileLevelId(profile, webrtc::H264::kLevel3_1);
+                auto name = cricket::kH264CodecName;
+                auto profile_string = webrtc::H264::ProfileLevelIdToString(profileId);
+                for (auto packetizationMode : packetizationModes) {
+                    std::map<std::string, std::string> parameters = {
+                        { cricket::kH264FmtpProfileLevelId, profile_string.value() },
+                        { cricket::kH264FmtpLevelAsymmetryAllowed, "1" },
+                        { cricket::kH264FmtpPacketizationMode, packetizationMode },
+                    };
+                    formats.emplace_back(name, parameters);
+                }
+            }
+            return formats;
         }
 
         virtual CodecInfo QueryVideoEncoder(webrtc::SdpVideoFormat const & format) const override {
@@ -40,11 +66,21 @@ namespace caff {
 
         virtual std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
                 webrtc::SdpVideoFormat const & format) override {
-            return std::make_unique<X264Encoder>(cricket::VideoCodec(format));
+            if (encoderControl->isEncodedVideoEnabled()) {
+                return std::make_unique<PassthroughEncoder>(cricket::VideoCodec(format), encoderControl);
+            }
+            // WebRTC creates the encoder once the answer is applied, but only initializes it with the first frame.
+            // Opening x264 here takes that time off the first frame's latency
+            auto encoder = std::make_unique<X264Encoder>(cricket::VideoCodec(format), encoderControl);
+            encoder->prepare(webrtc::CpuInfo::DetectNumberOfCores(), expectedMaxPayloadSize);
+            return std::move(encoder);
         }
+
+    private:
+        std::shared_ptr<EncoderControl> encoderControl;
     };
 
-    Instance::Instance() : taskQueue("caffeine-dispatcher") {
+    Instance::Instance() : encoderControl(std::make_shared<EncoderControl>()), taskQueue("caffeine-dispatcher") {
         networkThread = rtc::Thread::CreateWithSocketServer();
         networkThread->SetName("caffeine-network", nullptr);
         networkThread->Start();
@@ -67,7 +103,7 @@ namespace caff {
                 audioDevice,
                 webrtc::CreateBuiltinAudioEncoderFactory(),
                 webrtc::CreateBuiltinAudioDecoderFactory(),
-                std::make_unique<EncoderFactory>(),
+                std::make_unique<EncoderFactory>(encoderControl),
                 webrtc::CreateBuiltinVideoDecoderFactory(),
                 nullptr,
                 nullptr);
@@ -182,13 +218,19 @@ namespace caff {
             return caff_ResultAlreadyBroadcasting;
         }
 
+        encoderControl->resetSpeedStats();
+        encoderControl->resetFirstFrameLatency();
+        encoderControl->resetRateTarget();
+        encoderControl->latchEncodedVideo();
         broadcast = std::make_shared<Broadcast>(
                 *sharedCredentials,
                 userInfo->username,
                 std::move(title),
                 rating,
                 std::move(gameId),
+                videoOptions,
                 audioDevice,
+                encoderControl,
                 factory);
 
         auto dispatchFailure = [=, clientId = broadcast->getClientId()](caff_Result error) {
@@ -223,4 +265,16 @@ namespace caff {
         }
     }
 
+    void Instance::setAsyncVideo(bool enabled, size_t queueDepth, caff_VideoDropPolicy dropPolicy) {
+        std::lock_guard<std::mutex> lock(broadcastMutex);
+        videoOptions.isAsync = enabled;
+        videoOptions.queueDepth = queueDepth;
+        videoOptions.dropPolicy = dropPolicy;
+    }
+
+    void Instance::setParallelVideoThreshold(int64_t pixels) {
+        std::lock_guard<std::mutex> lock(broadcastMutex);
+        videoOptions.parallelPixelThreshold = pixels;
+    }
+
 } // namespace caff
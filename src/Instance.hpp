@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include "Broadcast.hpp"
+#include "EncoderControl.hpp"
 #include "RestApi.hpp"
 #include "caffeine.h"
 
@@ -20,7 +22,6 @@ namespace rtc {
 }
 
 namespace caff {
-    class Broadcast;
     class AudioDevice;
 
     class Instance {
@@ -53,10 +54,16 @@ namespace caff {
 
         void endBroadcast();
 
+        void setAsyncVideo(bool enabled, size_t queueDepth, caff_VideoDropPolicy dropPolicy);
+        void setParallelVideoThreshold(int64_t pixels);
+
+        EncoderControl & getEncoderControl() { return *encoderControl; }
+
     private:
         caff_Result authenticate(std::function<AuthResponse()> signinFunc);
 
         rtc::scoped_refptr<AudioDevice> audioDevice;
+        std::shared_ptr<EncoderControl> encoderControl;
         rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory;
         std::unique_ptr<rtc::Thread> networkThread;
         std::unique_ptr<rtc::Thread> workerThread;
@@ -66,6 +73,7 @@ namespace caff {
         mutable optional<SharedCredentials> sharedCredentials;
         std::shared_ptr<Broadcast> broadcast;
         std::mutex broadcastMutex;
+        VideoOptions videoOptions;  // guarded by broadcastMutex
 
         // copies for sharing with C
         optional<std::string> refreshToken;
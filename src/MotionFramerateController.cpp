@@ -0,0 +1,48 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "MotionFramerateController.hpp"
+
+namespace caff {
+
+    using namespace std::chrono_literals;
+
+    SmoothedThreshold::Settings constexpr motionSettings{
+        // Short enough to catch the start of the action, long enough that a single cut or flash doesn't count
+        500ms,
+        // Calm: a lobby, a menu, or a slow pan. At 60 fps this is about one luma step per frame
+        60.0,
+        3s,
+        // Moving: full framerate comes back at once
+        150.0,
+    };
+
+    MotionFramerateController::MotionFramerateController() : motion(motionSettings) {}
+
+    void MotionFramerateController::onFrame(std::chrono::microseconds now, double distance) {
+        if (!hasStarted) {
+            hasStarted = true;
+            lastFrameTime = now;
+            return;
+        }
+
+        auto elapsed = now - lastFrameTime;
+        if (elapsed <= 0us) {
+            return;
+        }
+        lastFrameTime = now;
+
+        // Measured per second, so the same motion reads the same at 30 and 60 fps
+        double rate = distance / std::chrono::duration<double>(elapsed).count();
+        switch (motion.update(now, rate)) {
+        case SmoothedThreshold::Level::High:
+            isHigh = true;
+            break;
+        case SmoothedThreshold::Level::SustainedLow:
+            isHigh = false;
+            break;
+        case SmoothedThreshold::Level::Between:
+            break;
+        }
+    }
+
+} // namespace caff
@@ -0,0 +1,35 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+
+#include "SmoothedThreshold.hpp"
+
+namespace caff {
+
+    // Decides whether captured video moves enough to be worth a framerate above 30 fps. Motion is measured as how fast
+    // the frame's luma signature (see computeLumaSignature) changes. Full framerate is kept until the picture has been
+    // calm for a few seconds, and comes back as soon as it moves again, so a pause in the action doesn't cost the
+    // next burst its smoothness.
+    class MotionFramerateController {
+    public:
+        MotionFramerateController();
+
+        // Records a frame captured at time |now| whose luma signature differs by |distance| (0-255) from the frame
+        // measured before it
+        void onFrame(std::chrono::microseconds now, double distance);
+
+        bool isHighMotion() const { return isHigh; }
+
+        // Smoothed luma signature change per second
+        double getMotion() const { return motion.getValue(); }
+
+    private:
+        SmoothedThreshold motion;
+        bool hasStarted = false;
+        std::chrono::microseconds lastFrameTime{};
+        bool isHigh = true;
+    };
+
+} // namespace caff
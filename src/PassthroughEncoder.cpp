@@ -0,0 +1,245 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "PassthroughEncoder.hpp"
+
+#include <cstdio>
+
+#include "ErrorLogging.hpp"
+
+#include "api/video/i420_buffer.h"
+#include "common_video/h264/h264_common.h"
+#include "media/base/mediaconstants.h"
+#include "modules/include/module_common_types.h"
+#include "modules/video_coding/include/video_codec_interface.h"
+#include "modules/video_coding/include/video_error_codes.h"
+#include "rtc_base/timeutils.h"
+
+namespace caff {
+
+    // While waiting for a key frame, the application is asked again this often in case it missed the request
+    int64_t const kKeyFrameRequestIntervalMs = 1000;
+
+    // Bits of the NAL unit header that are zero when no other picture references this one
+    uint8_t const kNalRefIdcMask = 0x60;
+
+    bool isDisposableAccessUnit(uint8_t const * data, size_t size) {
+        bool hasSlice = false;
+        for (auto const & nalu : webrtc::H264::FindNaluIndices(data, size)) {
+            if (nalu.payload_size == 0) {
+                continue;
+            }
+            uint8_t const header = data[nalu.payload_start_offset];
+            auto const type = webrtc::H264::ParseNaluType(header);
+            if (type != webrtc::H264::NaluType::kSlice && type != webrtc::H264::NaluType::kIdr) {
+                continue;
+            }
+            if (header & kNalRefIdcMask) {
+                return false;
+            }
+            hasSlice = true;
+        }
+        return hasSlice;
+    }
+
+    EncodedVideoBuffer::EncodedVideoBuffer(
+            uint8_t const * data, size_t size, int32_t width, int32_t height, bool isKeyFrame, uint64_t frameNumber)
+        : bytes(data, data + size)
+        , frameWidth(width)
+        , frameHeight(height)
+        , keyFrame(isKeyFrame)
+        , number(frameNumber) {}
+
+    webrtc::VideoFrameBuffer::Type EncodedVideoBuffer::type() const { return Type::kNative; }
+
+    int EncodedVideoBuffer::width() const { return frameWidth; }
+
+    int EncodedVideoBuffer::height() const { return frameHeight; }
+
+    rtc::scoped_refptr<webrtc::I420BufferInterface> EncodedVideoBuffer::ToI420() {
+        auto buffer = webrtc::I420Buffer::Create(frameWidth, frameHeight);
+        webrtc::I420Buffer::SetBlack(buffer.get());
+        return buffer;
+    }
+
+    uint8_t const * EncodedVideoBuffer::data() const { return bytes.data(); }
+
+    size_t EncodedVideoBuffer::size() const { return bytes.size(); }
+
+    bool EncodedVideoBuffer::isKeyFrame() const { return keyFrame; }
+
+    uint64_t EncodedVideoBuffer::frameNumber() const { return number; }
+
+    PassthroughEncoder::PassthroughEncoder(
+            cricket::VideoCodec const & codec, std::shared_ptr<EncoderControl> encoderControl)
+        : encoderControl(std::move(encoderControl)) {
+        std::string packetizationModeString;
+        if (codec.GetParam(cricket::kH264FmtpPacketizationMode, &packetizationModeString) &&
+            packetizationModeString == "1") {
+            packetizationMode = webrtc::H264PacketizationMode::NonInterleaved;
+        }
+        // A missing profile-level-id means Constrained Baseline
+        auto profileLevelId = webrtc::H264::ParseSdpProfileLevelId(codec.params);
+        if (profileLevelId) {
+            profile = profileLevelId->profile;
+        }
+    }
+
+    int32_t PassthroughEncoder::InitEncode(
+            webrtc::VideoCodec const * codecSettings, int32_t numberOfCores, size_t maxPayloadSize) {
+        if (!codecSettings || codecSettings->codecType != webrtc::kVideoCodecH264) {
+            return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+        }
+        if (packetizationMode != webrtc::H264PacketizationMode::NonInterleaved) {
+            // Access units from the application may have slices of any size, and single NAL unit mode can't split them
+            LOG_ERROR("Encoded video needs H.264 packetization mode 1");
+            return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
+        }
+
+        // WebRTC calls this again whenever the frame size changes. The application starts a new size with a key
+        // frame anyway, so there is no need to wait for one here
+        mode = codecSettings->mode;
+        LOG_DEBUG("Passing through encoded video at %dx%d", codecSettings->width, codecSettings->height);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    int32_t PassthroughEncoder::Release() { return WEBRTC_VIDEO_CODEC_OK; }
+
+    int32_t PassthroughEncoder::RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback * callback) {
+        encodedImageCallback = callback;
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    int32_t PassthroughEncoder::SetRateAllocation(
+            webrtc::BitrateAllocation const & bitrateAllocation, uint32_t framerate) {
+        // The application's encoder is configured by the application, which reads the rate back from the video stats
+        if (encoderControl) {
+            encoderControl->recordRateTarget(
+                    static_cast<int32_t>(bitrateAllocation.get_sum_kbps()), static_cast<int32_t>(framerate));
+        }
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    int32_t PassthroughEncoder::SetChannelParameters(uint32_t packetLoss, int64_t rtt) {
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    int32_t PassthroughEncoder::Encode(
+            webrtc::VideoFrame const & frame,
+            webrtc::CodecSpecificInfo const * codecSpecificInfo,
+            std::vector<webrtc::FrameType> const * frameTypes) {
+        if (!encodedImageCallback) {
+            return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+        }
+
+        auto frameBuffer = frame.video_frame_buffer();
+        if (frameBuffer->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+            // Black frames from a disabled track, or raw video sent alongside encoded video
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+        auto encodedBuffer = static_cast<EncodedVideoBuffer const *>(frameBuffer.get());
+
+        if (frameTypes && !frameTypes->empty() && (*frameTypes)[0] == webrtc::kVideoFrameKey &&
+            !encodedBuffer->isKeyFrame()) {
+            requestKeyFrame();
+        }
+
+        bool const isContinuous = encodedBuffer->frameNumber() == nextFrameNumber;
+        nextFrameNumber = encodedBuffer->frameNumber() + 1;
+        if (encodedBuffer->isKeyFrame() && !isNegotiatedProfile(*encodedBuffer)) {
+            isWaitingForKeyFrame = true;
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+        if (encodedBuffer->isKeyFrame()) {
+            isWaitingForKeyFrame = false;
+        } else if (!isContinuous && !isWaitingForKeyFrame) {
+            LOG_DEBUG("Encoded video frame dropped before the encoder; waiting for a key frame");
+            isWaitingForKeyFrame = true;
+            requestKeyFrame();
+        }
+
+        if (isWaitingForKeyFrame) {
+            if (rtc::TimeMillis() - lastKeyFrameRequestMs >= kKeyFrameRequestIntervalMs) {
+                requestKeyFrame();
+            }
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+
+        auto nalus = webrtc::H264::FindNaluIndices(encodedBuffer->data(), encodedBuffer->size());
+        if (nalus.empty()) {
+            LOG_ERROR("Encoded video frame has no Annex B start codes");
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+
+        webrtc::RTPFragmentationHeader fragHeader;
+        fragHeader.VerifyAndAllocateFragmentationHeader(nalus.size());
+        for (size_t i = 0; i < nalus.size(); ++i) {
+            fragHeader.fragmentationOffset[i] = nalus[i].payload_start_offset;
+            fragHeader.fragmentationLength[i] = nalus[i].payload_size;
+            fragHeader.fragmentationPlType[i] = 0;
+            fragHeader.fragmentationTimeDiff[i] = 0;
+        }
+
+        // The packetizer copies what it needs before OnEncodedImage returns, so the image can point into the frame
+        webrtc::EncodedImage encodedImage(
+                const_cast<uint8_t *>(encodedBuffer->data()), encodedBuffer->size(), encodedBuffer->size());
+        encodedImage._encodedWidth = encodedBuffer->width();
+        encodedImage._encodedHeight = encodedBuffer->height();
+        encodedImage._timeStamp = frame.timestamp();
+        encodedImage.ntp_time_ms_ = frame.ntp_time_ms();
+        encodedImage.capture_time_ms_ = frame.render_time_ms();
+        encodedImage.rotation_ = frame.rotation();
+        encodedImage.content_type_ = (mode == webrtc::VideoCodecMode::kScreensharing)
+                                             ? webrtc::VideoContentType::SCREENSHARE
+                                             : webrtc::VideoContentType::UNSPECIFIED;
+        encodedImage.timing_.flags = webrtc::VideoSendTiming::kInvalid;
+        encodedImage._frameType = encodedBuffer->isKeyFrame() ? webrtc::kVideoFrameKey : webrtc::kVideoFrameDelta;
+        encodedImage._completeFrame = true;
+
+        bitstreamParser.ParseBitstream(encodedImage._buffer, encodedImage._length);
+        bitstreamParser.GetLastSliceQp(&encodedImage.qp_);
+
+        webrtc::CodecSpecificInfo codecSpecific;
+        codecSpecific.codecType = webrtc::kVideoCodecH264;
+        codecSpecific.codecSpecific.H264.packetization_mode = webrtc::H264PacketizationMode::NonInterleaved;
+        if (encoderControl) {
+            encoderControl->recordFrameEncoded();
+        }
+        encodedImageCallback->OnEncodedImage(encodedImage, &codecSpecific, &fragHeader);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    void PassthroughEncoder::requestKeyFrame() {
+        lastKeyFrameRequestMs = rtc::TimeMillis();
+        if (encoderControl) {
+            encoderControl->requestKeyFrame();
+        }
+    }
+
+    // The three bytes after an SPS's NAL header are laid out like an SDP profile-level-id
+    bool PassthroughEncoder::isNegotiatedProfile(EncodedVideoBuffer const & buffer) const {
+        for (auto const & nalu : webrtc::H264::FindNaluIndices(buffer.data(), buffer.size())) {
+            auto const payload = buffer.data() + nalu.payload_start_offset;
+            if (nalu.payload_size < 4 || webrtc::H264::ParseNaluType(payload[0]) != webrtc::H264::NaluType::kSps) {
+                continue;
+            }
+            char spsProfileLevelId[7];
+            std::snprintf(
+                    spsProfileLevelId, sizeof(spsProfileLevelId), "%02x%02x%02x", payload[1], payload[2], payload[3]);
+            auto const spsProfile = webrtc::H264::ParseProfileLevelId(spsProfileLevelId);
+            if (!spsProfile || spsProfile->profile != profile) {
+                LOG_ERROR(
+                        "Encoded video has H.264 profile-level-id %s, which doesn't match the negotiated profile",
+                        spsProfileLevelId);
+                return false;
+            }
+            return true;
+        }
+        // A key frame without an SPS uses one sent earlier, which was checked then
+        return true;
+    }
+
+    bool PassthroughEncoder::SupportsNativeHandle() const { return true; }
+
+    char const * PassthroughEncoder::ImplementationName() const { return "passthrough"; }
+
+} // namespace caff
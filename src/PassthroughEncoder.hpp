@@ -0,0 +1,95 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "EncoderControl.hpp"
+
+#include "api/video/video_frame_buffer.h"
+#include "common_video/h264/h264_bitstream_parser.h"
+#include "media/base/h264_profile_level_id.h"
+#include "modules/video_coding/codecs/h264/include/h264.h"
+
+namespace caff {
+
+    // An H.264 access unit encoded by the application, carried through the capturer and WebRTC's video pipeline as
+    // a native frame buffer so PassthroughEncoder can send it as-is
+    class EncodedVideoBuffer : public webrtc::VideoFrameBuffer {
+    public:
+        EncodedVideoBuffer(
+                uint8_t const * data,
+                size_t size,
+                int32_t width,
+                int32_t height,
+                bool isKeyFrame,
+                uint64_t frameNumber);
+
+        virtual Type type() const override;
+        virtual int width() const override;
+        virtual int height() const override;
+        // Nothing decodes the access unit, so anything that needs pixels (e.g. a disabled track) gets a black frame
+        virtual rtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override;
+
+        uint8_t const * data() const;
+        size_t size() const;
+        bool isKeyFrame() const;
+        // Counts up by one per access unit sent, so frames dropped on the way to the encoder can be noticed
+        uint64_t frameNumber() const;
+
+    private:
+        std::vector<uint8_t> bytes;
+        int32_t frameWidth;
+        int32_t frameHeight;
+        bool keyFrame;
+        uint64_t number;
+    };
+
+    // Whether no other frame can reference this access unit, i.e. every slice has a nal_ref_idc of 0. Such frames can
+    // be dropped without corrupting the frames that follow
+    bool isDisposableAccessUnit(uint8_t const * data, size_t size);
+
+    // Sends access units from EncodedVideoBuffer frames without re-encoding them. WebRTC may still drop frames before
+    // they reach the encoder, e.g. while the network is congested; after a gap, delta frames would reference pictures
+    // the receiver never got, so they are discarded until the application sends a key frame. Key frames whose SPS has
+    // a different profile than the one negotiated are discarded too, since the receiver may not be able to decode them.
+    class PassthroughEncoder : public webrtc::VideoEncoder {
+    public:
+        PassthroughEncoder(cricket::VideoCodec const & codec, std::shared_ptr<EncoderControl> encoderControl);
+
+        virtual int32_t InitEncode(
+                webrtc::VideoCodec const * codec_settings, int32_t number_of_cores, size_t max_payload_size) override;
+        virtual int32_t Release() override;
+
+        virtual int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback * callback) override;
+        virtual int32_t SetRateAllocation(
+                webrtc::BitrateAllocation const & bitrate_allocation, uint32_t framerate) override;
+        virtual int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
+
+        virtual int32_t Encode(
+                webrtc::VideoFrame const & frame,
+                webrtc::CodecSpecificInfo const * codec_specific_info,
+                std::vector<webrtc::FrameType> const * frame_types) override;
+
+        virtual bool SupportsNativeHandle() const override;
+        virtual char const * ImplementationName() const override;
+
+    private:
+        void requestKeyFrame();
+        bool isNegotiatedProfile(EncodedVideoBuffer const & buffer) const;
+
+        std::shared_ptr<EncoderControl> encoderControl;
+        webrtc::EncodedImageCallback * encodedImageCallback = nullptr;
+        webrtc::VideoCodecMode mode = webrtc::VideoCodecMode::kRealtimeVideo;
+        webrtc::H264PacketizationMode packetizationMode = webrtc::H264PacketizationMode::SingleNalUnit;
+        webrtc::H264::Profile profile = webrtc::H264::kProfileConstrainedBaseline;
+        webrtc::H264BitstreamParser bitstreamParser;
+
+        bool isWaitingForKeyFrame = true;
+        int64_t lastKeyFrameRequestMs = 0;
+        uint64_t nextFrameNumber = 0;
+    };
+
+} // namespace caff
@@ -0,0 +1,69 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "RegionsOfInterest.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace caff {
+
+    // Past this, a region either turns to mush or takes most of the frame's bits
+    float constexpr maxQpOffset = 12.0f;
+
+    // First macroblock whose center is at or past |edge|, a fraction of |count| macroblocks. The edge is clamped to the
+    // frame first, since a float far outside it doesn't fit in an int
+    static int firstMacroblockFrom(double edge, int count) {
+        edge = std::max(0.0, std::min(edge, 1.0));
+        auto index = static_cast<int>(std::ceil(edge * count - 0.5));
+        return std::max(0, std::min(index, count));
+    }
+
+    static bool isFinite(caff_VideoRegion const & region) {
+        return std::isfinite(region.x) && std::isfinite(region.y) && std::isfinite(region.width) &&
+               std::isfinite(region.height) && std::isfinite(region.qpOffset);
+    }
+
+    std::vector<float> computeQuantOffsets(std::vector<caff_VideoRegion> const & regions, int mbWidth, int mbHeight) {
+        auto const macroblockCount = static_cast<size_t>(mbWidth) * mbHeight;
+        std::vector<float> offsets(macroblockCount, 0.0f);
+        std::vector<bool> isInRegion(macroblockCount, false);
+        bool isCovered = false;
+
+        for (auto const & region : regions) {
+            if (!isFinite(region) || region.qpOffset == 0.0f) {
+                continue;
+            }
+            auto qpOffset = std::max(-maxQpOffset, std::min(region.qpOffset, maxQpOffset));
+
+            // Far edges are summed as doubles, since two large floats can add up to infinity
+            int left = firstMacroblockFrom(region.x, mbWidth);
+            int right = firstMacroblockFrom(double{ region.x } + region.width, mbWidth);
+            int top = firstMacroblockFrom(region.y, mbHeight);
+            int bottom = firstMacroblockFrom(double{ region.y } + region.height, mbHeight);
+
+            for (int y = top; y < bottom; ++y) {
+                for (int x = left; x < right; ++x) {
+                    auto index = static_cast<size_t>(y) * mbWidth + x;
+                    offsets[index] = isInRegion[index] ? std::min(offsets[index], qpOffset) : qpOffset;
+                    isInRegion[index] = true;
+                    isCovered = true;
+                }
+            }
+        }
+
+        if (!isCovered) {
+            return {};
+        }
+
+        double sum = 0.0;
+        for (auto offset : offsets) {
+            sum += offset;
+        }
+        auto mean = static_cast<float>(sum / offsets.size());
+        for (auto & offset : offsets) {
+            offset -= mean;
+        }
+        return offsets;
+    }
+
+} // namespace caff
@@ -0,0 +1,18 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <vector>
+
+#include "caffeine.h"
+
+namespace caff {
+
+    // Quantizer offsets for each 16x16 macroblock of a frame |mbWidth| by |mbHeight| macroblocks in size, in raster
+    // order, as x264 takes them in x264_picture_t::prop.quant_offsets. A macroblock belongs to a region if its center
+    // does; where regions overlap the lowest offset wins. All offsets are then shifted so they average zero, which
+    // keeps the frame's mean quantizer, and so its bitrate, about where rate control put it. Returns an empty vector if
+    // no region covers a macroblock.
+    std::vector<float> computeQuantOffsets(std::vector<caff_VideoRegion> const & regions, int mbWidth, int mbHeight);
+
+} // namespace caff
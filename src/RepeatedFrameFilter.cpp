@@ -0,0 +1,39 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "RepeatedFrameFilter.hpp"
+
+namespace caff {
+
+    // Identical frames are still delivered at this interval, so static content goes out at a reduced framerate instead
+    // of stopping altogether
+    int64_t constexpr repeatedFrameIntervalMicros = 200'000;
+
+    // Frames are converted for real at least this often, in case two different frames hash the same
+    int64_t constexpr maxElisionMicros = 1'000'000;
+
+    RepeatedFrameFilter::Decision RepeatedFrameFilter::onFrame(uint64_t frameHash, int64_t timeMicros, bool canRepeat) {
+        bool const isRepeat = canRepeat && hasFrame && frameHash == lastFrameHash &&
+                              timeMicros - lastConvertedTime < maxElisionMicros;
+        hasFrame = true;
+        lastFrameHash = frameHash;
+        if (!isRepeat) {
+            return Decision::Convert;
+        }
+
+        if (timeMicros - lastDeliveredTime < repeatedFrameIntervalMicros) {
+            ++elidedFrames;
+            return Decision::Elide;
+        }
+
+        // An identical input gives x264 nothing to code, so this is mostly skipped macroblocks
+        ++repeatedFrames;
+        lastDeliveredTime = timeMicros;
+        return Decision::Repeat;
+    }
+
+    void RepeatedFrameFilter::onConverted(int64_t timeMicros) {
+        lastDeliveredTime = timeMicros;
+        lastConvertedTime = timeMicros;
+    }
+
+} // namespace caff
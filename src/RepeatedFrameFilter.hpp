@@ -0,0 +1,41 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace caff {
+
+    // Decides which captured frames are the same as the one before, from hashes of their rows (see hashRows). Repeats
+    // are mostly dropped, but some are delivered again as the previous buffer so static content keeps flowing at a low
+    // framerate, and frames are converted for real at least once a second so a hash collision can't freeze the picture.
+    class RepeatedFrameFilter {
+    public:
+        enum class Decision {
+            Convert,  // a new picture, to be converted and then recorded with onConverted
+            Elide,    // a repeat to drop
+            Repeat,   // a repeat to deliver again as the previous buffer
+        };
+
+        // Decides what to do with a frame captured at |timeMicros| whose rows hash to |frameHash|. |canRepeat| is
+        // whether the previous buffer is still around and the right size to send again
+        Decision onFrame(uint64_t frameHash, int64_t timeMicros, bool canRepeat);
+
+        // Records that a frame captured at |timeMicros| was converted and delivered
+        void onConverted(int64_t timeMicros);
+
+        uint64_t getElidedFrames() const { return elidedFrames; }
+        uint64_t getRepeatedFrames() const { return repeatedFrames; }
+
+    private:
+        bool hasFrame = false;
+        uint64_t lastFrameHash = 0;
+
+        int64_t lastDeliveredTime = 0;
+        int64_t lastConvertedTime = 0;
+        std::atomic<uint64_t> elidedFrames{ 0 };
+        std::atomic<uint64_t> repeatedFrames{ 0 };
+    };
+
+} // namespace caff
@@ -0,0 +1,55 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "ScreenContentDetector.hpp"
+
+#include <utility>
+
+namespace caff {
+
+    using namespace std::chrono_literals;
+
+    SmoothedThreshold::Settings constexpr changeSettings{
+        // Long enough to ride out a burst of scrolling, short enough that a game leaving its menu shows up within a
+        // second
+        1s,
+        // Quiet: typing, a moving cursor or a blinking caret change a handful of rows
+        0.15,
+        5s,
+        // Busy: most of the picture moving, as in a game or camera video
+        0.4,
+    };
+
+    double changedRowFraction(std::vector<uint64_t> const & previousRows, std::vector<uint64_t> const & rows) {
+        if (rows.empty() || previousRows.size() != rows.size()) {
+            return 1.0;
+        }
+        size_t changed = 0;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (rows[i] != previousRows[i]) {
+                ++changed;
+            }
+        }
+        return static_cast<double>(changed) / rows.size();
+    }
+
+    ScreenContentDetector::ScreenContentDetector() : changedFraction(changeSettings) {}
+
+    void ScreenContentDetector::onFrame(std::chrono::microseconds now, std::vector<uint64_t> & rowHashes) {
+        onFrame(now, changedRowFraction(previousRowHashes, rowHashes));
+        std::swap(previousRowHashes, rowHashes);
+    }
+
+    void ScreenContentDetector::onFrame(std::chrono::microseconds now, double changedFractionNow) {
+        switch (changedFraction.update(now, changedFractionNow)) {
+        case SmoothedThreshold::Level::High:
+            isScreen = false;
+            break;
+        case SmoothedThreshold::Level::SustainedLow:
+            isScreen = true;
+            break;
+        case SmoothedThreshold::Level::Between:
+            break;
+        }
+    }
+
+} // namespace caff
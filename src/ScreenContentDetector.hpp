@@ -0,0 +1,44 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "SmoothedThreshold.hpp"
+
+namespace caff {
+
+    // Share of rows that differ between two frames' row hashes (see hashRows). Frames of different sizes count as fully
+    // changed
+    double changedRowFraction(std::vector<uint64_t> const & previousRows, std::vector<uint64_t> const & rows);
+
+    // Decides whether captured video looks like screen content, from how much of each frame changes. Desktops, code
+    // editors and strategy maps change a few rows at a time around the cursor or a unit, while most games and camera
+    // video change nearly every row on every frame. Screen content is only reported after a long quiet stretch, and
+    // given up soon after the picture starts moving, so brief pauses in a game don't flip the encoder back and forth.
+    class ScreenContentDetector {
+    public:
+        ScreenContentDetector();
+
+        // Records a captured frame at time |now| with one hash per row (see hashRows). It is compared with the frame
+        // recorded just before, so the thresholds measure change between consecutive frames at any resolution.
+        // |rowHashes| is swapped with the previous frame's, for reuse as the next frame's buffer
+        void onFrame(std::chrono::microseconds now, std::vector<uint64_t> & rowHashes);
+
+        // Records a captured frame at time |now| in which |changedFraction| of the rows changed since the frame before
+        void onFrame(std::chrono::microseconds now, double changedFraction);
+
+        bool isScreenContent() const { return isScreen; }
+
+        // Smoothed share of rows changing per frame
+        double getChangedFraction() const { return changedFraction.getValue(); }
+
+    private:
+        SmoothedThreshold changedFraction;
+        bool isScreen = false;
+        std::vector<uint64_t> previousRowHashes;
+    };
+
+} // namespace caff
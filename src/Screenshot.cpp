@@ -0,0 +1,151 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "Screenshot.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+
+#include "api/video/i420_buffer.h"
+#include "libyuv.h"
+
+// Uncomment this to save png & jpg copies of the screenshot to the working directory
+//#define SAVE_SCREENSHOT
+
+#ifndef SAVE_SCREENSHOT
+#    define STBI_WRITE_NO_STDIO
+#endif
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+namespace caff {
+
+    // The lobby shows screenshots as small cards, so anything beyond this is wasted encoding time and upload size
+    int32_t constexpr screenshotMaxWidth = 640;
+    int32_t constexpr screenshotMaxHeight = 360;
+
+    // Noticeably faster to encode than 95, with no visible difference at thumbnail size
+    int constexpr screenshotQuality = 80;
+
+    static void writeScreenshot(void * context, void * data, int size) {
+        auto screenshot = reinterpret_cast<ScreenshotData *>(context);
+        auto pixels = reinterpret_cast<uint8_t *>(data);
+        screenshot->insert(screenshot->end(), pixels, pixels + size);
+    }
+
+    // Shrinks the frame to fit within the thumbnail size, keeping its aspect ratio
+    static rtc::scoped_refptr<webrtc::I420BufferInterface> downscale(webrtc::I420BufferInterface const & buffer) {
+        auto const scale = std::min(
+                { 1.0,
+                  static_cast<double>(screenshotMaxWidth) / buffer.width(),
+                  static_cast<double>(screenshotMaxHeight) / buffer.height() });
+        auto const width = std::max(static_cast<int>(buffer.width() * scale) & ~1, 2);
+        auto const height = std::max(static_cast<int>(buffer.height() * scale) & ~1, 2);
+
+        auto scaled = webrtc::I420Buffer::Create(width, height);
+        scaled->ScaleFrom(buffer);
+        return scaled;
+    }
+
+    ScreenshotData createScreenshot(rtc::scoped_refptr<webrtc::I420BufferInterface> buffer) {
+        if (!buffer) {
+            throw std::runtime_error("No buffer for screenshot");
+        }
+        if (buffer->width() > screenshotMaxWidth || buffer->height() > screenshotMaxHeight) {
+            buffer = downscale(*buffer);
+        }
+
+        auto const width = buffer->width();
+        auto const height = buffer->height();
+        auto constexpr channels = 3;
+        auto const destStride = width * channels;
+
+        std::vector<uint8_t> raw;
+        raw.resize(destStride * height);
+
+        auto ret = libyuv::I420ToRAW(
+                buffer->DataY(),
+                buffer->StrideY(),
+                buffer->DataU(),
+                buffer->StrideU(),
+                buffer->DataV(),
+                buffer->StrideV(),
+                &raw[0],
+                destStride,
+                width,
+                height);
+        if (ret != 0) {
+            throw std::runtime_error("Failed to convert I420 to RAW");
+        }
+#ifdef SAVE_SCREENSHOT
+        ret = stbi_write_png("screenshot.png", width, height, channels, &raw[0], destStride);
+        ret = stbi_write_jpg("screenshot.jpg", width, height, channels, &raw[0], screenshotQuality);
+#endif
+        ScreenshotData screenshot;
+        ret = stbi_write_jpg_to_func(writeScreenshot, &screenshot, width, height, channels, &raw[0], screenshotQuality);
+        if (ret == 0) {
+            throw std::runtime_error("Failed to convert RAW to JPEG");
+        }
+        return screenshot;
+    }
+
+    // Each cell's average comes from a square of this many samples per side
+    int32_t constexpr lumaSamplesPerSide = 4;
+
+    LumaSignature computeLumaSignature(webrtc::I420BufferInterface const & buffer) {
+        LumaSignature signature;
+        auto const cellWidth = buffer.width() / lumaSignatureColumns;
+        auto const cellHeight = buffer.height() / lumaSignatureRows;
+
+        for (int32_t row = 0; row < lumaSignatureRows; ++row) {
+            for (int32_t column = 0; column < lumaSignatureColumns; ++column) {
+                int sum = 0;
+                for (int32_t sampleY = 0; sampleY < lumaSamplesPerSide; ++sampleY) {
+                    // Samples sit in the middle of evenly spaced sub-cells, so they never touch the frame's edge
+                    auto y = row * cellHeight + (2 * sampleY + 1) * cellHeight / (2 * lumaSamplesPerSide);
+                    auto const * line = buffer.DataY() + y * buffer.StrideY();
+                    for (int32_t sampleX = 0; sampleX < lumaSamplesPerSide; ++sampleX) {
+                        auto x = column * cellWidth + (2 * sampleX + 1) * cellWidth / (2 * lumaSamplesPerSide);
+                        sum += line[x];
+                    }
+                }
+                signature[row * lumaSignatureColumns + column] =
+                        static_cast<uint8_t>(sum / (lumaSamplesPerSide * lumaSamplesPerSide));
+            }
+        }
+        return signature;
+    }
+
+    double lumaSignatureDistance(LumaSignature const & left, LumaSignature const & right) {
+        int total = 0;
+        for (size_t i = 0; i < left.size(); ++i) {
+            total += std::abs(left[i] - right[i]);
+        }
+        return static_cast<double>(total) / left.size();
+    }
+
+    int lumaSignatureBrightness(LumaSignature const & signature) {
+        return std::accumulate(signature.begin(), signature.end(), 0) / static_cast<int>(signature.size());
+    }
+
+    // Minimum time between screenshot uploads after the first
+    auto constexpr screenshotRefreshInterval = std::chrono::seconds(60);
+
+    // Mean per-cell luma difference (0-255) that counts as a new scene
+    int constexpr sceneChangeThreshold = 12;
+
+    // Frames darker than this (0-255) are most likely fades or loading screens
+    int constexpr minScreenshotBrightness = 16;
+
+    bool isScreenshotRefreshWanted(
+            LumaSignature const & signature,
+            LumaSignature const & lastSignature,
+            std::chrono::steady_clock::duration sinceLastScreenshot) {
+        return sinceLastScreenshot >= screenshotRefreshInterval &&
+               lumaSignatureBrightness(signature) >= minScreenshotBrightness &&
+               lumaSignatureDistance(signature, lastSignature) >= sceneChangeThreshold;
+    }
+
+} // namespace caff
@@ -0,0 +1,43 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "RestApi.hpp"
+
+#include "api/video/video_frame_buffer.h"
+#include "rtc_base/scoped_ref_ptr.h"
+
+namespace caff {
+
+    // Encodes a frame as the JPEG thumbnail shown in the Caffeine.tv lobby. Frames larger than the thumbnail are
+    // downscaled before encoding. Throws std::runtime_error on failure.
+    ScreenshotData createScreenshot(rtc::scoped_refptr<webrtc::I420BufferInterface> buffer);
+
+    int32_t constexpr lumaSignatureColumns = 16;
+    int32_t constexpr lumaSignatureRows = 9;
+
+    // Average brightness of each cell in a coarse grid over the frame. Comparing two of these is a cheap way to tell
+    // whether frames show the same scene.
+    using LumaSignature = std::array<uint8_t, lumaSignatureColumns * lumaSignatureRows>;
+
+    // Samples a few luma values per cell rather than reading the whole plane
+    LumaSignature computeLumaSignature(webrtc::I420BufferInterface const & buffer);
+
+    // Mean absolute difference between the cells of two signatures, from 0 (identical) to 255
+    double lumaSignatureDistance(LumaSignature const & left, LumaSignature const & right);
+
+    // Mean of all cells, from 0 (black) to 255
+    int lumaSignatureBrightness(LumaSignature const & signature);
+
+    // Whether a frame with |signature| should replace the lobby screenshot taken |sinceLastScreenshot| ago from a frame
+    // with |lastSignature|. Only bright enough frames of a new scene qualify, and not too soon after the last upload.
+    bool isScreenshotRefreshWanted(
+            LumaSignature const & signature,
+            LumaSignature const & lastSignature,
+            std::chrono::steady_clock::duration sinceLastScreenshot);
+
+} // namespace caff
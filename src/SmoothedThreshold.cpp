@@ -0,0 +1,44 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "SmoothedThreshold.hpp"
+
+#include <algorithm>
+
+namespace caff {
+
+    using namespace std::chrono_literals;
+
+    SmoothedThreshold::SmoothedThreshold(Settings const & settings) : settings(settings) {}
+
+    SmoothedThreshold::Level SmoothedThreshold::update(std::chrono::microseconds now, double sample) {
+        if (!hasSample || settings.smoothingTime <= 0us) {
+            hasSample = true;
+            value = sample;
+        } else {
+            auto elapsed = std::min(std::max(now - lastSampleTime, 0us), settings.smoothingTime);
+            value += (sample - value) * elapsed.count() / settings.smoothingTime.count();
+        }
+        lastSampleTime = now;
+
+        if (value > settings.highThreshold) {
+            isLow = false;
+            return Level::High;
+        }
+        if (value >= settings.lowThreshold) {
+            isLow = false;
+            return Level::Between;
+        }
+        if (!isLow) {
+            isLow = true;
+            lowSince = now;
+        }
+        return now - lowSince >= settings.lowHoldTime ? Level::SustainedLow : Level::Between;
+    }
+
+    void SmoothedThreshold::reset() {
+        hasSample = false;
+        value = 0.0;
+        isLow = false;
+    }
+
+} // namespace caff
@@ -0,0 +1,49 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+
+namespace caff {
+
+    // Smooths a noisy measurement over time and compares it with two thresholds, for decisions that should react
+    // quickly one way and slowly the other. Passing the high threshold counts at once, while the value has to stay
+    // under the low threshold for a hold time before that counts. Between the two thresholds neither does, which keeps a
+    // value hovering near one of them from flipping the decision back and forth.
+    class SmoothedThreshold {
+    public:
+        struct Settings {
+            std::chrono::microseconds smoothingTime;  // time constant of the exponential smoothing
+            double lowThreshold;
+            std::chrono::microseconds lowHoldTime;
+            double highThreshold;
+        };
+
+        enum class Level {
+            Between,        // neither of the below
+            High,           // above the high threshold
+            SustainedLow,   // below the low threshold for at least the hold time
+        };
+
+        explicit SmoothedThreshold(Settings const & settings);
+
+        // Adds |sample|, measured at time |now|, and classifies the smoothed value. Each sample is weighted by the time
+        // since the last one, so the smoothing doesn't depend on how often samples arrive. The first sample after a
+        // reset is taken as is
+        Level update(std::chrono::microseconds now, double sample);
+
+        // Forgets every sample
+        void reset();
+
+        double getValue() const { return value; }
+
+    private:
+        Settings settings;
+        double value = 0.0;
+        bool hasSample = false;
+        std::chrono::microseconds lastSampleTime{};
+        bool isLow = false;
+        std::chrono::microseconds lowSince{};
+    };
+
+} // namespace caff
@@ -2,70 +2,37 @@
 
 #include "VideoCapturer.hpp"
 
+#include <algorithm>
+#include <thread>
+
 #include "ErrorLogging.hpp"
+#include "PassthroughEncoder.hpp"
 #include "Policy.hpp"
+#include "VideoConversion.hpp"
 
-#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "common_video/include/video_frame_buffer.h"
 #include "libyuv.h"
+#include "rtc_base/callback.h"
 
 namespace caff {
-    using namespace std::chrono_literals;
-
-    // Copied from old version of libwebrtc
-    static libyuv::RotationMode convertRotationMode(webrtc::VideoRotation rotation) {
-        switch (rotation) {
-        case webrtc::kVideoRotation_0:
-            return libyuv::kRotate0;
-        case webrtc::kVideoRotation_90:
-            return libyuv::kRotate90;
-        case webrtc::kVideoRotation_180:
-            return libyuv::kRotate180;
-        case webrtc::kVideoRotation_270:
-            return libyuv::kRotate270;
-        }
-    }
-
-    // Copied from old version of libwebrtc
-    static int convertToI420(
-            webrtc::VideoType srcVideoType,
-            uint8_t const * srcFrame,
-            int cropX,
-            int cropY,
-            int srcWidth,
-            int srcHeight,
-            size_t sampleSize,
-            webrtc::VideoRotation rotation,
-            webrtc::I420Buffer * dstBuffer) {
-        int dstWidth = dstBuffer->width();
-        int dstHeight = dstBuffer->height();
-        // LibYuv expects pre-rotation values for dst.
-        // Stride values should correspond to the destination values.
-        if (rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270) {
-            std::swap(dstWidth, dstHeight);
-        }
-        return libyuv::ConvertToI420(
-                srcFrame,
-                sampleSize,
-                dstBuffer->MutableDataY(),
-                dstBuffer->StrideY(),
-                dstBuffer->MutableDataU(),
-                dstBuffer->StrideU(),
-                dstBuffer->MutableDataV(),
-                dstBuffer->StrideV(),
-                cropX,
-                cropY,
-                srcWidth,
-                srcHeight,
-                dstWidth,
-                dstHeight,
-                convertRotationMode(rotation),
-                webrtc::ConvertVideoType(srcVideoType));
-    }
+
+    // Enough for an unscaled and a scaled buffer in conversion plus the frames queued up in WebRTC's encode pipeline
+    size_t constexpr maxPooledBuffers = 10;
+
+    // Conversion and scaling are memory bound, so more threads than this stop paying off
+    size_t constexpr maxConversionThreads = 4;
+
+    // Framerate used while the picture is calm, when the broadcast's limit is higher
+    int32_t constexpr lowMotionFramerate = 30;
 
      VideoCapturer::VideoCapturer()
-        : interFrameLimit(1'000'000us / (maxFps + 2))
+        : frameCadence(maxFps)
+        , framerateLimit(maxFps)
+        , framerate(maxFps)
         , frameWidthMax(maxFrameWidth)
         , frameHeightMax(maxFrameHeight)
+        , bufferPool(maxPooledBuffers)
+        , encodedCadence(maxFps)
      {}
 
     cricket::CaptureState VideoCapturer::Start(cricket::VideoFormat const & format) {
@@ -74,32 +41,36 @@ namespace caff {
         return cricket::CS_STARTING;
     }
 
-    rtc::scoped_refptr<webrtc::I420Buffer> VideoCapturer::sendVideo(
-            webrtc::VideoType format,
-            uint8_t const * frameData,
-            size_t frameByteCount,
-            int32_t width,
-            int32_t height,
-            std::chrono::microseconds timestamp) {
-        // TODO: see if we can easily configure max frame rate in webrtc
-        auto span = timestamp - lastTimestamp;
-        if (span < interFrameLimit) {
-            LOG_DEBUG(
-                    "Dropping Frame: timestamp: %lld, lastTimestamp: %lld, span: %lld",
-                    timestamp.count(),
-                    lastTimestamp.count(),
-                    span.count());
+    WorkerPool * VideoCapturer::workerPoolFor(int32_t width, int32_t height) {
+        if (parallelPixelThreshold <= 0 || int64_t{ width } * height < parallelPixelThreshold) {
             return nullptr;
         }
-        lastTimestamp = timestamp;
 
+        // Created on first use so broadcasts of small frames never start the threads
+        if (!workerPool) {
+            size_t concurrency = std::min<size_t>(std::thread::hardware_concurrency(), maxConversionThreads);
+            if (concurrency < 2) {
+                return nullptr;
+            }
+            LOG_DEBUG("Starting %zu video conversion threads", concurrency - 1);
+            workerPool = std::make_unique<WorkerPool>(concurrency - 1);
+        }
+        return workerPool.get();
+    }
+
+    bool VideoCapturer::adaptFrameSize(
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp,
+            int32_t * adaptedWidthOut,
+            int32_t * adaptedHeightOut,
+            int64_t * translatedCameraTime) {
         int32_t adaptedWidth = minFrameDimension;
         int32_t adaptedHeight = minFrameDimension;
         int32_t cropWidth;
         int32_t cropHeight;
         int32_t cropX;
         int32_t cropY;
-        int64_t translatedCameraTime;
 
         if (!AdaptFrame(
                     width,
@@ -112,9 +83,9 @@ namespace caff {
                     &cropHeight,
                     &cropX,
                     &cropY,
-                    &translatedCameraTime)) {
+                    translatedCameraTime)) {
             LOG_DEBUG("Adapter dropped the frame.");
-            return nullptr;
+            return false;
         }
 
         // we will cap the minimum resolution to be 360 on the smaller of either width
@@ -141,44 +112,358 @@ namespace caff {
 
         // if the given input is a weird resolution that is an odd number, the adapted
         // may be odd too, and we need to ensure that it is even.
-        adaptedWidth = (adaptedWidth + 1) & ~1;   // round up to even
-        adaptedHeight = (adaptedHeight + 1) & ~1; // round up to even
+        *adaptedWidthOut = (adaptedWidth + 1) & ~1;   // round up to even
+        *adaptedHeightOut = (adaptedHeight + 1) & ~1; // round up to even
+        return true;
+    }
+
+    rtc::scoped_refptr<webrtc::I420BufferInterface> VideoCapturer::deliverFrame(
+            rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+            int32_t width,
+            int32_t height,
+            int32_t adaptedWidth,
+            int32_t adaptedHeight,
+            int64_t translatedCameraTime) {
+        measureMotion(buffer.get(), translatedCameraTime);
+
+        rtc::scoped_refptr<webrtc::I420BufferInterface> scaledBuffer = buffer;
+        if (adaptedWidth != buffer->width() || adaptedHeight != buffer->height()) {
+            auto newBuffer = bufferPool.createBuffer(adaptedWidth, adaptedHeight);
+            if (!newBuffer) {
+                LOG_ERROR("Failed to create scaled buffer");
+                return nullptr;
+            }
+            auto scaleResult =
+                    scaleI420(*buffer, newBuffer.get(), workerPoolFor(buffer->width(), buffer->height()));
+            if (scaleResult != 0) {
+                LOG_ERROR("Failed to scale i420 frame: %d", scaleResult);
+                return nullptr;
+            }
+            scaledBuffer = newBuffer;
+        }
+
+        if (isRawVideoEncoded) {
+            webrtc::VideoFrame frame(scaledBuffer, webrtc::kVideoRotation_0, translatedCameraTime);
+            OnFrame(frame, width, height);
+        }
 
-        rtc::scoped_refptr<webrtc::I420Buffer> unscaledBuffer = webrtc::I420Buffer::Create(width, height);
+        return scaledBuffer;
+    }
+
+    static uint64_t frameHashSeed(webrtc::VideoType format, int32_t width, int32_t height) {
+        return (static_cast<uint64_t>(format) << 48) ^ (static_cast<uint64_t>(width) << 24) ^
+               static_cast<uint64_t>(height);
+    }
+
+    bool VideoCapturer::skipRepeatedFrame(
+            uint64_t frameHash,
+            int32_t width,
+            int32_t height,
+            int32_t adaptedWidth,
+            int32_t adaptedHeight,
+            int64_t translatedCameraTime) {
+        bool const canRepeat = lastDeliveredBuffer && lastDeliveredBuffer->width() == adaptedWidth &&
+                               lastDeliveredBuffer->height() == adaptedHeight;
+        auto decision = repeatFilter.onFrame(frameHash, translatedCameraTime, canRepeat);
+        if (decision == RepeatedFrameFilter::Decision::Convert) {
+            return false;
+        }
+        measureMotion(nullptr, translatedCameraTime);
+
+        if (decision == RepeatedFrameFilter::Decision::Repeat && isRawVideoEncoded) {
+            webrtc::VideoFrame frame(lastDeliveredBuffer, webrtc::kVideoRotation_0, translatedCameraTime);
+            OnFrame(frame, width, height);
+        }
+        return true;
+    }
+
+    rtc::scoped_refptr<webrtc::I420BufferInterface> VideoCapturer::rememberFrame(
+            rtc::scoped_refptr<webrtc::I420BufferInterface> buffer, int64_t translatedCameraTime) {
+        lastDeliveredBuffer = buffer;
+        repeatFilter.onConverted(translatedCameraTime);
+        return buffer;
+    }
+
+    rtc::scoped_refptr<webrtc::I420BufferInterface> VideoCapturer::sendVideo(
+            webrtc::VideoType format,
+            uint8_t const * frameData,
+            size_t frameByteCount,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        if (auto rowBytes = packedRowBytes(format, width)) {
+            return sendVideoStrided(format, frameData, rowBytes, width, height, timestamp);
+        }
+
+        if (!frameCadence.acceptFrame(timestamp, &timestamp)) {
+            return nullptr;
+        }
+
+        int32_t adaptedWidth;
+        int32_t adaptedHeight;
+        int64_t translatedCameraTime;
+        if (!adaptFrameSize(width, height, timestamp, &adaptedWidth, &adaptedHeight, &translatedCameraTime)) {
+            return nullptr;
+        }
+
+        // Rows here are just equal slices of the buffer, since it may hold several planes or compressed data
+        auto frameHash = hashRows(
+                frameData,
+                static_cast<int>(frameByteCount / height),
+                static_cast<int>(frameByteCount / height),
+                height,
+                frameHashSeed(format, width, height) ^ frameByteCount,
+                &rowHashes);
+        measureChange(translatedCameraTime);
+        if (skipRepeatedFrame(frameHash, width, height, adaptedWidth, adaptedHeight, translatedCameraTime)) {
+            return nullptr;
+        }
+
+        rtc::scoped_refptr<webrtc::I420Buffer> unscaledBuffer = bufferPool.createBuffer(width, height);
         if (!unscaledBuffer) {
             LOG_ERROR("Failed to create unscaled buffer");
             return nullptr;
         }
 
         auto convertResult = convertToI420(
-                format, frameData, 0, 0, width, height, frameByteCount, webrtc::kVideoRotation_0, unscaledBuffer.get());
+                format,
+                frameData,
+                0,
+                0,
+                width,
+                height,
+                frameByteCount,
+                webrtc::kVideoRotation_0,
+                unscaledBuffer.get(),
+                workerPoolFor(width, height));
         if (convertResult != 0) {
             LOG_ERROR("Failed to convert i420 frame: %d", convertResult);
             return nullptr;
         }
 
-        rtc::scoped_refptr<webrtc::I420Buffer> scaledBuffer = unscaledBuffer;
-        if (adaptedHeight != height) {
-            scaledBuffer = webrtc::I420Buffer::Create(adaptedWidth, adaptedHeight);
+        return rememberFrame(
+                deliverFrame(unscaledBuffer, width, height, adaptedWidth, adaptedHeight, translatedCameraTime),
+                translatedCameraTime);
+    }
+
+    rtc::scoped_refptr<webrtc::I420BufferInterface> VideoCapturer::sendVideoStrided(
+            webrtc::VideoType format,
+            uint8_t const * frameData,
+            int32_t stride,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        if (!frameCadence.acceptFrame(timestamp, &timestamp)) {
+            return nullptr;
+        }
+
+        int32_t adaptedWidth;
+        int32_t adaptedHeight;
+        int64_t translatedCameraTime;
+        if (!adaptFrameSize(width, height, timestamp, &adaptedWidth, &adaptedHeight, &translatedCameraTime)) {
+            return nullptr;
+        }
+
+        auto frameHash = hashRows(
+                frameData,
+                stride,
+                packedRowBytes(format, width),
+                height,
+                frameHashSeed(format, width, height),
+                &rowHashes);
+        measureChange(translatedCameraTime);
+        if (skipRepeatedFrame(frameHash, width, height, adaptedWidth, adaptedHeight, translatedCameraTime)) {
+            return nullptr;
+        }
+
+        // Downscaling packed RGB before conversion avoids writing and re-reading a full-resolution I420 frame
+        bool const isDownscaling = adaptedWidth <= width && adaptedHeight <= height &&
+                                   (adaptedWidth != width || adaptedHeight != height);
+        if (isDownscaling && canScaleBeforeConversion(format)) {
+            auto scaledBuffer = bufferPool.createBuffer(adaptedWidth, adaptedHeight);
             if (!scaledBuffer) {
                 LOG_ERROR("Failed to create scaled buffer");
                 return nullptr;
             }
-            scaledBuffer->ScaleFrom(*unscaledBuffer);
+
+            auto convertResult = scaleAndConvertToI420(
+                    format,
+                    frameData,
+                    stride,
+                    width,
+                    height,
+                    scaleScratch,
+                    scaledBuffer.get(),
+                    workerPoolFor(width, height));
+            if (convertResult != 0) {
+                LOG_ERROR("Failed to scale and convert i420 frame: %d", convertResult);
+                return nullptr;
+            }
+
+            return rememberFrame(
+                    deliverFrame(scaledBuffer, width, height, adaptedWidth, adaptedHeight, translatedCameraTime),
+                    translatedCameraTime);
+        }
+
+        rtc::scoped_refptr<webrtc::I420Buffer> unscaledBuffer = bufferPool.createBuffer(width, height);
+        if (!unscaledBuffer) {
+            LOG_ERROR("Failed to create unscaled buffer");
+            return nullptr;
         }
 
-        webrtc::VideoFrame frame(scaledBuffer, webrtc::kVideoRotation_0, translatedCameraTime);
+        auto convertResult =
+                convertPackedToI420(format, frameData, stride, unscaledBuffer.get(), workerPoolFor(width, height));
+        if (convertResult != 0) {
+            LOG_ERROR("Failed to convert i420 frame: %d", convertResult);
+            return nullptr;
+        }
 
-        OnFrame(frame, width, height);
+        return rememberFrame(
+                deliverFrame(unscaledBuffer, width, height, adaptedWidth, adaptedHeight, translatedCameraTime),
+                translatedCameraTime);
+    }
 
-        return scaledBuffer;
+    rtc::scoped_refptr<webrtc::I420BufferInterface> VideoCapturer::sendVideoPlanes(
+            webrtc::VideoType format,
+            uint8_t const * const planes[3],
+            int32_t const strides[3],
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp,
+            std::shared_ptr<void> planesOwner) {
+        // Dropping out of this function early releases |planesOwner| and hands the planes back to the application
+        if (!frameCadence.acceptFrame(timestamp, &timestamp)) {
+            return nullptr;
+        }
+
+        int32_t adaptedWidth;
+        int32_t adaptedHeight;
+        int64_t translatedCameraTime;
+        if (!adaptFrameSize(width, height, timestamp, &adaptedWidth, &adaptedHeight, &translatedCameraTime)) {
+            return nullptr;
+        }
+
+        rtc::scoped_refptr<webrtc::I420BufferInterface> buffer;
+        bool isWrapped = false;
+        switch (format) {
+        case webrtc::VideoType::kI420:
+        case webrtc::VideoType::kIYUV:
+        case webrtc::VideoType::kYV12:
+            // Wrapped frames are never skipped as repeats, but their luma rows still show how much of the picture
+            // changed
+            hashRows(planes[0], strides[0], width, height, 0, &rowHashes);
+            measureChange(translatedCameraTime);
+
+            // U and V are passed in separately, so all of these are plain I420 as far as WebRTC is concerned
+            buffer = webrtc::WrapI420Buffer(
+                    width,
+                    height,
+                    planes[0],
+                    strides[0],
+                    planes[1],
+                    strides[1],
+                    planes[2],
+                    strides[2],
+                    rtc::Callback0<void>([planesOwner]() mutable { planesOwner.reset(); }));
+            isWrapped = true;
+            break;
+        case webrtc::VideoType::kNV12:
+        case webrtc::VideoType::kNV21: {
+            auto frameHash =
+                    hashRows(planes[0], strides[0], width, height, frameHashSeed(format, width, height), &rowHashes);
+            frameHash = hashRows(planes[1], strides[1], (width + 1) / 2 * 2, (height + 1) / 2, frameHash);
+            measureChange(translatedCameraTime);
+            if (skipRepeatedFrame(frameHash, width, height, adaptedWidth, adaptedHeight, translatedCameraTime)) {
+                return nullptr;
+            }
+
+            // This version of WebRTC has no biplanar buffer type, so the chroma plane has to be split here
+            auto converted = bufferPool.createBuffer(width, height);
+            if (!converted) {
+                LOG_ERROR("Failed to create unscaled buffer");
+                return nullptr;
+            }
+            auto convert = (format == webrtc::VideoType::kNV12) ? libyuv::NV12ToI420 : libyuv::NV21ToI420;
+            auto convertResult = convert(
+                    planes[0],
+                    strides[0],
+                    planes[1],
+                    strides[1],
+                    converted->MutableDataY(),
+                    converted->StrideY(),
+                    converted->MutableDataU(),
+                    converted->StrideU(),
+                    converted->MutableDataV(),
+                    converted->StrideV(),
+                    width,
+                    height);
+            if (convertResult != 0) {
+                LOG_ERROR("Failed to convert biplanar frame: %d", convertResult);
+                return nullptr;
+            }
+            buffer = converted;
+            break;
+        }
+        default:
+            LOG_ERROR("Unsupported planar video format: %d", static_cast<int>(format));
+            return nullptr;
+        }
+
+        auto deliveredBuffer = deliverFrame(buffer, width, height, adaptedWidth, adaptedHeight, translatedCameraTime);
+        if (isWrapped) {
+            // Keeping the application's planes around to repeat them would hold up their release, so wrapped frames
+            // aren't checked for repeats
+            lastDeliveredBuffer = nullptr;
+            return deliveredBuffer;
+        }
+        return rememberFrame(deliveredBuffer, translatedCameraTime);
+    }
+
+    void VideoCapturer::sendEncodedVideo(
+            uint8_t const * data,
+            size_t size,
+            int32_t width,
+            int32_t height,
+            bool isKeyFrame,
+            std::chrono::microseconds timestamp) {
+        // A dropped frame still takes its number unless nothing references it, so PassthroughEncoder sees the gap and
+        // waits for a key frame
+        if (width > frameWidthMax || height > frameHeightMax) {
+            if (width != rejectedEncodedWidth || height != rejectedEncodedHeight) {
+                LOG_ERROR(
+                        "Encoded video at %dx%d is larger than the %dx%d limit",
+                        width,
+                        height,
+                        frameWidthMax,
+                        frameHeightMax);
+                rejectedEncodedWidth = width;
+                rejectedEncodedHeight = height;
+            }
+            ++encodedFrameCount;
+            return;
+        }
+        rejectedEncodedWidth = 0;
+        rejectedEncodedHeight = 0;
+
+        if (!encodedCadence.acceptFrame(timestamp, &timestamp)) {
+            if (!isDisposableAccessUnit(data, size)) {
+                ++encodedFrameCount;
+            }
+            return;
+        }
+
+        auto translatedCameraTime = encodedTimestampAligner.TranslateTimestamp(timestamp.count(), rtc::TimeMicros());
+        rtc::scoped_refptr<EncodedVideoBuffer> buffer(new rtc::RefCountedObject<EncodedVideoBuffer>(
+                data, size, width, height, isKeyFrame, encodedFrameCount++));
+        webrtc::VideoFrame frame(buffer, webrtc::kVideoRotation_0, translatedCameraTime);
+        OnFrame(frame, width, height);
     }
 
     void VideoCapturer::Stop() {}
 
     bool VideoCapturer::IsRunning() { return true; }
 
-    bool VideoCapturer::IsScreencast() const { return false; }
+    bool VideoCapturer::IsScreencast() const { return isScreencast; }
 
     bool VideoCapturer::GetPreferredFourccs(std::vector<uint32_t> * fourccs) {
         // ignore preferred formats
@@ -190,10 +475,56 @@ namespace caff {
     }
 
     void VideoCapturer::SetFramerateLimit(int32_t framerate) {
-        // Caffeine platform only supports either 30 or 60fps. Frames that come in too quickly will be dropped.
-        // This value is fudged a bit (+2 frames) to allow for minor variance between frames.
-        int32_t dropFps = framerate + 2;
-        interFrameLimit = 1'000'000us / dropFps;
+        framerateLimit = framerate;
+        // Content and motion aren't measured on encoded frames, so only the limit applies to them
+        encodedCadence.setFramerate(framerate);
+        updateFramerate();
+    }
+
+    void VideoCapturer::setContentFramerateLimit(int32_t framerate) {
+        contentFramerateLimit = framerate;
+        updateFramerate();
+    }
+
+    void VideoCapturer::updateFramerate() {
+        auto newFramerate =
+                contentFramerateLimit > 0 ? std::min(framerateLimit, contentFramerateLimit) : framerateLimit;
+        if (isMotionAdapted && !motionController.isHighMotion()) {
+            newFramerate = std::min(newFramerate, lowMotionFramerate);
+        }
+        if (newFramerate == framerate) {
+            return;
+        }
+        // Setting the cadence's framerate restarts its output clock, so it is only done when the framerate changes
+        LOG_DEBUG("Capturing at %d fps", newFramerate);
+        framerate = newFramerate;
+        frameCadence.setFramerate(newFramerate);
+    }
+
+    void VideoCapturer::measureMotion(webrtc::I420BufferInterface const * buffer, int64_t translatedCameraTime) {
+        if (!isMotionAdapted) {
+            return;
+        }
+
+        double distance = 0.0;
+        if (buffer) {
+            auto signature = computeLumaSignature(*buffer);
+            if (hasLumaSignature) {
+                distance = lumaSignatureDistance(signature, lastLumaSignature);
+            }
+            lastLumaSignature = signature;
+            hasLumaSignature = true;
+        }
+
+        bool const wasHighMotion = motionController.isHighMotion();
+        motionController.onFrame(std::chrono::microseconds(translatedCameraTime), distance);
+        if (motionController.isHighMotion() != wasHighMotion) {
+            LOG_DEBUG(
+                    "Video motion is %s (%.0f per second)",
+                    motionController.isHighMotion() ? "high" : "low",
+                    motionController.getMotion());
+            updateFramerate();
+        }
     }
 
     void VideoCapturer::SetFrameSizeLimit(int32_t width, int32_t height) {
@@ -204,4 +535,33 @@ namespace caff {
     void VideoCapturer::EnableFrameAdaption(bool adaptFrames) {
         set_enable_video_adapter(adaptFrames);
     }
+
+    void VideoCapturer::setRawVideoEncoded(bool isEncoded) { isRawVideoEncoded = isEncoded; }
+
+    void VideoCapturer::setScreencast(bool isScreencast) { this->isScreencast = isScreencast; }
+
+    bool VideoCapturer::isScreenContentDetected() const { return screenContentDetector.isScreenContent(); }
+
+    void VideoCapturer::measureChange(int64_t translatedCameraTime) {
+        screenContentDetector.onFrame(std::chrono::microseconds(translatedCameraTime), rowHashes);
+    }
+
+    void VideoCapturer::setMotionAdaptation(bool isEnabled) {
+        isMotionAdapted = isEnabled;
+        updateFramerate();
+    }
+
+    void VideoCapturer::setParallelPixelThreshold(int64_t pixels) { parallelPixelThreshold = pixels; }
+
+    I420BufferPool::Stats VideoCapturer::getBufferPoolStats() const { return bufferPool.getStats(); }
+
+    FrameCadence::Stats VideoCapturer::getCadenceStats() const {
+        return isRawVideoEncoded ? frameCadence.getStats() : encodedCadence.getStats();
+    }
+
+    int32_t VideoCapturer::getFramerate() const { return framerate; }
+
+    VideoCapturer::RepeatStats VideoCapturer::getRepeatStats() const {
+        return { repeatFilter.getElidedFrames(), repeatFilter.getRepeatedFrames() };
+    }
 } // namespace caff
@@ -2,12 +2,24 @@
 
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <memory>
+#include <vector>
+
+#include "FrameCadence.hpp"
+#include "I420BufferPool.hpp"
+#include "MotionFramerateController.hpp"
+#include "RepeatedFrameFilter.hpp"
+#include "ScreenContentDetector.hpp"
+#include "Screenshot.hpp"
+#include "WorkerPool.hpp"
 
 #include "api/video/i420_buffer.h"
 #include "common_types.h"
 #include "media/base/videocapturer.h"
 #include "rtc_base/refcountedobject.h"
+#include "rtc_base/timestampaligner.h"
 
 namespace caff {
 
@@ -18,7 +30,7 @@ namespace caff {
         VideoCapturer & operator=(VideoCapturer const &) = delete;
         virtual ~VideoCapturer() {}
 
-        rtc::scoped_refptr<webrtc::I420Buffer> sendVideo(
+        rtc::scoped_refptr<webrtc::I420BufferInterface> sendVideo(
                 webrtc::VideoType format,
                 uint8_t const * frame,
                 size_t frameBytes,
@@ -26,6 +38,38 @@ namespace caff {
                 int32_t height,
                 std::chrono::microseconds timestamp);
 
+        // For single-plane formats whose rows are |stride| bytes apart
+        rtc::scoped_refptr<webrtc::I420BufferInterface> sendVideoStrided(
+                webrtc::VideoType format,
+                uint8_t const * frame,
+                int32_t stride,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+
+        // Planes are given in Y, U, V order (Y, UV for biplanar formats). I420-family planes are wrapped without
+        // copying, and |planesOwner| is released once nothing references them anymore.
+        rtc::scoped_refptr<webrtc::I420BufferInterface> sendVideoPlanes(
+                webrtc::VideoType format,
+                uint8_t const * const planes[3],
+                int32_t const strides[3],
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp,
+                std::shared_ptr<void> planesOwner);
+
+        // Passes an access unit the application encoded itself to PassthroughEncoder. These frames can't be scaled, so
+        // frames larger than the frame size limit are rejected. Frames above the framerate limit are dropped; unless
+        // nothing references them, the encoder then waits for a key frame, since the frames that follow would be
+        // corrupt
+        void sendEncodedVideo(
+                uint8_t const * data,
+                size_t size,
+                int32_t width,
+                int32_t height,
+                bool isKeyFrame,
+                std::chrono::microseconds timestamp);
+
         virtual cricket::CaptureState Start(cricket::VideoFormat const & format) override;
         virtual void Stop() override;
         virtual bool IsRunning() override;
@@ -33,14 +77,102 @@ namespace caff {
         virtual bool GetPreferredFourccs(std::vector<uint32_t> * fourccs) override;
 
         void SetFramerateLimit(int32_t framerate);
+        // Lowers the framerate below the limit for the content being captured. 0 removes the cap. Like sending video,
+        // this must be called on the capture thread
+        void setContentFramerateLimit(int32_t framerate);
         void SetFrameSizeLimit(int32_t width, int32_t height);
         void EnableFrameAdaption(bool adaptFrames);
 
+        // When false, raw frames are still converted and returned, e.g. for screenshots, but not passed to the encoder
+        void setRawVideoEncoded(bool isEncoded);
+
+        // What IsScreencast reports to WebRTC's video source
+        void setScreencast(bool isScreencast);
+        // Whether the frames captured over the last few seconds look like screen content. Capture thread only
+        bool isScreenContentDetected() const;
+
+        // When false, motion is not measured and calm video keeps the full framerate. On by default; capture thread only
+        void setMotionAdaptation(bool isEnabled);
+
+        // Frames with at least this many pixels are converted and scaled on several threads. 0 disables threading.
+        void setParallelPixelThreshold(int64_t pixels);
+
+        I420BufferPool::Stats getBufferPoolStats() const;
+        FrameCadence::Stats getCadenceStats() const;
+
+        // Framerate frames are currently captured at, after the limit, the content cap and the motion choice
+        int32_t getFramerate() const;
+
+        // Frames found identical to the previous one, which skipped conversion. Elided frames were dropped, repeated
+        // frames were delivered again as the previous buffer to keep static content flowing at a low framerate.
+        struct RepeatStats {
+            uint64_t elidedFrames;
+            uint64_t repeatedFrames;
+        };
+        RepeatStats getRepeatStats() const;
+
     private:
-        std::chrono::microseconds lastTimestamp{ std::chrono::seconds::min() };
-        std::chrono::microseconds interFrameLimit;
+        void updateFramerate();
+        // Feeds |rowHashes| to screen content detection
+        void measureChange(int64_t translatedCameraTime);
+        // Feeds the motion since the last measured frame to |motionController|. |buffer| is null for a repeated frame
+        void measureMotion(webrtc::I420BufferInterface const * buffer, int64_t translatedCameraTime);
+        WorkerPool * workerPoolFor(int32_t width, int32_t height);
+        bool adaptFrameSize(
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp,
+                int32_t * adaptedWidth,
+                int32_t * adaptedHeight,
+                int64_t * translatedCameraTime);
+        bool skipRepeatedFrame(
+                uint64_t frameHash,
+                int32_t width,
+                int32_t height,
+                int32_t adaptedWidth,
+                int32_t adaptedHeight,
+                int64_t translatedCameraTime);
+        rtc::scoped_refptr<webrtc::I420BufferInterface> rememberFrame(
+                rtc::scoped_refptr<webrtc::I420BufferInterface> buffer, int64_t translatedCameraTime);
+        rtc::scoped_refptr<webrtc::I420BufferInterface> deliverFrame(
+                rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+                int32_t width,
+                int32_t height,
+                int32_t adaptedWidth,
+                int32_t adaptedHeight,
+                int64_t translatedCameraTime);
+
+        FrameCadence frameCadence;
+        int32_t framerateLimit;
+        int32_t contentFramerateLimit = 0;
+        std::atomic<int32_t> framerate;
         int32_t frameWidthMax;
         int32_t frameHeightMax;
+        I420BufferPool bufferPool;
+        std::vector<uint8_t> scaleScratch;
+        int64_t parallelPixelThreshold = 0;
+        bool isRawVideoEncoded = true;
+        std::atomic<bool> isScreencast{ false };
+
+        // Encoded frames are held to the framerate limit on a cadence of their own, so raw frames sent for screenshots
+        // don't take their ticks
+        FrameCadence encodedCadence;
+        rtc::TimestampAligner encodedTimestampAligner;
+        uint64_t encodedFrameCount = 0;
+        int32_t rejectedEncodedWidth = 0;
+        int32_t rejectedEncodedHeight = 0;
+
+        RepeatedFrameFilter repeatFilter;
+        rtc::scoped_refptr<webrtc::I420BufferInterface> lastDeliveredBuffer;
+
+        std::vector<uint64_t> rowHashes;
+        ScreenContentDetector screenContentDetector;
+
+        bool isMotionAdapted = true;
+        MotionFramerateController motionController;
+        LumaSignature lastLumaSignature{};
+        bool hasLumaSignature = false;
+        std::unique_ptr<WorkerPool> workerPool;
     };
 
 }  // namespace caff
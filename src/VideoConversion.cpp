@@ -0,0 +1,402 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "VideoConversion.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "WorkerPool.hpp"
+
+#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include "libyuv.h"
+
+namespace caff {
+
+    // Rows of RGB scaled and converted at a time. Keeps the scaled band in cache while it is converted.
+    int constexpr scaleBandRows = 16;
+
+    int constexpr bytesPerRgbPixel = 4;
+
+    // Copied from old version of libwebrtc
+    static libyuv::RotationMode convertRotationMode(webrtc::VideoRotation rotation) {
+        switch (rotation) {
+        case webrtc::kVideoRotation_0:
+            return libyuv::kRotate0;
+        case webrtc::kVideoRotation_90:
+            return libyuv::kRotate90;
+        case webrtc::kVideoRotation_180:
+            return libyuv::kRotate180;
+        case webrtc::kVideoRotation_270:
+            return libyuv::kRotate270;
+        }
+    }
+
+    static int greatestCommonDivisor(int a, int b) {
+        while (b != 0) {
+            int remainder = a % b;
+            a = b;
+            b = remainder;
+        }
+        return a;
+    }
+
+    // Whether libyuv scales every plane of an I420 frame from |srcWidth|x|srcHeight| to |dstWidth|x|dstHeight| with a
+    // filter that reads only the source rows under each output row. kFilterBox falls back to bilinear once neither side
+    // shrinks below half, and bilinear reads across band edges, which would leave seams. Exact halving of both sides is
+    // the exception, since it averages each 2x2 block on its own, but only if the chroma planes halve exactly too.
+    static bool isScaledRowLocally(int srcWidth, int srcHeight, int dstWidth, int dstHeight) {
+        if (dstHeight * 2 < srcHeight) {
+            return true;
+        }
+        return dstWidth * 2 == srcWidth && dstHeight * 2 == srcHeight && srcWidth % 4 == 0 && srcHeight % 4 == 0;
+    }
+
+    // Splits |rows| into one band per thread, each a multiple of |alignment| rows, and calls |function| for each band.
+    // Returns the first nonzero result, if any.
+    static int forEachBand(
+            WorkerPool * workerPool,
+            int rows,
+            int alignment,
+            std::function<int(int bandY, int bandRows)> const & function) {
+        int const concurrency = workerPool ? static_cast<int>(workerPool->getConcurrency()) : 1;
+        int bandRows = (rows + concurrency - 1) / concurrency;
+        bandRows = std::max((bandRows + alignment - 1) / alignment * alignment, alignment);
+        int const bandCount = (rows + bandRows - 1) / bandRows;
+        if (bandCount <= 1) {
+            return function(0, rows);
+        }
+
+        std::vector<int> results(bandCount);
+        workerPool->parallelFor(bandCount, [&](size_t index) {
+            int const bandY = static_cast<int>(index) * bandRows;
+            results[index] = function(bandY, std::min(bandRows, rows - bandY));
+        });
+
+        for (auto result : results) {
+            if (result != 0) {
+                return result;
+            }
+        }
+        return 0;
+    }
+
+    // Copied from old version of libwebrtc
+    int convertToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int cropX,
+            int cropY,
+            int srcWidth,
+            int srcHeight,
+            size_t sampleSize,
+            webrtc::VideoRotation rotation,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool) {
+        int dstWidth = dstBuffer->width();
+        int dstHeight = dstBuffer->height();
+        // LibYuv expects pre-rotation values for dst.
+        // Stride values should correspond to the destination values.
+        if (rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270) {
+            std::swap(dstWidth, dstHeight);
+        }
+
+        // Rotated output doesn't map to bands of rows, and MJPEG can't be decoded starting partway down the frame
+        bool const canSplit = rotation == webrtc::kVideoRotation_0 && srcVideoType != webrtc::VideoType::kMJPEG &&
+                              srcHeight > 0;
+        if (!canSplit) {
+            workerPool = nullptr;
+        }
+
+        // Bands start on even rows so each one owns whole chroma rows
+        return forEachBand(workerPool, dstHeight, 2, [&](int bandY, int bandRows) {
+            return libyuv::ConvertToI420(
+                    srcFrame,
+                    sampleSize,
+                    dstBuffer->MutableDataY() + bandY * dstBuffer->StrideY(),
+                    dstBuffer->StrideY(),
+                    dstBuffer->MutableDataU() + (bandY / 2) * dstBuffer->StrideU(),
+                    dstBuffer->StrideU(),
+                    dstBuffer->MutableDataV() + (bandY / 2) * dstBuffer->StrideV(),
+                    dstBuffer->StrideV(),
+                    cropX,
+                    cropY + bandY,
+                    srcWidth,
+                    srcHeight,
+                    dstWidth,
+                    bandRows,
+                    convertRotationMode(rotation),
+                    webrtc::ConvertVideoType(srcVideoType));
+        });
+    }
+
+    int scaleI420(
+            webrtc::I420BufferInterface const & srcBuffer, webrtc::I420Buffer * dstBuffer, WorkerPool * workerPool) {
+        int const srcHeight = srcBuffer.height();
+        int const dstHeight = dstBuffer->height();
+
+        // Bands only scale independently when each one maps to a whole number of source rows. The smallest such band
+        // comes from the reduced height ratio, doubled if needed so bands also cover whole chroma rows.
+        int const divisor = greatestCommonDivisor(srcHeight, dstHeight);
+        int dstUnit = dstHeight / divisor;
+        int srcUnit = srcHeight / divisor;
+        if (dstUnit % 2 != 0 || srcUnit % 2 != 0) {
+            dstUnit *= 2;
+            srcUnit *= 2;
+        }
+        if (dstHeight % dstUnit != 0 || dstUnit * 2 > dstHeight ||
+            !isScaledRowLocally(srcBuffer.width(), srcHeight, dstBuffer->width(), dstHeight)) {
+            workerPool = nullptr;
+        }
+
+        if (!workerPool) {
+            dstBuffer->ScaleFrom(srcBuffer);
+            return 0;
+        }
+
+        return forEachBand(workerPool, dstHeight, dstUnit, [&](int bandY, int bandRows) {
+            int const srcY = bandY / dstUnit * srcUnit;
+            int const srcRows = bandRows / dstUnit * srcUnit;
+            return libyuv::I420Scale(
+                    srcBuffer.DataY() + srcY * srcBuffer.StrideY(),
+                    srcBuffer.StrideY(),
+                    srcBuffer.DataU() + (srcY / 2) * srcBuffer.StrideU(),
+                    srcBuffer.StrideU(),
+                    srcBuffer.DataV() + (srcY / 2) * srcBuffer.StrideV(),
+                    srcBuffer.StrideV(),
+                    srcBuffer.width(),
+                    srcRows,
+                    dstBuffer->MutableDataY() + bandY * dstBuffer->StrideY(),
+                    dstBuffer->StrideY(),
+                    dstBuffer->MutableDataU() + (bandY / 2) * dstBuffer->StrideU(),
+                    dstBuffer->StrideU(),
+                    dstBuffer->MutableDataV() + (bandY / 2) * dstBuffer->StrideV(),
+                    dstBuffer->StrideV(),
+                    dstBuffer->width(),
+                    bandRows,
+                    libyuv::kFilterBox);
+        });
+    }
+
+    uint64_t hashRows(
+            uint8_t const * data,
+            int stride,
+            int rowBytes,
+            int rows,
+            uint64_t seed,
+            std::vector<uint64_t> * rowHashes) {
+        // 64-bit FNV-1a over 8-byte words rather than single bytes. Each row is split across four interleaved lanes so
+        // the multiplies don't wait on each other, which brings hashing a whole frame close to the cost of copying it
+        uint64_t constexpr fnvOffset = 0xcbf29ce484222325ull;
+        uint64_t constexpr fnvPrime = 0x100000001b3ull;
+        int constexpr laneCount = 4;
+        auto mix = [](uint64_t & hash, uint64_t word) {
+            hash ^= word;
+            hash *= fnvPrime;
+        };
+
+        if (rowHashes) {
+            rowHashes->clear();
+        }
+
+        // Each row is hashed on its own and then folded into the frame hash, so a change in one row doesn't alter the
+        // hashes of the rows after it
+        uint64_t hash = fnvOffset ^ seed;
+        for (int row = 0; row < rows; ++row) {
+            auto line = data + static_cast<ptrdiff_t>(row) * stride;
+            uint64_t lanes[laneCount];
+            for (int lane = 0; lane < laneCount; ++lane) {
+                lanes[lane] = fnvOffset + lane;
+            }
+
+            int offset = 0;
+            for (; offset + laneCount * 8 <= rowBytes; offset += laneCount * 8) {
+                for (int lane = 0; lane < laneCount; ++lane) {
+                    uint64_t word;
+                    std::memcpy(&word, line + offset + lane * 8, sizeof(word));
+                    mix(lanes[lane], word);
+                }
+            }
+            for (; offset + 8 <= rowBytes; offset += 8) {
+                uint64_t word;
+                std::memcpy(&word, line + offset, sizeof(word));
+                mix(lanes[0], word);
+            }
+            for (; offset < rowBytes; ++offset) {
+                mix(lanes[0], line[offset]);
+            }
+
+            uint64_t rowHash = lanes[0];
+            for (int lane = 1; lane < laneCount; ++lane) {
+                mix(rowHash, lanes[lane]);
+            }
+            mix(hash, rowHash);
+            if (rowHashes) {
+                rowHashes->push_back(rowHash);
+            }
+        }
+        return hash;
+    }
+
+    bool canScaleBeforeConversion(webrtc::VideoType format) {
+        switch (format) {
+        case webrtc::VideoType::kARGB:
+        case webrtc::VideoType::kBGRA:
+        case webrtc::VideoType::kABGR:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    int packedRowBytes(webrtc::VideoType format, int width) {
+        switch (format) {
+        case webrtc::VideoType::kRGB24:
+            return width * 3;
+        case webrtc::VideoType::kARGB:
+        case webrtc::VideoType::kBGRA:
+        case webrtc::VideoType::kABGR:
+            return width * bytesPerRgbPixel;
+        case webrtc::VideoType::kARGB4444:
+        case webrtc::VideoType::kRGB565:
+        case webrtc::VideoType::kARGB1555:
+            return width * 2;
+        case webrtc::VideoType::kYUY2:
+        case webrtc::VideoType::kUYVY:
+            // Each 4-byte macropixel holds two pixels
+            return (width + 1) / 2 * 4;
+        default:
+            return 0;
+        }
+    }
+
+    using PackedToI420Function = int (*)(
+            uint8_t const * srcPacked,
+            int srcStridePacked,
+            uint8_t * dstY,
+            int dstStrideY,
+            uint8_t * dstU,
+            int dstStrideU,
+            uint8_t * dstV,
+            int dstStrideV,
+            int width,
+            int height);
+
+    // Same mapping libyuv::ConvertToI420 uses for these formats
+    static PackedToI420Function packedToI420Function(webrtc::VideoType format) {
+        switch (format) {
+        case webrtc::VideoType::kRGB24:
+            return libyuv::RGB24ToI420;
+        case webrtc::VideoType::kARGB:
+            return libyuv::ARGBToI420;
+        case webrtc::VideoType::kBGRA:
+            return libyuv::BGRAToI420;
+        case webrtc::VideoType::kABGR:
+            return libyuv::ABGRToI420;
+        case webrtc::VideoType::kARGB4444:
+            return libyuv::ARGB4444ToI420;
+        case webrtc::VideoType::kRGB565:
+            return libyuv::RGB565ToI420;
+        case webrtc::VideoType::kARGB1555:
+            return libyuv::ARGB1555ToI420;
+        case webrtc::VideoType::kYUY2:
+            return libyuv::YUY2ToI420;
+        case webrtc::VideoType::kUYVY:
+            return libyuv::UYVYToI420;
+        default:
+            return nullptr;
+        }
+    }
+
+    int convertPackedToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int srcStride,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool) {
+        auto convert = packedToI420Function(srcVideoType);
+        if (!convert) {
+            return -1;
+        }
+
+        return forEachBand(workerPool, dstBuffer->height(), 2, [&](int bandY, int bandRows) {
+            return convert(
+                    srcFrame + bandY * srcStride,
+                    srcStride,
+                    dstBuffer->MutableDataY() + bandY * dstBuffer->StrideY(),
+                    dstBuffer->StrideY(),
+                    dstBuffer->MutableDataU() + (bandY / 2) * dstBuffer->StrideU(),
+                    dstBuffer->StrideU(),
+                    dstBuffer->MutableDataV() + (bandY / 2) * dstBuffer->StrideV(),
+                    dstBuffer->StrideV(),
+                    dstBuffer->width(),
+                    bandRows);
+        });
+    }
+
+    int scaleAndConvertToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int srcStride,
+            int srcWidth,
+            int srcHeight,
+            std::vector<uint8_t> & scratch,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool) {
+        if (!canScaleBeforeConversion(srcVideoType)) {
+            return -1;
+        }
+        auto convert = packedToI420Function(srcVideoType);
+
+        int const dstWidth = dstBuffer->width();
+        int const dstHeight = dstBuffer->height();
+        int const scratchStride = dstWidth * bytesPerRgbPixel;
+
+        // Sized for the whole scaled frame so each band can be clipped out of it without offset math, but only one
+        // band at a time is touched before it is consumed
+        scratch.resize(static_cast<size_t>(scratchStride) * dstHeight);
+
+        // Each thread works through its own run of bands. They write to disjoint rows of |scratch|, so it is shared.
+        return forEachBand(workerPool, dstHeight, scaleBandRows, [&](int firstY, int rows) {
+            for (int bandY = firstY; bandY < firstY + rows; bandY += scaleBandRows) {
+                int const bandRows = std::min(scaleBandRows, firstY + rows - bandY);
+
+                auto result = libyuv::ARGBScaleClip(
+                        srcFrame,
+                        srcStride,
+                        srcWidth,
+                        srcHeight,
+                        scratch.data(),
+                        scratchStride,
+                        dstWidth,
+                        dstHeight,
+                        0,
+                        bandY,
+                        dstWidth,
+                        bandRows,
+                        libyuv::kFilterBox);
+                if (result != 0) {
+                    return result;
+                }
+
+                // bandY is always even, so chroma rows line up with the band
+                result = convert(
+                        scratch.data() + bandY * scratchStride,
+                        scratchStride,
+                        dstBuffer->MutableDataY() + bandY * dstBuffer->StrideY(),
+                        dstBuffer->StrideY(),
+                        dstBuffer->MutableDataU() + (bandY / 2) * dstBuffer->StrideU(),
+                        dstBuffer->StrideU(),
+                        dstBuffer->MutableDataV() + (bandY / 2) * dstBuffer->StrideV(),
+                        dstBuffer->StrideV(),
+                        dstWidth,
+                        bandRows);
+                if (result != 0) {
+                    return result;
+                }
+            }
+            return 0;
+        });
+    }
+
+} // namespace caff
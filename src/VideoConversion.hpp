@@ -0,0 +1,72 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "common_types.h"
+
+namespace caff {
+    class WorkerPool;
+
+    // The functions below split their work into bands of rows across |workerPool| when it is not null
+
+    // Converts a frame to I420 at |dstBuffer|'s size. Any cropping is done before conversion, no scaling is done.
+    int convertToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int cropX,
+            int cropY,
+            int srcWidth,
+            int srcHeight,
+            size_t sampleSize,
+            webrtc::VideoRotation rotation,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool);
+
+    // Scales |srcBuffer| to |dstBuffer|'s size with the same box filter as I420Buffer::ScaleFrom, and with the same result.
+    // Only ratios that libyuv box filters are split into bands; others, such as 1080 to 720, run in one piece
+    int scaleI420(
+            webrtc::I420BufferInterface const & srcBuffer, webrtc::I420Buffer * dstBuffer, WorkerPool * workerPool);
+
+    // Bytes in one row of a tightly packed frame in a single-plane format, or 0 if the format has separate planes or is
+    // compressed
+    int packedRowBytes(webrtc::VideoType format, int width);
+
+    // Converts a single-plane frame with rows |srcStride| bytes apart to I420 at |dstBuffer|'s size, without scaling
+    int convertPackedToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int srcStride,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool);
+
+    // Hashes |rows| rows of |rowBytes| bytes each, |stride| bytes apart, so a frame can be compared with the one before
+    // it. Every row is read, since any change that falls outside the hashed rows would pass for a repeat. If |rowHashes|
+    // is given, it is filled with a separate hash of each row, so two frames can be compared row by row.
+    uint64_t hashRows(
+            uint8_t const * data,
+            int stride,
+            int rowBytes,
+            int rows,
+            uint64_t seed,
+            std::vector<uint64_t> * rowHashes = nullptr);
+
+    // Whether scaleAndConvertToI420 supports the format. Only 32-bit packed RGB formats can be scaled before conversion
+    bool canScaleBeforeConversion(webrtc::VideoType format);
+
+    // Scales a packed RGB frame to |dstBuffer|'s size and converts it to I420 in the same pass, a band of rows at a
+    // time, so the full-resolution frame is only read once. |scratch| holds scaled RGB rows and is reused across calls.
+    int scaleAndConvertToI420(
+            webrtc::VideoType srcVideoType,
+            uint8_t const * srcFrame,
+            int srcStride,
+            int srcWidth,
+            int srcHeight,
+            std::vector<uint8_t> & scratch,
+            webrtc::I420Buffer * dstBuffer,
+            WorkerPool * workerPool);
+
+} // namespace caff
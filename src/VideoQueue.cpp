@@ -0,0 +1,179 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "VideoQueue.hpp"
+
+#include <cstring>
+
+#include "ErrorLogging.hpp"
+
+namespace caff {
+
+    VideoQueue::VideoQueue(size_t maxDepth, caff_VideoDropPolicy dropPolicy, FrameHandler handler)
+        : maxDepth(maxDepth)
+        , dropPolicy(dropPolicy)
+        , handler(std::move(handler))
+        , slots(maxDepth + 2) {
+        for (auto & slot : slots) {
+            freeSlots.push_back(&slot);
+        }
+        thread = std::thread([this] { run(); });
+    }
+
+    VideoQueue::~VideoQueue() { stop(); }
+
+    QueuedFrame * VideoQueue::acquireSlot() {
+        std::shared_ptr<void> droppedPlanes;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (isStopping) {
+            return nullptr;
+        }
+
+        if (readySlots.size() >= maxDepth) {
+            ++droppedFrames;
+            if (dropPolicy == caff_VideoDropPolicyNewest) {
+                return nullptr;
+            }
+            auto oldest = readySlots.front();
+            readySlots.pop_front();
+            // Hand the planes back after unlocking, since the release callback is application code
+            droppedPlanes = std::move(oldest->planesOwner);
+            freeSlots.push_back(oldest);
+        }
+
+        CAFF_CHECK(!freeSlots.empty());
+        auto slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    void VideoQueue::commitSlot(QueuedFrame * slot) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            readySlots.push_back(slot);
+        }
+        readyCondition.notify_one();
+    }
+
+    void VideoQueue::pushFrame(
+            caff_VideoFormat format,
+            uint8_t const * frameData,
+            size_t frameBytes,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        auto slot = acquireSlot();
+        if (!slot) {
+            return;
+        }
+
+        // Slots keep their allocation between frames, so this only allocates while the queue warms up
+        slot->format = format;
+        slot->planes[0] = nullptr;
+        slot->data.resize(frameBytes);
+        std::memcpy(slot->data.data(), frameData, frameBytes);
+        slot->width = width;
+        slot->height = height;
+        slot->timestamp = timestamp;
+        commitSlot(slot);
+    }
+
+    void VideoQueue::pushStridedFrame(
+            caff_VideoFormat format,
+            uint8_t const * frameData,
+            int32_t stride,
+            size_t rowBytes,
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp) {
+        auto slot = acquireSlot();
+        if (!slot) {
+            return;
+        }
+
+        // Dropping the padding here means the consumer sees an ordinary packed frame
+        slot->format = format;
+        slot->planes[0] = nullptr;
+        slot->data.resize(rowBytes * height);
+        for (int32_t row = 0; row < height; ++row) {
+            std::memcpy(slot->data.data() + row * rowBytes, frameData + static_cast<ptrdiff_t>(row) * stride, rowBytes);
+        }
+        slot->width = width;
+        slot->height = height;
+        slot->timestamp = timestamp;
+        commitSlot(slot);
+    }
+
+    void VideoQueue::pushPlanes(
+            caff_VideoFormat format,
+            uint8_t const * const planes[3],
+            int32_t const strides[3],
+            int32_t width,
+            int32_t height,
+            std::chrono::microseconds timestamp,
+            std::shared_ptr<void> planesOwner) {
+        auto slot = acquireSlot();
+        if (!slot) {
+            return;
+        }
+
+        slot->format = format;
+        for (size_t i = 0; i < 3; ++i) {
+            slot->planes[i] = planes[i];
+            slot->strides[i] = strides[i];
+        }
+        slot->planesOwner = std::move(planesOwner);
+        slot->width = width;
+        slot->height = height;
+        slot->timestamp = timestamp;
+        commitSlot(slot);
+    }
+
+    void VideoQueue::run() {
+        while (true) {
+            QueuedFrame * slot = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readyCondition.wait(lock, [this] { return isStopping || !readySlots.empty(); });
+                if (isStopping) {
+                    return;
+                }
+                slot = readySlots.front();
+                readySlots.pop_front();
+            }
+
+            try {
+                handler(*slot);
+            } catch (...) {
+                LOG_ERROR("Failed to handle queued video frame");
+            }
+            slot->planesOwner.reset();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            freeSlots.push_back(slot);
+        }
+    }
+
+    void VideoQueue::stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isStopping = true;
+        }
+        readyCondition.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+
+        // Nothing else touches the slots once the thread has exited and isStopping is set
+        for (auto slot : readySlots) {
+            slot->planesOwner.reset();
+            freeSlots.push_back(slot);
+        }
+        readySlots.clear();
+    }
+
+    VideoQueue::Stats VideoQueue::getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return { static_cast<uint32_t>(readySlots.size()), droppedFrames };
+    }
+
+} // namespace caff
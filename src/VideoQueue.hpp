@@ -0,0 +1,102 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include "caffeine.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace caff {
+
+    // A frame as handed in by the application. Packed frames are copied into |data|; planar frames reference the
+    // application's planes, which stay valid until |planesOwner| is released.
+    struct QueuedFrame {
+        caff_VideoFormat format = caff_VideoFormatUnknown;
+        std::vector<uint8_t> data;
+        uint8_t const * planes[3] = {};
+        int32_t strides[3] = {};
+        std::shared_ptr<void> planesOwner;
+        int32_t width = 0;
+        int32_t height = 0;
+        std::chrono::microseconds timestamp{};
+
+        bool isPlanar() const { return planes[0] != nullptr; }
+    };
+
+    // Bounded single-producer/single-consumer frame queue with a dedicated consumer thread. Frame slots are
+    // preallocated and recycled, so the only work left on the producer's thread is copying the frame in.
+    class VideoQueue {
+    public:
+        using FrameHandler = std::function<void(QueuedFrame const &)>;
+
+        struct Stats {
+            uint32_t depth;
+            uint64_t droppedFrames;
+        };
+
+        VideoQueue(size_t maxDepth, caff_VideoDropPolicy dropPolicy, FrameHandler handler);
+        VideoQueue(VideoQueue const &) = delete;
+        VideoQueue & operator=(VideoQueue const &) = delete;
+        ~VideoQueue();
+
+        void pushFrame(
+                caff_VideoFormat format,
+                uint8_t const * frameData,
+                size_t frameBytes,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+        // Copies |height| rows of |rowBytes| each, |stride| bytes apart, into a tightly packed frame
+        void pushStridedFrame(
+                caff_VideoFormat format,
+                uint8_t const * frameData,
+                int32_t stride,
+                size_t rowBytes,
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp);
+        void pushPlanes(
+                caff_VideoFormat format,
+                uint8_t const * const planes[3],
+                int32_t const strides[3],
+                int32_t width,
+                int32_t height,
+                std::chrono::microseconds timestamp,
+                std::shared_ptr<void> planesOwner);
+
+        // Waits for the frame being handled to finish and discards the rest
+        void stop();
+
+        Stats getStats() const;
+
+    private:
+        QueuedFrame * acquireSlot();
+        void commitSlot(QueuedFrame * slot);
+        void run();
+
+        size_t const maxDepth;
+        caff_VideoDropPolicy const dropPolicy;
+        FrameHandler handler;
+
+        // Enough for a full queue, one frame being filled by the producer, and one being handled by the consumer
+        std::vector<QueuedFrame> slots;
+        std::vector<QueuedFrame *> freeSlots;
+        std::deque<QueuedFrame *> readySlots;
+
+        mutable std::mutex mutex;
+        std::condition_variable readyCondition;
+        bool isStopping = false;
+        std::atomic<uint64_t> droppedFrames{ 0 };
+        std::thread thread;
+    };
+
+} // namespace caff
@@ -0,0 +1,81 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#include "WorkerPool.hpp"
+
+namespace caff {
+
+    WorkerPool::WorkerPool(size_t threadCount) {
+        for (size_t i = 0; i < threadCount; ++i) {
+            threads.emplace_back([this] { run(); });
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isStopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto & thread : threads) {
+            thread.join();
+        }
+    }
+
+    void WorkerPool::parallelFor(size_t count, Task const & task) {
+        if (count == 0) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> callLock(callMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->task = &task;
+            taskCount = count;
+            nextIndex = 0;
+            pendingCount = count;
+        }
+        workAvailable.notify_all();
+
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        workFinished.wait(lock, [this] { return pendingCount == 0; });
+        this->task = nullptr;
+    }
+
+    void WorkerPool::runTasks() {
+        while (true) {
+            Task const * currentTask;
+            size_t index;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!task || nextIndex >= taskCount) {
+                    return;
+                }
+                currentTask = task;
+                index = nextIndex++;
+            }
+
+            (*currentTask)(index);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pendingCount == 0) {
+                workFinished.notify_all();
+            }
+        }
+    }
+
+    void WorkerPool::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            workAvailable.wait(lock, [this] { return isStopping || (task && nextIndex < taskCount); });
+            if (isStopping) {
+                return;
+            }
+            lock.unlock();
+            runTasks();
+            lock.lock();
+        }
+    }
+
+} // namespace caff
@@ -0,0 +1,49 @@
+// Copyright 2019 Caffeine Inc. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace caff {
+
+    // Fixed set of threads for splitting one piece of work into independent chunks. The calling thread takes part in
+    // the work too, so a pool with N threads runs N + 1 chunks at once.
+    class WorkerPool {
+    public:
+        using Task = std::function<void(size_t index)>;
+
+        explicit WorkerPool(size_t threadCount);
+        WorkerPool(WorkerPool const &) = delete;
+        WorkerPool & operator=(WorkerPool const &) = delete;
+        ~WorkerPool();
+
+        // Number of chunks that can run at once, including the calling thread
+        size_t getConcurrency() const { return threads.size() + 1; }
+
+        // Calls |task| once for each index in [0, count) and returns when all calls have finished. |task| must not
+        // throw. Calls from different threads are serialized.
+        void parallelFor(size_t count, Task const & task);
+
+    private:
+        void run();
+        void runTasks();
+
+        std::vector<std::thread> threads;
+        std::mutex callMutex;
+
+        std::mutex mutex;
+        std::condition_variable workAvailable;
+        std::condition_variable workFinished;
+        Task const * task = nullptr;
+        size_t taskCount = 0;
+        size_t nextIndex = 0;
+        size_t pendingCount = 0;
+        bool isStopping = false;
+    };
+
+} // namespace caff
@@ -3,14 +3,17 @@
 #include "X264Encoder.hpp"
 
 #include "ErrorLogging.hpp"
+#include "RegionsOfInterest.hpp"
 
-#include "common_video/libyuv/include/webrtc_libyuv.h"
+#include <algorithm>
+
+#include "rtc_base/timeutils.h"
 #include "system_wrappers/include/metrics.h"
 
 namespace caff {
 
-    uint32_t const kLongStartcodeSize = 4;
-    uint32_t const kShortStartcodeSize = 3;
+    // x264 prefixes each NAL unit with its size when Annex B output is off
+    uint32_t const kLengthPrefixSize = 4;
 
     float const kHighQualityCrf = 18.0f;
     float const kNormalQualityCrf = 21.5f;
@@ -21,19 +24,109 @@ namespace caff {
     // minimum bitrate for high quality crf. above 1000 kbps will use high quality crf if before 720p.
     int const kMinBitrateKbpsHighQualityCrf = 1000;
 
-    // If the incoming fps is higher than 50, we will switch x264 to encode at 60fps. Otherwise, if the
-    // incoming fps drops below 35, we will switch to encode at 30fps.
+    // The capturer chooses between 30 and 60 fps from how much the picture moves (see MotionFramerateController), and
+    // x264 follows the rate frames arrive at. If the incoming fps is higher than 50, we will switch x264 to encode at
+    // 60fps. Otherwise, if the incoming fps drops below 35, we will switch to encode at 30fps.
     // The default target framerate is 30.
     uint32_t const kFpsHighThreshold = 50;
     uint32_t const kFpsLowThreshold = 35;
 
+    // Relative change in the bandwidth estimate needed before the encoder's rate control is reconfigured. The estimate
+    // moves a little on every update, and each reconfigure resets VBV state
+    double const kBitrateDecreaseThreshold = 0.05;
+    double const kBitrateIncreaseThreshold = 0.15;
+
+    // QP bounds for WebRTC's quality scaler, which steps the resolution down while the average QP stays above the
+    // high threshold and back up while it stays below the low one. Same values as WebRTC's OpenH264 encoder
+    int const kLowH264QpThreshold = 24;
+    int const kHighH264QpThreshold = 37;
+
+    // Quality scaling stops at 640x360, the smallest size the capturer sends
+    int const kMinScaledPixels = 640 * 360;
+
+    // Each slice restarts prediction, so past a few slices the loss in compression outweighs the speedup
+    int32_t const kMaxSlicedThreads = 4;
+
     // Used by histograms. Values of entries should not be changed.
     enum X264EncoderEvent {
         kX264EncoderEventInit = 0,
         kX264EncoderEventError = 1,
+        kX264EncoderEventSpeedUp = 2,
+        kX264EncoderEventSpeedDown = 3,
         kX264EncoderEventMax = 16,
     };
 
+    // The parts of x264's presets that x264_encoder_reconfig can change, fastest first. Level numbers are reported
+    // through caff_VideoStats::encoderSpeedLevel
+    struct SpeedLevel {
+        char const * name;
+        int frameReference;
+        unsigned int intraPartitions;
+        unsigned int interPartitions;
+        int meMethod;
+        int subpelRefine;
+        int trellis;
+        int deblockingFilter;
+    };
+
+    unsigned int const kIntraPartitions = X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8;
+    unsigned int const kInterPartitions = kIntraPartitions | X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16;
+
+    // x264 can't be reconfigured out of subme 0, so the fastest level keeps subme 1 and is otherwise ultrafast
+    SpeedLevel const kSpeedLadder[] = {
+        { "ultrafast", 1, 0, 0, X264_ME_DIA, 1, 0, 0 },
+        { "superfast", 1, kIntraPartitions, kIntraPartitions, X264_ME_DIA, 1, 0, 1 },
+        { "veryfast", 1, kIntraPartitions, kInterPartitions, X264_ME_HEX, 2, 0, 1 },
+        { "faster", 2, kIntraPartitions, kInterPartitions, X264_ME_HEX, 4, 1, 1 },
+    };
+    int32_t const kSpeedLadderSize = static_cast<int32_t>(sizeof(kSpeedLadder) / sizeof(kSpeedLadder[0]));
+    int32_t const kDefaultSpeedLevel = 2;
+
+    // x264_encoder_reconfig can lower the reference count but not raise it past the count x264 was opened with
+    int const kMaxSpeedLadderReferences = 2;
+
+    int32_t speedLadderSize() { return kSpeedLadderSize; }
+
+    void applySpeedLevel(x264_param_t * encoderParams, int32_t speedLevel) {
+        auto const & level = kSpeedLadder[speedLevel];
+        encoderParams->i_frame_reference = level.frameReference;
+        encoderParams->analyse.intra = level.intraPartitions;
+        encoderParams->analyse.inter = level.interPartitions;
+        encoderParams->analyse.i_me_method = level.meMethod;
+        encoderParams->analyse.i_subpel_refine = level.subpelRefine;
+        encoderParams->analyse.i_trellis = level.trellis;
+        encoderParams->b_deblocking_filter = level.deblockingFilter;
+    }
+
+    // Partitions and trellis are masked by the profile, and the reference count by what x264 was opened with, so only
+    // the settings every profile keeps are compared
+    bool isAtSpeedLevel(x264_param_t const & encoderParams, int32_t speedLevel) {
+        auto const & level = kSpeedLadder[speedLevel];
+        return encoderParams.analyse.i_me_method == level.meMethod &&
+               encoderParams.analyse.i_subpel_refine == level.subpelRefine &&
+               encoderParams.b_deblocking_filter == level.deblockingFilter;
+    }
+
+    static float crfFor(int height, uint32_t kbps) {
+        return (height >= kMaxFrameHeightHighQualityCrf || kbps < kMinBitrateKbpsHighQualityCrf) ? kNormalQualityCrf
+                                                                                                 : kHighQualityCrf;
+    }
+
+    // B-frames are never used, so the constrained variants encode the same as their unconstrained profiles
+    static char const * x264ProfileName(webrtc::H264::Profile profile) {
+        switch (profile) {
+        case webrtc::H264::kProfileHigh:
+        case webrtc::H264::kProfileConstrainedHigh:
+            return "high";
+        case webrtc::H264::kProfileMain:
+            return "main";
+        case webrtc::H264::kProfileBaseline:
+        case webrtc::H264::kProfileConstrainedBaseline:
+        default:
+            return "baseline";
+        }
+    }
+
     webrtc::FrameType ConvertToWebrtcFrameType(int type) {
         switch (type) {
         case X264_TYPE_IDR:
@@ -49,96 +142,73 @@ namespace caff {
         }
     }
 
-    // Helper method used by H264EncoderImpl::Encode.
-    // Copies the encoded bytes from |info| to |encodedImage| and updates the
-    // fragmentation information of |fragHeader|. The |encodedImage->_buffer| may
-    // be deleted and reallocated if a bigger buffer is required.
-    static void rtpFragmentize(
+    void rtpFragmentize(
             webrtc::EncodedImage * encodedImage,
-            std::unique_ptr<uint8_t[]> * encodedImageBuffer,
-            webrtc::VideoFrameBuffer const & frameBuffer,
+            std::vector<uint8_t> * copyBuffer,
             uint32_t numNals,
             x264_nal_t * nal,
             webrtc::RTPFragmentationHeader * fragHeader) {
-        // Calculate minimum buffer size required to hold encoded data.
-        size_t requiredSize = 0;
-        size_t fragmentsCount = 0;
+        // With Annex B output x264 starts every slice after the first with a 3 byte start code, and WebRTC's H.264
+        // decoder only accepts 4 byte ones. Length-prefixed output gives every NAL unit a 4 byte prefix instead, which
+        // is overwritten with a start code where it lies.
+        uint8_t const startCode[kLengthPrefixSize] = { 0, 0, 0, 1 };
 
-        for (uint32_t idx = 0; idx < numNals; ++idx, ++fragmentsCount) {
-            CHECK_POSITIVE(nal[idx].i_payload);
+        // x264 writes all NAL units of a frame back to back, so normally the image can point straight at its output
+        size_t requiredSize = 0;
+        bool isContiguous = true;
+        for (uint32_t idx = 0; idx < numNals; ++idx) {
+            CAFF_CHECK(nal[idx].i_payload > static_cast<int>(kLengthPrefixSize));
             // Ensure |requiredSize| will not overflow.
-            CAFF_CHECK(nal[idx].i_payload <= std::numeric_limits<size_t>::max() - requiredSize);
-            requiredSize += nal[idx].i_payload;
-            // x264 uses 3 byte startcode instead, and uses 4 byte start codes only for
-            // SPS and PPS. In the case of 3 byte start codes, we need to prepend an
-            // extra 00 in front since WebRTC can only decode start codes with 00 00 00
-            // 01.
-            if (!nal[idx].b_long_startcode) {
-                ++requiredSize;
+            CAFF_CHECK(static_cast<size_t>(nal[idx].i_payload) <= std::numeric_limits<size_t>::max() - requiredSize);
+            if (nal[idx].p_payload != nal[0].p_payload + requiredSize) {
+                isContiguous = false;
             }
+            requiredSize += nal[idx].i_payload;
+            memcpy(nal[idx].p_payload, startCode, sizeof(startCode));
         }
 
-        if (encodedImage->_size < requiredSize) {
-            // Increase buffer size. Allocate enough to hold an unencoded image, this
-            // should be more than enough to hold any encoded data of future frames of
-            // the same size (avoiding possible future reallocation due to variations in
-            // required size).
-            encodedImage->_size =
-                    webrtc::CalcBufferSize(webrtc::VideoType::kI420, frameBuffer.width(), frameBuffer.height());
-
-            if (encodedImage->_size < requiredSize) {
-                // Encoded data > unencoded data. Allocate required bytes.
-                LOG_WARNING(
-                        "Encoding produced more bytes than the original image data! Original: %zd, encoded: %zd",
-                        encodedImage->_size,
-                        requiredSize);
-                encodedImage->_size = requiredSize;
+        if (isContiguous) {
+            encodedImage->_buffer = numNals > 0 ? nal[0].p_payload : nullptr;
+            encodedImage->_size = requiredSize;
+        } else {
+            LOG_WARNING("x264 output is not contiguous; copying %zu bytes", requiredSize);
+            copyBuffer->resize(requiredSize);
+            size_t copied = 0;
+            for (uint32_t idx = 0; idx < numNals; ++idx) {
+                memcpy(copyBuffer->data() + copied, nal[idx].p_payload, nal[idx].i_payload);
+                copied += nal[idx].i_payload;
             }
-            encodedImage->_buffer = new uint8_t[encodedImage->_size];
-            encodedImageBuffer->reset(encodedImage->_buffer);
-        }
-
-        // Iterate layers and NAL units, note each NAL unit as a fragment and copy
-        // the data to |encodedImage->_buffer|.
-        // Because x264 generates both 4 and 3 byte start code, we need to prepend 00
-        // in the case where only a 3 byte start code is generated since WebRTC H.264
-        // decoder requires 4 byte start codes only. For simplicity, we will just
-        // prepend 00 00 00 01 in front of the NALU and remove the generated start
-        // code by x264.
-        uint8_t const startCode[4] = { 0, 0, 0, 1 };
-        fragHeader->VerifyAndAllocateFragmentationHeader(fragmentsCount);
-        size_t frag = 0;
-        encodedImage->_length = 0;
-
-        for (uint32_t idx = 0; idx < numNals; ++idx, ++frag) {
-            CAFF_CHECK(nal[idx].i_payload >= 4);
-
-            uint32_t offset = nal[idx].b_long_startcode ? kLongStartcodeSize : kShortStartcodeSize;
-            uint32_t naluSize = nal[idx].i_payload - offset;
-
-            // copy the start code first
-            memcpy(encodedImage->_buffer + encodedImage->_length, startCode, sizeof(startCode));
-            encodedImage->_length += sizeof(startCode);
-
-            // copy the data without start code
-            memcpy(encodedImage->_buffer + encodedImage->_length, nal[idx].p_payload + offset, naluSize);
-            encodedImage->_length += naluSize;
-
-            // offset to start of data. length is data without start code.
-            fragHeader->fragmentationOffset[frag] = encodedImage->_length - naluSize;
-            fragHeader->fragmentationLength[frag] = naluSize;
+            encodedImage->_buffer = copyBuffer->data();
+            encodedImage->_size = copyBuffer->size();
+        }
+        encodedImage->_length = requiredSize;
+
+        // offset to start of data. length is data without start code.
+        fragHeader->VerifyAndAllocateFragmentationHeader(numNals);
+        size_t offset = 0;
+        for (uint32_t frag = 0; frag < numNals; ++frag) {
+            fragHeader->fragmentationOffset[frag] = offset + kLengthPrefixSize;
+            fragHeader->fragmentationLength[frag] = nal[frag].i_payload - kLengthPrefixSize;
             fragHeader->fragmentationPlType[frag] = 0;
             fragHeader->fragmentationTimeDiff[frag] = 0;
+            offset += nal[frag].i_payload;
         }
     }
 
-    X264Encoder::X264Encoder(cricket::VideoCodec const & codec) {
-        LOG_DEBUG("Using x264 encoder");
+    X264Encoder::X264Encoder(cricket::VideoCodec const & codec, std::shared_ptr<EncoderControl> encoderControl)
+        : encoderControl(std::move(encoderControl)) {
         std::string packetizationModeString;
         if (codec.GetParam(cricket::kH264FmtpPacketizationMode, &packetizationModeString) &&
             packetizationModeString == "1") {
             packetizationMode = webrtc::H264PacketizationMode::NonInterleaved;
         }
+
+        // A missing profile-level-id means Constrained Baseline
+        auto profileLevelId = webrtc::H264::ParseSdpProfileLevelId(codec.params);
+        if (profileLevelId) {
+            profile = profileLevelId->profile;
+        }
+        LOG_DEBUG("Using x264 encoder with the %s profile", x264ProfileName(profile));
     }
 
     X264Encoder::~X264Encoder() { Release(); }
@@ -183,6 +253,13 @@ namespace caff {
             return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
         }
 
+        if (isPrepared && encoder && codecSettings->width == width && codecSettings->height == height &&
+            codecSettings->mode == mode && numCores == numberOfCores && maxPayloadSize == this->maxPayloadSize) {
+            return adoptPreparedEncoder(*codecSettings);
+        }
+        isPrepared = false;
+
+        flushDelayedFrames();
         int32_t releaseRet = Release();
         if (releaseRet != WEBRTC_VIDEO_CODEC_OK) {
             reportError();
@@ -191,6 +268,7 @@ namespace caff {
         CAFF_CHECK(!encoder);
 
         numberOfCores = numCores;
+        inputFps = 0;
 
         width = codecSettings->width;
         height = codecSettings->height;
@@ -202,6 +280,9 @@ namespace caff {
 
         // encoder and codecSettings both use kbits/second
         targetKbps = codecSettings->maxBitrate;
+        appliedKbps = targetKbps;
+
+        loadContentProfile();
 
         x264_param_t encoderParams;
         int32_t ret = x264_param_default_preset(&encoderParams, "veryfast", "zerolatency");
@@ -216,80 +297,212 @@ namespace caff {
         encoderParams.i_log_level = X264_LOG_DEBUG;
 
         encoderParams.i_csp = X264_CSP_I420;
-        encoderParams.b_annexb = 1;
-        encoderParams.b_cabac = 0;
+
+        // Comparing each frame with its input costs a full pass over both, so it is only done for measurements
+        encoderParams.analyse.b_psnr = offlineOptions.measureQuality;
+        encoderParams.analyse.b_ssim = offlineOptions.measureQuality;
+        // Length prefixes are rewritten into 4 byte start codes by rtpFragmentize
+        encoderParams.b_annexb = 0;
+        // CABAC saves about a tenth of the bitrate wherever the profile allows it
+        encoderParams.b_cabac =
+                profile != webrtc::H264::kProfileBaseline && profile != webrtc::H264::kProfileConstrainedBaseline;
 
         encoderParams.i_width = width;
         encoderParams.i_height = height;
         encoderParams.i_fps_den = 1;
         encoderParams.i_fps_num = targetFps;
+
+        // Frames carry their capture time in microseconds, so rate control budgets bits by wall-clock time rather
+        // than assuming every frame lasts 1 / targetFps. The zerolatency tune turns this off
+        encoderParams.b_vfr_input = 1;
+        encoderParams.i_timebase_num = 1;
+        encoderParams.i_timebase_den = 1'000'000;
         encoderParams.i_level_idc = 42;
 
         // CPU settings
-        // use single thread encoding since multi-threaded may cause some issue on
-        // certain CPU and/or Windows
-        encoderParams.i_threads = 1;
-        encoderParams.b_sliced_threads = 0;
+        applyThreading(&encoderParams);
 
         // bitstream parameters
         encoderParams.b_intra_refresh = 1;
-        encoderParams.i_bframe = 0;
-        encoderParams.i_nal_hrd = X264_NAL_HRD_CBR;
+        encoderParams.i_bframe = 0;  // every profile stays free of B-frames to keep latency down
+        // HRD parameters are written into the SPS, which would go stale once the bitrate is reconfigured. They are
+        // not used for CRF anyway
+        encoderParams.i_nal_hrd = X264_NAL_HRD_NONE;
 
         // rate control
         encoderParams.rc.i_rc_method = X264_RC_CRF;
         encoderParams.rc.i_bitrate = targetKbps;
 
-        encoderParams.rc.f_rf_constant =
-                (height >= kMaxFrameHeightHighQualityCrf || targetKbps < kMinBitrateKbpsHighQualityCrf)
-                        ? kNormalQualityCrf
-                        : kHighQualityCrf;
+        encoderParams.rc.f_rf_constant = chooseCrf(height, targetKbps);
+        encoderParams.rc.f_aq_strength = contentTuning->aqStrength;
         encoderParams.rc.i_vbv_buffer_size = targetKbps;
         encoderParams.rc.i_vbv_max_bitrate = targetKbps;
         encoderParams.rc.f_vbv_buffer_init = 0.5;
 
+        if (isScreenContent()) {
+            // Weaker deblocking keeps text and UI edges crisp, and fades are too rare in screen content to be worth
+            // searching for weighted prediction. The content tuning already limits the motion search
+            encoderParams.i_deblocking_filter_alphac0 = -1;
+            encoderParams.i_deblocking_filter_beta = -1;
+            encoderParams.analyse.i_weighted_pred = X264_WEIGHTP_NONE;
+        }
+
         // if using single NALU, need to limit slice size.
         if (packetizationMode == webrtc::H264PacketizationMode::SingleNalUnit) {
             encoderParams.i_slice_max_size = static_cast<unsigned int>(maxPayloadSize);
         }
 
-        x264_param_apply_profile(&encoderParams, "baseline");
+        x264_param_apply_profile(&encoderParams, x264ProfileName(profile));
 
-        ret = x264_picture_alloc(&pictureIn, encoderParams.i_csp, encoderParams.i_width, encoderParams.i_height);
-        if (0 != ret) {
-            LOG_ERROR("Failed to allocate picture. errno: %d", ret);
-            CAFF_CHECK(!encoder);
-            reportError();
-            return WEBRTC_VIDEO_CODEC_ERROR;
-        }
-
-        // picture setup
+        // picture setup. The planes point into each input frame, so x264 never owns them
+        x264_picture_init(&pictureIn);
+        pictureIn.img.i_csp = encoderParams.i_csp;
         pictureIn.img.i_plane = 3;
 
+        // Carry preset changes over from the encoder this one replaces
+        speedLevel = kDefaultSpeedLevel;
+        if (offlineOptions.speedLevel >= 0) {
+            speedLevel = std::min(offlineOptions.speedLevel, kSpeedLadderSize - 1);
+        } else if (encoderControl) {
+            auto recordedLevel = encoderControl->getSpeedStats().level;
+            if (recordedLevel >= 0 && recordedLevel < kSpeedLadderSize) {
+                speedLevel = recordedLevel;
+            }
+            speedLevel = std::min(speedLevel, maxSpeedLevel());
+        }
+        speedController.reset(std::chrono::microseconds(rtc::TimeMicros()));
+
         // create encoder
-        encoder = x264_encoder_open(&encoderParams);
-        if (!encoder) {
+        if (!openEncoder(&encoderParams)) {
             LOG_ERROR("Failed to open x264 encoder");
-
-            x264_picture_clean(&pictureIn);
-            encoder = nullptr;
+            reportError();
             return WEBRTC_VIDEO_CODEC_ERROR;
         }
+        LOG_DEBUG(
+                "x264 starting with the %s preset and the %s content profile",
+                kSpeedLadder[speedLevel].name,
+                contentTuning->name);
+        if (encoderControl) {
+            encoderControl->recordSpeedLevel(speedLevel);
+        }
 
-        // Initialize encoded image. Default buffer size: size of unencoded data.
-        encodedImage._size =
-                webrtc::CalcBufferSize(webrtc::VideoType::kI420, codecSettings->width, codecSettings->height);
-        encodedImage._buffer = new uint8_t[encodedImage._size];
-        encodedImageBuffer.reset(encodedImage._buffer);
+        // Initialize encoded image. Its buffer is set to x264's output for each frame
+        encodedImage._size = 0;
+        encodedImage._buffer = nullptr;
         encodedImage._completeFrame = true;
         encodedImage._encodedWidth = 0;
         encodedImage._encodedHeight = 0;
         encodedImage._length = 0;
 
+        if (encoderControl) {
+            regionsOfInterest = encoderControl->getRegionsOfInterest(&regionsOfInterestGeneration);
+        }
+        updateQuantOffsets();
+
         frameCount = 0;
+        pendingFrames.clear();
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
+    bool X264Encoder::prepare(int32_t numCores, size_t maxPayloadSize) {
+        if (!encoderControl) {
+            return false;
+        }
+        auto expected = encoderControl->getExpectedVideo();
+        if (expected.width <= 0 || expected.height <= 0 || expected.framerate <= 0) {
+            return false;
+        }
+
+        webrtc::VideoCodec settings;
+        settings.codecType = webrtc::kVideoCodecH264;
+        settings.width = expected.width;
+        settings.height = expected.height;
+        settings.maxFramerate = expected.framerate;
+        settings.startBitrate = expected.maxKbps;
+        settings.maxBitrate = expected.maxKbps;
+        settings.mode = expected.isScreenContent ? webrtc::VideoCodecMode::kScreensharing
+                                                 : webrtc::VideoCodecMode::kRealtimeVideo;
+
+        int64_t openStart = rtc::TimeMicros();
+        if (InitEncode(&settings, numCores, maxPayloadSize) != WEBRTC_VIDEO_CODEC_OK) {
+            LOG_WARNING("Failed to prepare x264 encoder; it will be opened with the first frame");
+            return false;
+        }
+        isPrepared = true;
+        LOG_DEBUG(
+                "Prepared x264 encoder for %dx%d in %lld us",
+                width,
+                height,
+                static_cast<long long>(rtc::TimeMicros() - openStart));
+        return true;
+    }
+
+    int32_t X264Encoder::adoptPreparedEncoder(webrtc::VideoCodec const & codecSettings) {
+        isPrepared = false;
+        maxFrameRate = static_cast<float>(codecSettings.maxFramerate);
+        enableFrameDropping = codecSettings.H264().frameDroppingOn;
+        keyFrameInterval = codecSettings.H264().keyFrameInterval;
+        inputFps = 0;
+
+        // The CRF depends on the bitrate as well as the frame size, so it is updated along with rate control
+        targetKbps = codecSettings.maxBitrate;
+        if (targetKbps != appliedKbps) {
+            x264_param_t encoderParams;
+            x264_encoder_parameters(encoder, &encoderParams);
+            encoderParams.rc.f_rf_constant = chooseCrf(height, targetKbps);
+            encoderParams.rc.i_bitrate = targetKbps;
+            encoderParams.rc.i_vbv_max_bitrate = targetKbps;
+            encoderParams.rc.i_vbv_buffer_size = targetKbps;
+            if (x264_encoder_reconfig(encoder, &encoderParams) < 0) {
+                LOG_WARNING("Failed to apply %u kbps to the prepared x264 encoder", targetKbps);
+            } else {
+                appliedKbps = targetKbps;
+            }
+        }
+
+        // Time spent waiting for the first frame says nothing about the encoder's load
+        speedController.reset(std::chrono::microseconds(rtc::TimeMicros()));
+        LOG_DEBUG("Using the x264 encoder prepared for %dx%d", width, height);
+        return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    // Single-threaded encoding stays the default since multi-threaded may cause some issue on certain CPU and/or
+    // Windows
+    void X264Encoder::applyThreading(x264_param_t * encoderParams) const {
+        EncoderControl::Threading threading{ caff_EncoderThreadingSingle, 0 };
+        if (encoderControl) {
+            threading = encoderControl->getThreading();
+        }
+
+        int32_t cores = std::max(numberOfCores, 1);
+
+        switch (threading.mode) {
+        case caff_EncoderThreadingSliced:
+            encoderParams->i_threads = std::min(cores, kMaxSlicedThreads);
+            encoderParams->b_sliced_threads = 1;
+            break;
+        case caff_EncoderThreadingFrame:
+            // Each frame thread past the first holds back one frame of output
+            encoderParams->i_threads = std::min(cores, threading.maxLatencyFrames + 1);
+            encoderParams->b_sliced_threads = 0;
+            // The zerolatency tune turns these off already; frame threads would otherwise add lookahead delay
+            encoderParams->i_sync_lookahead = 0;
+            encoderParams->rc.i_lookahead = 0;
+            break;
+        case caff_EncoderThreadingSingle:
+        default:
+            encoderParams->i_threads = 1;
+            encoderParams->b_sliced_threads = 0;
+            break;
+        }
+
+        LOG_DEBUG(
+                "x264 using %d %s thread(s) of %d core(s)",
+                encoderParams->i_threads,
+                encoderParams->b_sliced_threads ? "slice" : "frame",
+                cores);
+    }
+
     int32_t X264Encoder::Release() {
         if (encoder) {
             x264_encoder_close(encoder);
@@ -297,9 +510,12 @@ namespace caff {
         }
 
         encodedImage._buffer = nullptr;
-        encodedImageBuffer.reset();
+        encodedImage._size = 0;
+        copyBuffer.clear();
+        copyBuffer.shrink_to_fit();
 
         frameCount = 0;
+        pendingFrames.clear();
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
@@ -308,6 +524,19 @@ namespace caff {
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
+    bool shouldReconfigureBitrate(uint32_t appliedKbps, uint32_t targetKbps) {
+        if (appliedKbps == 0) {
+            return targetKbps != 0;
+        }
+
+        // Drops are applied sooner than raises: overshooting the estimate backs frames up in the pacer, while
+        // undershooting it only costs a little quality until the next step up
+        if (targetKbps < appliedKbps) {
+            return appliedKbps - targetKbps >= appliedKbps * kBitrateDecreaseThreshold;
+        }
+        return targetKbps - appliedKbps >= appliedKbps * kBitrateIncreaseThreshold;
+    }
+
     int32_t X264Encoder::SetRateAllocation(webrtc::BitrateAllocation const & bitrateAllocation, uint32_t framerate) {
         if (bitrateAllocation.get_sum_bps() <= 0 || framerate <= 0) {
             return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
@@ -315,21 +544,33 @@ namespace caff {
 
         targetKbps = bitrateAllocation.get_sum_kbps();
         maxFrameRate = static_cast<float>(framerate);
+        inputFps = framerate;
+        if (encoderControl) {
+            encoderControl->recordRateTarget(static_cast<int32_t>(targetKbps), static_cast<int32_t>(framerate));
+        }
 
-        if (frameCount == 0 || nullptr == encoder) {
-            // Don't adjust the framerate until we start encoding.
-            LOG_DEBUG("No frames encoded or encoder setup yet. Ignore resetting encoder parameters.");
+        if (nullptr == encoder) {
+            LOG_DEBUG("Encoder not set up yet. Ignore resetting encoder parameters.");
             return WEBRTC_VIDEO_CODEC_OK;
         }
 
-        // If incoming fps is greater than high threshold and we still at 30fps, switch to 60fps.
-        if (framerate > kFpsHighThreshold && targetFps == 30) {
+        bool framerateChanged = false;
+        if (frameCount == 0) {
+            // Don't adjust the framerate until we start encoding.
+        } else if (framerate > kFpsHighThreshold && targetFps == 30) {
+            // If incoming fps is greater than high threshold and we still at 30fps, switch to 60fps.
             LOG_DEBUG("Resetting target framerate to 60");
             targetFps = 60;
+            framerateChanged = true;
         } else if (framerate < kFpsLowThreshold && targetFps == 60) {
             LOG_DEBUG("Resetting target framerate to 30");
             targetFps = 30;
-        } else {
+            framerateChanged = true;
+        }
+
+        bool bitrateChanged = shouldReconfigureBitrate(appliedKbps, targetKbps);
+
+        if (!framerateChanged && !bitrateChanged) {
             // No changes needed.
             return WEBRTC_VIDEO_CODEC_OK;
         }
@@ -337,16 +578,26 @@ namespace caff {
         x264_param_t encoderParams;
         x264_encoder_parameters(encoder, &encoderParams);
 
-        // Reset the fps.
         encoderParams.i_fps_num = targetFps;
 
+        if (bitrateChanged) {
+            LOG_DEBUG("Resetting target bitrate from %u to %u kbps", appliedKbps, targetKbps);
+            encoderParams.rc.i_bitrate = targetKbps;
+            encoderParams.rc.i_vbv_max_bitrate = targetKbps;
+            encoderParams.rc.i_vbv_buffer_size = targetKbps;
+            // The CRF depends on the bitrate too, so it is chosen again like when the encoder is opened
+            encoderParams.rc.f_rf_constant = chooseCrf(height, targetKbps);
+        }
+
         int ret = x264_encoder_reconfig(encoder, &encoderParams);
         if (ret < 0) {
             LOG_ERROR("Failed to reconfig encoder; error code: %d", ret);
             return WEBRTC_VIDEO_CODEC_ERR_PARAMETER;
         }
 
-        // TODO: need to change x264 target_bps on the fly?
+        if (bitrateChanged) {
+            appliedKbps = targetKbps;
+        }
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
@@ -366,21 +617,8 @@ namespace caff {
             return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
         }
 
-        // check if frame size has been changed by the AdaptFrame API.
-        if (inputFrame.height() != height) {
-            x264_param_t * encoderParams = nullptr;
-            x264_encoder_parameters(encoder, encoderParams);
-
-            if (nullptr != encoderParams) {
-                encoderParams->rc.f_rf_constant =
-                        (inputFrame.height() < kMaxFrameHeightHighQualityCrf) ? kHighQualityCrf : kNormalQualityCrf;
-
-                int ret = x264_encoder_reconfig(encoder, encoderParams);
-                if (ret < 0) {
-                    LOG_ERROR("Failed to reconfig encoder; error code: %d", ret);
-                }
-            }
-            height = inputFrame.height();
+        if (encoderControl && encoderControl->getContentProfileGeneration() != contentProfileGeneration) {
+            applyContentProfile();
         }
 
         bool forceKeyFrame = false;
@@ -395,45 +633,107 @@ namespace caff {
             forceKeyFrame = (*frameTypes)[0] == webrtc::kVideoFrameKey;
         }
 
+        rtc::scoped_refptr<webrtc::I420BufferInterface const> frameBuffer = inputFrame.video_frame_buffer()->ToI420();
+
+        // The frame size can change without a new InitEncode when quality scaling steps the resolution
+        if (frameBuffer->width() != width || frameBuffer->height() != height) {
+            if (!reopenEncoder(frameBuffer->width(), frameBuffer->height())) {
+                return WEBRTC_VIDEO_CODEC_ERROR;
+            }
+            forceKeyFrame = true;
+        }
+
+        if (encoderControl && encoderControl->getRegionsOfInterestGeneration() != regionsOfInterestGeneration) {
+            regionsOfInterest = encoderControl->getRegionsOfInterest(&regionsOfInterestGeneration);
+            updateQuantOffsets();
+        }
+
         x264_picture_t pictureOut = { 0 };
 
         pictureIn.i_type = forceKeyFrame ? X264_TYPE_IDR : X264_TYPE_AUTO;
 
-        rtc::scoped_refptr<webrtc::I420BufferInterface const> frameBuffer = inputFrame.video_frame_buffer()->ToI420();
-
         pictureIn.img.plane[0] = const_cast<uint8_t *>(frameBuffer->DataY());
         pictureIn.img.plane[1] = const_cast<uint8_t *>(frameBuffer->DataU());
         pictureIn.img.plane[2] = const_cast<uint8_t *>(frameBuffer->DataV());
-        pictureIn.i_pts = frameCount;
+        // Buffers wrapped around application-owned planes may be padded, so strides can change from frame to frame
+        pictureIn.img.i_stride[0] = frameBuffer->StrideY();
+        pictureIn.img.i_stride[1] = frameBuffer->StrideU();
+        pictureIn.img.i_stride[2] = frameBuffer->StrideV();
+        pictureIn.i_pts = nextPts(inputFrame.timestamp_us());
+        attachQuantOffsets();
+
+        pendingFrames.push_back({ pictureIn.i_pts,
+                                  inputFrame.timestamp(),
+                                  inputFrame.ntp_time_ms(),
+                                  inputFrame.render_time_ms(),
+                                  inputFrame.rotation(),
+                                  frameBuffer->width(),
+                                  frameBuffer->height() });
+        ++frameCount;
 
         x264_nal_t * nal = nullptr;
         int32_t numNals = 0;
+        int64_t encodeStart = rtc::TimeMicros();
         int32_t encodedFrameSize = x264_encoder_encode(encoder, &nal, &numNals, &pictureIn, &pictureOut);
+        int64_t encodeEnd = rtc::TimeMicros();
 
         if (encodedFrameSize < 0) {
             LOG_ERROR("x264 frame encoding failed. x264_encoder_encode returned: %d", encodedFrameSize);
             reportError();
             x264_encoder_close(encoder);
             encoder = nullptr;
-            x264_picture_clean(&pictureIn);
+            pendingFrames.clear();
             return WEBRTC_VIDEO_CODEC_ERROR;
         }
+        // x264 applies a reconfig to the next frame it encodes, so a preset change can only be read back after it
+        confirmSpeedLevel();
+
+        // Frames arrive at the rate WebRTC last reported, or x264's target rate before that
+        uint32_t frameRate = inputFps > 0 ? inputFps : targetFps;
+        auto adjustment = speedController.onFrameEncoded(
+                std::chrono::microseconds(encodeEnd),
+                std::chrono::microseconds(encodeEnd - encodeStart),
+                std::chrono::microseconds(1'000'000 / frameRate));
+        if (adjustment != EncoderSpeedController::Adjustment::None && offlineOptions.speedLevel < 0) {
+            adjustSpeed(adjustment);
+        }
 
-        encodedImage._encodedWidth = frameBuffer->width();
-        encodedImage._encodedHeight = frameBuffer->height();
-        encodedImage._timeStamp = inputFrame.timestamp();
-        encodedImage.ntp_time_ms_ = inputFrame.ntp_time_ms();
-        encodedImage.capture_time_ms_ = inputFrame.render_time_ms();
-        encodedImage.rotation_ = inputFrame.rotation();
-        encodedImage.content_type_ = (mode == webrtc::VideoCodecMode::kScreensharing)
-                                             ? webrtc::VideoContentType::SCREENSHARE
-                                             : webrtc::VideoContentType::UNSPECIFIED;
+        // Frame threads hold output back while the pipeline fills; nothing is delivered until then
+        if (numNals == 0) {
+            return WEBRTC_VIDEO_CODEC_OK;
+        }
+
+        return deliverEncodedFrame(nal, numNals, pictureOut);
+    }
+
+    int32_t X264Encoder::deliverEncodedFrame(x264_nal_t * nal, int32_t numNals, x264_picture_t const & pictureOut) {
+        // Without B-frames output stays in input order, so anything older than this picture was dropped by x264
+        while (!pendingFrames.empty() && pendingFrames.front().pts < pictureOut.i_pts) {
+            pendingFrames.pop_front();
+        }
+        if (pendingFrames.empty() || pendingFrames.front().pts != pictureOut.i_pts) {
+            LOG_ERROR("x264 output an unknown frame; pts: %lld", static_cast<long long>(pictureOut.i_pts));
+            reportError();
+            return WEBRTC_VIDEO_CODEC_ERROR;
+        }
+        PendingFrame outputFrame = pendingFrames.front();
+        pendingFrames.pop_front();
+
+        encodedImage._encodedWidth = outputFrame.width;
+        encodedImage._encodedHeight = outputFrame.height;
+        encodedImage._timeStamp = outputFrame.timestamp;
+        encodedImage.ntp_time_ms_ = outputFrame.ntpTimeMs;
+        encodedImage.capture_time_ms_ = outputFrame.renderTimeMs;
+        encodedImage.rotation_ = outputFrame.rotation;
+        encodedImage.content_type_ =
+                isScreenContent() ? webrtc::VideoContentType::SCREENSHARE : webrtc::VideoContentType::UNSPECIFIED;
         encodedImage.timing_.flags = webrtc::VideoSendTiming::kInvalid;
         encodedImage._frameType = ConvertToWebrtcFrameType(pictureOut.i_type);
+        lastFrameQuality = { pictureOut.prop.f_psnr_avg, pictureOut.prop.f_ssim };
 
         // Split encoded image up into fragments. This also updates |encodedImage|.
         webrtc::RTPFragmentationHeader fragHeader;
-        rtpFragmentize(&encodedImage, &encodedImageBuffer, *frameBuffer, numNals, nal, &fragHeader);
+        rtpFragmentize(&encodedImage, &copyBuffer, static_cast<uint32_t>(numNals), nal, &fragHeader);
 
         // Encoder can skip frames to save bandwidth in which case
         // |encodedImage._length| == 0.
@@ -446,13 +746,232 @@ namespace caff {
             webrtc::CodecSpecificInfo codecSpecificInfo;
             codecSpecificInfo.codecType = webrtc::kVideoCodecH264;
             codecSpecificInfo.codecSpecific.H264.packetization_mode = packetizationMode;
+            if (encoderControl) {
+                encoderControl->recordFrameEncoded();
+            }
             encodedImageCallback->OnEncodedImage(encodedImage, &codecSpecificInfo, &fragHeader);
         }
-        ++frameCount;
 
         return WEBRTC_VIDEO_CODEC_OK;
     }
 
+    void X264Encoder::flushDelayedFrames() {
+        if (!encoder || !encodedImageCallback) {
+            pendingFrames.clear();
+            return;
+        }
+
+        while (x264_encoder_delayed_frames(encoder) > 0) {
+            x264_picture_t pictureOut = { 0 };
+            x264_nal_t * nal = nullptr;
+            int32_t numNals = 0;
+            if (x264_encoder_encode(encoder, &nal, &numNals, nullptr, &pictureOut) < 0) {
+                break;
+            }
+            if (numNals > 0) {
+                deliverEncodedFrame(nal, numNals, pictureOut);
+            }
+        }
+        pendingFrames.clear();
+    }
+
+    int64_t X264Encoder::nextPts(int64_t timestampUs) {
+        if (frameCount == 0) {
+            firstTimestampUs = timestampUs;
+            lastPts = 0;
+            return 0;
+        }
+
+        // x264 needs strictly increasing pts. A frame that doesn't move forward in time is placed one nominal frame
+        // interval after the last, rather than a microsecond after it, which would tell rate control it was tiny
+        int64_t pts = timestampUs - firstTimestampUs;
+        if (pts <= lastPts) {
+            pts = lastPts + 1'000'000 / targetFps;
+        }
+        lastPts = pts;
+        return pts;
+    }
+
+    bool X264Encoder::openEncoder(x264_param_t * encoderParams) {
+        requestedSpeedLevel = -1;
+        applySpeedLevel(encoderParams, speedLevel);
+        int frameReference = encoderParams->i_frame_reference;
+        encoderParams->i_frame_reference = kMaxSpeedLadderReferences;
+
+        encoder = x264_encoder_open(encoderParams);
+        if (!encoder) {
+            return false;
+        }
+        ++openCount;
+
+        encoderParams->i_frame_reference = frameReference;
+        if (x264_encoder_reconfig(encoder, encoderParams) < 0) {
+            LOG_WARNING("Failed to apply the %s preset", kSpeedLadder[speedLevel].name);
+        }
+        return true;
+    }
+
+    void X264Encoder::adjustSpeed(EncoderSpeedController::Adjustment adjustment) {
+        bool const isFaster = adjustment == EncoderSpeedController::Adjustment::Faster;
+        int32_t newLevel = speedLevel + (isFaster ? -1 : 1);
+        if (newLevel < 0 || newLevel > maxSpeedLevel()) {
+            return;
+        }
+
+        LOG_DEBUG("x264 encode load %.2f", speedController.getLoad());
+        requestSpeedLevel(newLevel);
+    }
+
+    void X264Encoder::requestSpeedLevel(int32_t newLevel) {
+        x264_param_t encoderParams;
+        x264_encoder_parameters(encoder, &encoderParams);
+        applySpeedLevel(&encoderParams, newLevel);
+
+        int ret = x264_encoder_reconfig(encoder, &encoderParams);
+        if (ret < 0) {
+            LOG_ERROR("Failed to reconfig encoder; error code: %d", ret);
+            return;
+        }
+        requestedSpeedLevel = newLevel;
+    }
+
+    void X264Encoder::confirmSpeedLevel() {
+        if (requestedSpeedLevel < 0) {
+            return;
+        }
+        int32_t newLevel = requestedSpeedLevel;
+        requestedSpeedLevel = -1;
+
+        x264_param_t encoderParams;
+        x264_encoder_parameters(encoder, &encoderParams);
+        if (!isAtSpeedLevel(encoderParams, newLevel)) {
+            LOG_WARNING(
+                    "x264 did not switch from the %s to the %s preset",
+                    kSpeedLadder[speedLevel].name,
+                    kSpeedLadder[newLevel].name);
+            return;
+        }
+
+        LOG_DEBUG("x264 switched preset from %s to %s", kSpeedLadder[speedLevel].name, kSpeedLadder[newLevel].name);
+        RTC_HISTOGRAM_ENUMERATION(
+                "WebRTC.Video.X264Encoder.Event",
+                newLevel < speedLevel ? kX264EncoderEventSpeedUp : kX264EncoderEventSpeedDown,
+                kX264EncoderEventMax);
+        speedLevel = newLevel;
+        if (encoderControl) {
+            encoderControl->recordSpeedLevel(speedLevel);
+        }
+    }
+
+    int32_t X264Encoder::maxSpeedLevel() const {
+        return std::min(contentTuning->maxSpeedLevel, kSpeedLadderSize - 1);
+    }
+
+    float X264Encoder::chooseCrf(int frameHeight, uint32_t kbps) const {
+        if (offlineOptions.crf > 0.0f) {
+            return offlineOptions.crf;
+        }
+        return crfFor(frameHeight, kbps) + contentTuning->crfOffset;
+    }
+
+    void X264Encoder::loadContentProfile() {
+        auto profile = caff_ContentProfileDefault;
+        if (encoderControl) {
+            profile = encoderControl->getContentProfile(&contentProfileGeneration);
+        }
+        // WebRTC switches the mode with a new InitEncode, so the generation is still tracked for when it switches back
+        contentTuning = isScreenContent() ? &screenContentTuning() : &contentTuningFor(profile);
+    }
+
+    bool X264Encoder::isScreenContent() const { return mode == webrtc::VideoCodecMode::kScreensharing; }
+
+    void X264Encoder::applyContentProfile() {
+        auto previousName = contentTuning->name;
+        loadContentProfile();
+
+        // Quality target and preset change in place. AQ strength is fixed once x264 is open, so it waits for the
+        // next reopen
+        x264_param_t encoderParams;
+        x264_encoder_parameters(encoder, &encoderParams);
+        encoderParams.rc.f_rf_constant = chooseCrf(height, appliedKbps);
+        int32_t newLevel = std::min(speedLevel, maxSpeedLevel());
+        applySpeedLevel(&encoderParams, newLevel);
+
+        int ret = x264_encoder_reconfig(encoder, &encoderParams);
+        if (ret < 0) {
+            LOG_ERROR("Failed to reconfig encoder; error code: %d", ret);
+            return;
+        }
+
+        LOG_DEBUG(
+                "x264 switching from the %s to the %s content profile (crf %.1f, %s preset)",
+                previousName,
+                contentTuning->name,
+                encoderParams.rc.f_rf_constant,
+                kSpeedLadder[newLevel].name);
+        if (newLevel != speedLevel) {
+            requestedSpeedLevel = newLevel;
+            speedController.reset(std::chrono::microseconds(rtc::TimeMicros()));
+        }
+    }
+
+    bool X264Encoder::reopenEncoder(int newWidth, int newHeight) {
+        LOG_DEBUG("Reopening x264 encoder for %dx%d (was %dx%d)", newWidth, newHeight, width, height);
+        flushDelayedFrames();
+
+        // x264_encoder_reconfig can't change the frame size, but the open encoder's parameters already carry every
+        // setting made since InitEncode, including rate control
+        x264_param_t encoderParams;
+        x264_encoder_parameters(encoder, &encoderParams);
+        x264_encoder_close(encoder);
+
+        encoderParams.i_width = newWidth;
+        encoderParams.i_height = newHeight;
+        encoderParams.rc.f_rf_constant = chooseCrf(newHeight, appliedKbps);
+        // A content profile change since x264 was opened may have left this pending
+        encoderParams.rc.f_aq_strength = contentTuning->aqStrength;
+
+        if (!openEncoder(&encoderParams)) {
+            LOG_ERROR("Failed to reopen x264 encoder for %dx%d", newWidth, newHeight);
+            reportError();
+            return false;
+        }
+
+        width = newWidth;
+        height = newHeight;
+        updateQuantOffsets();
+        return true;
+    }
+
+    void X264Encoder::updateQuantOffsets() {
+        int const macroblockSize = 16;
+        int mbWidth = (width + macroblockSize - 1) / macroblockSize;
+        int mbHeight = (height + macroblockSize - 1) / macroblockSize;
+        quantOffsets = computeQuantOffsets(regionsOfInterest, mbWidth, mbHeight);
+    }
+
+    void X264Encoder::attachQuantOffsets() {
+        // x264 turns the offsets into per-macroblock quantizers inside the x264_encoder_encode call that takes the
+        // picture, before handing it to a frame thread, so it can read them straight from |quantOffsets|
+        pictureIn.prop.quant_offsets = quantOffsets.empty() ? nullptr : quantOffsets.data();
+        pictureIn.prop.quant_offsets_free = nullptr;
+    }
+
+    void X264Encoder::setOfflineOptions(OfflineOptions const & options) { offlineOptions = options; }
+
+    X264Encoder::FrameQuality X264Encoder::getLastFrameQuality() const { return lastFrameQuality; }
+
+    uint64_t X264Encoder::getOpenCount() const { return openCount; }
+
+    float X264Encoder::getCrf() const {
+        if (!encoder) {
+            return 0.0f;
+        }
+        x264_param_t encoderParams;
+        x264_encoder_parameters(encoder, &encoderParams);
+        return encoderParams.rc.f_rf_constant;
+    }
+
     char const * X264Encoder::ImplementationName() const {
         // implementation name.
         return "libx264";
@@ -482,7 +1001,6 @@ namespace caff {
     int32_t X264Encoder::SetChannelParameters(uint32_t packetLoss, int64_t rtt) { return WEBRTC_VIDEO_CODEC_OK; }
 
     webrtc::VideoEncoder::ScalingSettings X264Encoder::GetScalingSettings() const {
-        static constexpr auto kOffScalingSettings = webrtc::VideoEncoder::ScalingSettings::kOff;
-        return kOffScalingSettings;
+        return webrtc::VideoEncoder::ScalingSettings(kLowH264QpThreshold, kHighH264QpThreshold, kMinScaledPixels);
     }
 } // namespace caff
@@ -3,21 +3,57 @@
 #define X264ENCODER_H_
 
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "ContentProfile.hpp"
+#include "EncoderControl.hpp"
+#include "EncoderSpeedController.hpp"
 
 #include "common_video/h264/h264_bitstream_parser.h"
+#include "media/base/h264_profile_level_id.h"
 #include "modules/video_coding/codecs/h264/include/h264.h"
 
 #include "x264.h"
 
 namespace caff {
 
+    // Whether a change in target bitrate from |appliedKbps| is big enough to reconfigure the encoder for
+    bool shouldReconfigureBitrate(uint32_t appliedKbps, uint32_t targetKbps);
+
+    // Points |encodedImage| at the NAL units x264 output with the size prefixes of length-prefixed (non Annex B) output
+    // replaced by start codes, and describes each NAL unit in |fragHeader|. The image is only valid until the next call
+    // to x264_encoder_encode. If the NAL units are not back to back they are copied into |copyBuffer| instead
+    void rtpFragmentize(
+            webrtc::EncodedImage * encodedImage,
+            std::vector<uint8_t> * copyBuffer,
+            uint32_t numNals,
+            x264_nal_t * nal,
+            webrtc::RTPFragmentationHeader * fragHeader);
+
+    // Number of levels in the preset ladder the encoder moves along to fit the CPU time available, fastest first
+    int32_t speedLadderSize();
+
+    // Sets the parts of |encoderParams| that make up preset ladder level |speedLevel|
+    void applySpeedLevel(x264_param_t * encoderParams, int32_t speedLevel);
+
+    // Whether |encoderParams|, as read back from an open encoder, are at preset ladder level |speedLevel|
+    bool isAtSpeedLevel(x264_param_t const & encoderParams, int32_t speedLevel);
+
     class X264Encoder : public webrtc::H264Encoder {
     public:
-        explicit X264Encoder(cricket::VideoCodec const & codec);
+        // |encoderControl| may be null, in which case the encoder uses its defaults
+        X264Encoder(cricket::VideoCodec const & codec, std::shared_ptr<EncoderControl> encoderControl);
         virtual ~X264Encoder();
 
         virtual int32_t InitEncode(
                 webrtc::VideoCodec const * codec_settings, int32_t number_of_cores, size_t max_payload_size) override;
+
+        // Opens x264 with the settings in EncoderControl::getExpectedVideo, ahead of WebRTC's InitEncode, which only
+        // comes with the first frame. If InitEncode then asks for the same frame size, mode, cores and payload size,
+        // the open encoder is kept and only its bitrate is updated
+        bool prepare(int32_t numCores, size_t maxPayloadSize);
         virtual int32_t Release() override;
 
         virtual int32_t RegisterEncodeCompleteCallback(webrtc::EncodedImageCallback * callback) override;
@@ -35,9 +71,74 @@ namespace caff {
 
         virtual int32_t SetChannelParameters(uint32_t packet_loss, int64_t rtt) override;
 
+        // Fixed settings for measuring the encoder outside a broadcast, e.g. in benchmarks. Set before InitEncode
+        struct OfflineOptions {
+            int32_t speedLevel = -1;      // preset ladder level to hold, or -1 to adapt to the CPU time available
+            float crf = 0.0f;             // CRF to use, or 0 to choose one from the resolution and bitrate
+            bool measureQuality = false;  // have x264 compute PSNR and SSIM of each frame against its input
+        };
+        void setOfflineOptions(OfflineOptions const & options);
+
+        // PSNR (dB) and SSIM of the frame most recently passed to the callback. Only set with measureQuality
+        struct FrameQuality {
+            double psnr;
+            double ssim;
+        };
+        FrameQuality getLastFrameQuality() const;
+
+        // Times x264 has been opened, including by prepare. A prepared encoder that InitEncode keeps doesn't count again
+        uint64_t getOpenCount() const;
+
+        // CRF the open x264 encoder is configured with, or 0 when it is closed
+        float getCrf() const;
+
     private:
-        bool isInitialized() const;
+        // What the callback needs to know about a frame once x264 outputs it. With frame threads, output lags input
+        struct PendingFrame {
+            int64_t pts;
+            uint32_t timestamp;
+            int64_t ntpTimeMs;
+            int64_t renderTimeMs;
+            webrtc::VideoRotation rotation;
+            int width;
+            int height;
+        };
 
+        bool isInitialized() const;
+        // Takes over the encoder opened by prepare for WebRTC's |codecSettings|
+        int32_t adoptPreparedEncoder(webrtc::VideoCodec const & codecSettings);
+        void applyThreading(x264_param_t * encoderParams) const;
+
+        int32_t deliverEncodedFrame(x264_nal_t * nal, int32_t numNals, x264_picture_t const & pictureOut);
+        // Drains frames still inside x264's frame threads so they are not lost when the encoder closes
+        void flushDelayedFrames();
+        // Closes and reopens x264 for a new frame size, keeping every other setting
+        bool reopenEncoder(int newWidth, int newHeight);
+        // Converts a capture time to x264's microsecond timebase, relative to the first frame
+        int64_t nextPts(int64_t timestampUs);
+        // Opens x264 with |encoderParams| at the current speed level
+        bool openEncoder(x264_param_t * encoderParams);
+        // Moves one step along the preset ladder
+        void adjustSpeed(EncoderSpeedController::Adjustment adjustment);
+        // Reconfigures x264 for preset ladder level |newLevel|. The level only counts once confirmSpeedLevel sees it
+        void requestSpeedLevel(int32_t newLevel);
+        // Adopts the requested preset ladder level if x264 actually switched to it
+        void confirmSpeedLevel();
+        // Slowest preset ladder level the current content profile allows
+        int32_t maxSpeedLevel() const;
+        float chooseCrf(int frameHeight, uint32_t kbps) const;
+        // Reads the current game's content profile from |encoderControl|, or the screen content tuning while WebRTC has
+        // the encoder in screensharing mode
+        void loadContentProfile();
+        bool isScreenContent() const;
+        // Switches the open encoder to a content profile that changed mid-broadcast
+        void applyContentProfile();
+        // Rebuilds the quantizer offsets from |regionsOfInterest| at the current frame size
+        void updateQuantOffsets();
+        // Points |pictureIn| at the quantizer offsets, if there are any
+        void attachQuantOffsets();
+
+        std::shared_ptr<EncoderControl> encoderControl;
         webrtc::H264BitstreamParser bitstreamParser;
 
         void reportInit();
@@ -50,25 +151,47 @@ namespace caff {
         int height = 0;
         float maxFrameRate = 0.0f;
         uint32_t targetKbps = 0;
+        uint32_t appliedKbps = 0;  // bitrate x264's rate control was last configured with
         uint32_t targetFps = 30;
+        uint32_t inputFps = 0;  // last framerate passed to SetRateAllocation
         webrtc::VideoCodecMode mode = webrtc::VideoCodecMode::kRealtimeVideo;
 
         // H.264 specifc parameters
         bool enableFrameDropping = false;
         int keyFrameInterval = 0;
         webrtc::H264PacketizationMode packetizationMode = webrtc::H264PacketizationMode::SingleNalUnit;
+        webrtc::H264::Profile profile = webrtc::H264::kProfileConstrainedBaseline;
 
         size_t maxPayloadSize = 0;
         int32_t numberOfCores = 0;
 
         webrtc::EncodedImage encodedImage;
-        std::unique_ptr<uint8_t[]> encodedImageBuffer;
+        std::vector<uint8_t> copyBuffer;  // only used if x264's output is not contiguous
         webrtc::EncodedImageCallback * encodedImageCallback = nullptr;
 
+        bool isPrepared = false;  // opened by prepare and not yet initialized by WebRTC
         bool hasReportedInit = false;
         bool hasReportedError = false;
 
+        uint64_t openCount = 0;
         uint64_t frameCount = 0;
+        std::deque<PendingFrame> pendingFrames;
+        int64_t firstTimestampUs = 0;
+        int64_t lastPts = 0;
+
+        OfflineOptions offlineOptions;
+        FrameQuality lastFrameQuality{ 0.0, 0.0 };
+
+        EncoderSpeedController speedController;
+        int32_t speedLevel = 0;  // index into the preset ladder; see X264Encoder.cpp
+        int32_t requestedSpeedLevel = -1;  // level x264 was reconfigured for but not yet confirmed at, or -1
+
+        ContentTuning const * contentTuning = &contentTuningFor(caff_ContentProfileDefault);
+        uint64_t contentProfileGeneration = 0;
+
+        std::vector<caff_VideoRegion> regionsOfInterest;
+        uint64_t regionsOfInterestGeneration = 0;
+        std::vector<float> quantOffsets;  // one per macroblock, or empty
     };
 
 }  // namespace caff
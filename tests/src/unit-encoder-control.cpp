@@ -0,0 +1,107 @@
+#include "doctest.h"
+
+#include "ContentProfile.hpp"
+#include "EncoderControl.hpp"
+
+using namespace caff;
+
+TEST_CASE("Content profile follows the current game") {
+    EncoderControl control;
+    uint64_t generation = 0;
+    CHECK(control.getContentProfile(&generation) == caff_ContentProfileDefault);
+    auto const initialGeneration = generation;
+
+    control.setGameContentProfile("shooter", caff_ContentProfileFastMotion);
+    control.setGameContentProfile("cards", caff_ContentProfileStatic);
+    CHECK(control.getContentProfileGeneration() == initialGeneration);
+
+    control.setCurrentGame("shooter");
+    CHECK(control.getContentProfile(&generation) == caff_ContentProfileFastMotion);
+    CHECK(generation != initialGeneration);
+
+    SUBCASE("switching games changes the profile") {
+        control.setCurrentGame("cards");
+        auto previousGeneration = generation;
+        CHECK(control.getContentProfile(&generation) == caff_ContentProfileStatic);
+        CHECK(generation != previousGeneration);
+    }
+
+    SUBCASE("games without a profile use the default") {
+        control.setCurrentGame("unknown");
+        CHECK(control.getContentProfile(&generation) == caff_ContentProfileDefault);
+    }
+
+    SUBCASE("changing the current game's profile applies immediately") {
+        control.setGameContentProfile("shooter", caff_ContentProfileStatic);
+        CHECK(control.getContentProfile(&generation) == caff_ContentProfileStatic);
+    }
+
+    SUBCASE("a game with the same profile keeps the generation") {
+        control.setGameContentProfile("racer", caff_ContentProfileFastMotion);
+        control.setCurrentGame("racer");
+        CHECK(control.getContentProfileGeneration() == generation);
+    }
+}
+
+TEST_CASE("Every content profile has tuning") {
+    for (int profile = 0; profile <= caff_ContentProfileLast; ++profile) {
+        auto const & tuning = contentTuningFor(static_cast<caff_ContentProfile>(profile));
+        CHECK(tuning.name != nullptr);
+        CHECK(tuning.maxSpeedLevel >= 0);
+        CHECK(tuning.maxFramerate >= 0);
+    }
+}
+
+TEST_CASE("First frame latency runs from the first frame sent to the first frame encoded") {
+    EncoderControl control;
+    CHECK(control.getFirstFrameLatency().count() == -1);
+
+    // Output before anything was sent, e.g. from a previous broadcast's encoder, is ignored
+    control.recordFrameEncoded();
+    CHECK(control.getFirstFrameLatency().count() == -1);
+
+    control.recordFrameSent();
+    control.recordFrameSent();
+    CHECK(control.getFirstFrameLatency().count() == -1);
+    control.recordFrameEncoded();
+    CHECK(control.getFirstFrameLatency().count() >= 0);
+
+    SUBCASE("and starts over with each broadcast") {
+        control.resetFirstFrameLatency();
+        CHECK(control.getFirstFrameLatency().count() == -1);
+        control.recordFrameSent();
+        control.recordFrameEncoded();
+        CHECK(control.getFirstFrameLatency().count() >= 0);
+    }
+}
+
+TEST_CASE("Encoded video mode holds for the whole broadcast") {
+    EncoderControl control;
+    control.setEncodedVideo(true, nullptr, nullptr);
+    CHECK_FALSE(control.isEncodedVideoEnabled());
+
+    control.latchEncodedVideo();
+    CHECK(control.isEncodedVideoEnabled());
+
+    // Turned off mid-broadcast, e.g. before WebRTC recreates the encoder
+    control.setEncodedVideo(false, nullptr, nullptr);
+    CHECK(control.isEncodedVideoEnabled());
+
+    control.latchEncodedVideo();
+    CHECK_FALSE(control.isEncodedVideoEnabled());
+}
+
+TEST_CASE("Rate target follows the encoder until the next broadcast") {
+    EncoderControl control;
+    CHECK(control.getRateTarget().kbps == 0);
+    CHECK(control.getRateTarget().framerate == 0);
+
+    control.recordRateTarget(2000, 30);
+    control.recordRateTarget(1200, 24);
+    CHECK(control.getRateTarget().kbps == 1200);
+    CHECK(control.getRateTarget().framerate == 24);
+
+    control.resetRateTarget();
+    CHECK(control.getRateTarget().kbps == 0);
+    CHECK(control.getRateTarget().framerate == 0);
+}
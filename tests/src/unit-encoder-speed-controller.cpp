@@ -0,0 +1,59 @@
+#include "doctest.h"
+
+#include "EncoderSpeedController.hpp"
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    using Adjustment = EncoderSpeedController::Adjustment;
+
+    auto constexpr frameInterval = 16667us;
+
+    // Feeds frames at 60 fps that each take |encodeTime| until one asks for a change or |count| have gone by
+    Adjustment feed(
+            EncoderSpeedController & controller,
+            std::chrono::microseconds & now,
+            int count,
+            std::chrono::microseconds encodeTime) {
+        for (int i = 0; i < count; ++i) {
+            auto adjustment = controller.onFrameEncoded(now, encodeTime, frameInterval);
+            now += frameInterval;
+            if (adjustment != Adjustment::None) {
+                return adjustment;
+            }
+        }
+        return Adjustment::None;
+    }
+} // namespace
+
+TEST_CASE("Speed controller waits for the load to settle after a reset") {
+    EncoderSpeedController controller;
+    auto now = 1s + 0us;
+    CHECK(feed(controller, now, 60 * 2, 16ms) == Adjustment::None);
+    CHECK(feed(controller, now, 1, 16ms) == Adjustment::Faster);
+
+    SUBCASE("and measures the new preset afresh") {
+        CHECK(controller.getLoad() == 0.0);
+        CHECK(feed(controller, now, 60 * 2 - 1, 16ms) == Adjustment::None);
+        CHECK(feed(controller, now, 1, 16ms) == Adjustment::Faster);
+    }
+
+    SUBCASE("even when frames arrive slowly") {
+        auto const slowInterval = 100ms;
+        controller.reset(now);
+        for (int i = 0; i < 29; ++i) {
+            CHECK(controller.onFrameEncoded(now, 95ms, slowInterval) == Adjustment::None);
+            now += slowInterval;
+        }
+        CHECK(controller.onFrameEncoded(now, 95ms, slowInterval) == Adjustment::Faster);
+    }
+}
+
+TEST_CASE("Speed controller maps a high load to a faster preset and a sustained low one to a slower preset") {
+    EncoderSpeedController controller;
+    auto now = 1s + 0us;
+    CHECK(feed(controller, now, 60 * 60, 10ms) == Adjustment::None);
+    CHECK(feed(controller, now, 60 * 11, 4ms) == Adjustment::Slower);
+    CHECK(feed(controller, now, 60 * 3, 16ms) == Adjustment::Faster);
+}
@@ -0,0 +1,130 @@
+#include "doctest.h"
+
+#include "FrameCadence.hpp"
+
+#include <algorithm>
+#include <vector>
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    // Feeds |count| frames at |sourceFps| with a repeating jitter pattern, and returns which ones were accepted
+    std::vector<bool> run(
+            FrameCadence & cadence, double sourceFps, int count, std::vector<int64_t> jitterMicros = { 0 }) {
+        std::vector<bool> accepted;
+        for (int i = 0; i < count; ++i) {
+            auto ideal = static_cast<int64_t>(1'000'000 + i * 1'000'000 / sourceFps);
+            auto timestamp = std::chrono::microseconds(ideal + jitterMicros[i % jitterMicros.size()]);
+            std::chrono::microseconds smoothed;
+            accepted.push_back(cadence.acceptFrame(timestamp, &smoothed));
+        }
+        return accepted;
+    }
+
+    // True if accepted frames alternate with single dropped frames throughout
+    bool isEveryOtherFrame(std::vector<bool> const & accepted) {
+        for (size_t i = 1; i < accepted.size(); ++i) {
+            if (accepted[i] == accepted[i - 1]) {
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace
+
+TEST_CASE("Frame cadence passes a matching source through") {
+    FrameCadence cadence(30);
+    auto accepted = run(cadence, 30, 300, { 0, 3000, -2000, 1000 });
+    CHECK(std::count(accepted.begin(), accepted.end(), true) == 300);
+    CHECK(cadence.getStats().lateFrames == 0);
+}
+
+TEST_CASE("Frame cadence halves a 60 Hz source evenly") {
+    FrameCadence cadence(30);
+    CHECK(isEveryOtherFrame(run(cadence, 60, 600)));
+
+    auto stats = cadence.getStats();
+    CHECK(stats.acceptedFrames == 300);
+    CHECK(stats.decimatedFrames == 300);
+    CHECK(stats.lateFrames == 0);
+}
+
+TEST_CASE("Frame cadence halves a 59.94 Hz source evenly") {
+    FrameCadence cadence(30);
+    CHECK(isEveryOtherFrame(run(cadence, 60000.0 / 1001, 1200)));
+}
+
+TEST_CASE("Frame cadence is not thrown off by timestamp jitter") {
+    FrameCadence cadence(30);
+    CHECK(isEveryOtherFrame(run(cadence, 60, 600, { 0, 4000, -3000, 2500, -4000, 1000 })));
+    CHECK(cadence.getStats().lateFrames == 0);
+}
+
+TEST_CASE("Frame cadence counts frames that miss their tick as late") {
+    FrameCadence cadence(30);
+    std::chrono::microseconds smoothed;
+    CHECK(cadence.acceptFrame(1'000'000us, &smoothed));
+    CHECK(cadence.acceptFrame(1'033'333us, &smoothed));
+    CHECK(cadence.acceptFrame(1'133'333us, &smoothed));
+    CHECK(cadence.getStats().lateFrames == 1);
+    CHECK(cadence.acceptFrame(1'166'666us, &smoothed));
+    CHECK(cadence.getStats().lateFrames == 1);
+}
+
+TEST_CASE("Frame cadence restarts its clock after a long gap") {
+    FrameCadence cadence(30);
+    run(cadence, 60, 60);
+
+    std::chrono::microseconds smoothed;
+    CHECK(cadence.acceptFrame(10s, &smoothed));
+    CHECK(smoothed == 10s);
+    CHECK(cadence.getStats().lateFrames == 0);
+}
+
+TEST_CASE("Frame cadence restarts its clock when timestamps go backwards") {
+    FrameCadence cadence(30);
+    run(cadence, 60, 60);
+
+    std::chrono::microseconds smoothed;
+    CHECK(cadence.acceptFrame(100ms, &smoothed));
+    CHECK(smoothed == 100ms);
+}
+
+TEST_CASE("Frame cadence decimates repeated and slightly earlier timestamps") {
+    FrameCadence cadence(30);
+    run(cadence, 30, 30);
+    auto const before = cadence.getStats();
+
+    // The last frame of the run was at 1s + 29 / 30 s
+    std::chrono::microseconds smoothed;
+    for (int i = 0; i < 10; ++i) {
+        CHECK_FALSE(cadence.acceptFrame(1'966'666us, &smoothed));
+    }
+    CHECK_FALSE(cadence.acceptFrame(1'960'000us, &smoothed));
+
+    auto const after = cadence.getStats();
+    CHECK(after.acceptedFrames == before.acceptedFrames);
+    CHECK(after.decimatedFrames == before.decimatedFrames + 11);
+
+    SUBCASE("and picks up again at the next tick") {
+        CHECK(cadence.acceptFrame(2'000'000us, &smoothed));
+    }
+}
+
+TEST_CASE("Frame cadence doesn't count frames from a slower source as late") {
+    FrameCadence cadence(30);
+    auto accepted = run(cadence, 24, 240, { 0, 2000, -1500, 1000 });
+    CHECK(std::count(accepted.begin(), accepted.end(), true) == 240);
+    CHECK(cadence.getStats().lateFrames == 0);
+
+    SUBCASE("but does once the source speeds up and then stalls") {
+        std::chrono::microseconds smoothed;
+        std::chrono::microseconds timestamp = 20s;
+        for (int i = 0; i < 60; ++i, timestamp += 16667us) {
+            cadence.acceptFrame(timestamp, &smoothed);
+        }
+        CHECK(cadence.acceptFrame(timestamp + 100ms, &smoothed));
+        CHECK(cadence.getStats().lateFrames == 1);
+    }
+}
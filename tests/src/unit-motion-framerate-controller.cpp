@@ -0,0 +1,38 @@
+#include "doctest.h"
+
+#include "MotionFramerateController.hpp"
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    auto constexpr frameInterval = 16667us;
+} // namespace
+
+TEST_CASE("Motion framerate controller starts at full framerate, lowers it when calm and raises it on motion") {
+    MotionFramerateController controller;
+    auto now = 1s + 0us;
+    CHECK(controller.isHighMotion());
+    for (auto end = now + 5s; now < end; now += frameInterval) {
+        controller.onFrame(now, 0.0);
+    }
+    CHECK_FALSE(controller.isHighMotion());
+    for (auto end = now + 1s; now < end; now += frameInterval) {
+        controller.onFrame(now, 8.0);
+    }
+    CHECK(controller.isHighMotion());
+}
+
+TEST_CASE("Motion framerate controller measures motion per second") {
+    MotionFramerateController first;
+    MotionFramerateController second;
+    auto now = 1s + 0us;
+    for (int i = 0; i < 120; ++i) {
+        first.onFrame(now, 2.0);
+        if (i % 2 == 0) {
+            second.onFrame(now, 4.0);
+        }
+        now += frameInterval;
+    }
+    CHECK(first.getMotion() == doctest::Approx(second.getMotion()).epsilon(0.05));
+}
@@ -0,0 +1,164 @@
+#include "doctest.h"
+
+#include "PassthroughEncoder.hpp"
+
+#include <vector>
+
+#include "media/base/mediaconstants.h"
+#include "rtc_base/refcountedobject.h"
+
+using namespace caff;
+
+namespace {
+    int constexpr width = 1280;
+    int constexpr height = 720;
+
+    class FrameCallback : public webrtc::EncodedImageCallback {
+    public:
+        virtual Result OnEncodedImage(
+                webrtc::EncodedImage const & encodedImage,
+                webrtc::CodecSpecificInfo const * codecSpecificInfo,
+                webrtc::RTPFragmentationHeader const * fragmentation) override {
+            frameTypes.push_back(encodedImage._frameType);
+            fragmentLengths.clear();
+            for (size_t i = 0; i < fragmentation->fragmentationVectorSize; ++i) {
+                fragmentLengths.push_back(fragmentation->fragmentationLength[i]);
+            }
+            return Result(Result::OK);
+        }
+
+        std::vector<webrtc::FrameType> frameTypes;
+        std::vector<size_t> fragmentLengths;  // of the last frame
+    };
+
+    void countRequest(void * userData) { ++*static_cast<int *>(userData); }
+
+    // An SPS with a 4 byte start code, then a slice with a 3 byte one
+    std::vector<uint8_t> const accessUnit = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f, 0, 0, 1, 0x65, 0x88, 0x84, 0x00 };
+
+    webrtc::VideoFrame encodedFrame(bool isKeyFrame, uint64_t frameNumber) {
+        rtc::scoped_refptr<EncodedVideoBuffer> buffer(new rtc::RefCountedObject<EncodedVideoBuffer>(
+                accessUnit.data(), accessUnit.size(), width, height, isKeyFrame, frameNumber));
+        webrtc::VideoFrame frame(buffer, webrtc::kVideoRotation_0, static_cast<int64_t>(frameNumber) * 33'333);
+        frame.set_timestamp(static_cast<uint32_t>(frameNumber) * 3000);
+        return frame;
+    }
+
+    cricket::VideoCodec packetizationModeOne() {
+        cricket::VideoCodec codec(cricket::kH264CodecName);
+        codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+        return codec;
+    }
+
+    struct Fixture {
+        Fixture() {
+            encoderControl->setEncodedVideo(true, countRequest, &keyFrameRequests);
+            encoder.RegisterEncodeCompleteCallback(&callback);
+
+            webrtc::VideoCodec settings;
+            settings.codecType = webrtc::kVideoCodecH264;
+            settings.width = width;
+            settings.height = height;
+            settings.maxFramerate = 30;
+            REQUIRE(encoder.InitEncode(&settings, 1, 1200) == WEBRTC_VIDEO_CODEC_OK);
+        }
+
+        void send(bool isKeyFrame, uint64_t frameNumber) {
+            REQUIRE(encoder.Encode(encodedFrame(isKeyFrame, frameNumber), nullptr, nullptr) == WEBRTC_VIDEO_CODEC_OK);
+        }
+
+        int keyFrameRequests = 0;
+        std::shared_ptr<EncoderControl> encoderControl = std::make_shared<EncoderControl>();
+        PassthroughEncoder encoder{ packetizationModeOne(), encoderControl };
+        FrameCallback callback;
+    };
+} // namespace
+
+TEST_CASE_FIXTURE(Fixture, "Passthrough sends access units split at start codes") {
+    send(true, 0);
+    send(false, 1);
+
+    REQUIRE(callback.frameTypes.size() == 2);
+    CHECK(callback.frameTypes[0] == webrtc::kVideoFrameKey);
+    CHECK(callback.frameTypes[1] == webrtc::kVideoFrameDelta);
+    REQUIRE(callback.fragmentLengths.size() == 2);
+    CHECK(callback.fragmentLengths[0] == 4);
+    CHECK(callback.fragmentLengths[1] == 4);
+    CHECK(keyFrameRequests == 0);
+}
+
+TEST_CASE_FIXTURE(Fixture, "Passthrough waits for a key frame to start") {
+    send(false, 0);
+    send(false, 1);
+    CHECK(callback.frameTypes.empty());
+    CHECK(keyFrameRequests == 1);
+
+    send(true, 2);
+    send(false, 3);
+    CHECK(callback.frameTypes.size() == 2);
+}
+
+TEST_CASE_FIXTURE(Fixture, "Passthrough drops delta frames after a gap") {
+    send(true, 0);
+    send(false, 1);
+    // Frame 2 never reached the encoder
+    send(false, 3);
+    send(false, 4);
+    CHECK(callback.frameTypes.size() == 2);
+    CHECK(keyFrameRequests == 1);
+
+    send(true, 5);
+    CHECK(callback.frameTypes.size() == 3);
+}
+
+TEST_CASE_FIXTURE(Fixture, "Passthrough forwards key frame requests") {
+    send(true, 0);
+    std::vector<webrtc::FrameType> const keyFrame = { webrtc::kVideoFrameKey };
+    REQUIRE(encoder.Encode(encodedFrame(false, 1), nullptr, &keyFrame) == WEBRTC_VIDEO_CODEC_OK);
+    CHECK(keyFrameRequests == 1);
+    CHECK(callback.frameTypes.size() == 2);
+}
+
+TEST_CASE("Only access units without reference slices are disposable") {
+    // Non-reference P slice, then a reference one
+    std::vector<uint8_t> const disposable = { 0, 0, 1, 0x01, 0x9a, 0x02, 0, 0, 1, 0x01, 0x9a, 0x04 };
+    std::vector<uint8_t> const reference = { 0, 0, 1, 0x01, 0x9a, 0x02, 0, 0, 1, 0x41, 0x9a, 0x04 };
+    std::vector<uint8_t> const parameterSetsOnly = { 0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1f };
+
+    CHECK(isDisposableAccessUnit(disposable.data(), disposable.size()));
+    CHECK_FALSE(isDisposableAccessUnit(reference.data(), reference.size()));
+    CHECK_FALSE(isDisposableAccessUnit(accessUnit.data(), accessUnit.size()));
+    CHECK_FALSE(isDisposableAccessUnit(parameterSetsOnly.data(), parameterSetsOnly.size()));
+}
+
+TEST_CASE("Passthrough rejects key frames from another profile") {
+    int keyFrameRequests = 0;
+    auto encoderControl = std::make_shared<EncoderControl>();
+    encoderControl->setEncodedVideo(true, countRequest, &keyFrameRequests);
+
+    auto codec = packetizationModeOne();
+    codec.SetParam(cricket::kH264FmtpProfileLevelId, "640c1f");
+    PassthroughEncoder encoder(codec, encoderControl);
+    FrameCallback callback;
+    encoder.RegisterEncodeCompleteCallback(&callback);
+    webrtc::VideoCodec settings;
+    settings.codecType = webrtc::kVideoCodecH264;
+    settings.width = width;
+    settings.height = height;
+    REQUIRE(encoder.InitEncode(&settings, 1, 1200) == WEBRTC_VIDEO_CODEC_OK);
+
+    // The access unit's SPS is Constrained Baseline, but High was negotiated
+    CHECK(encoder.Encode(encodedFrame(true, 0), nullptr, nullptr) == WEBRTC_VIDEO_CODEC_ERROR);
+    CHECK(encoder.Encode(encodedFrame(false, 1), nullptr, nullptr) == WEBRTC_VIDEO_CODEC_OK);
+    CHECK(callback.frameTypes.empty());
+}
+
+TEST_CASE_FIXTURE(Fixture, "Passthrough reports the rate WebRTC asks for") {
+    webrtc::BitrateAllocation allocation;
+    allocation.SetBitrate(0, 0, 1'500'000);
+    REQUIRE(encoder.SetRateAllocation(allocation, 24) == WEBRTC_VIDEO_CODEC_OK);
+
+    auto rateTarget = encoderControl->getRateTarget();
+    CHECK(rateTarget.kbps == 1500);
+    CHECK(rateTarget.framerate == 24);
+}
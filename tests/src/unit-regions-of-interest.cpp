@@ -0,0 +1,82 @@
+#include "doctest.h"
+
+#include "RegionsOfInterest.hpp"
+
+#include <limits>
+#include <numeric>
+
+using namespace caff;
+
+TEST_CASE("Regions of interest cover the macroblocks whose centers they contain") {
+    // 4x2 macroblocks; the region covers the right half of the top row
+    std::vector<caff_VideoRegion> const regions = { { 0.5f, 0.0f, 0.5f, 0.5f, -4.0f } };
+    auto offsets = computeQuantOffsets(regions, 4, 2);
+    REQUIRE(offsets.size() == 8);
+
+    // Mean of -4, -4 and six zeros is -1, which is taken off every macroblock
+    std::vector<float> const expected = { 1.0f, 1.0f, -3.0f, -3.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+    for (size_t i = 0; i < expected.size(); ++i) {
+        CAPTURE(i);
+        CHECK(offsets[i] == doctest::Approx(expected[i]));
+    }
+}
+
+TEST_CASE("Quantizer offsets average zero") {
+    std::vector<caff_VideoRegion> const regions = {
+        { 0.7f, 0.7f, 0.3f, 0.3f, -6.0f },
+        { 0.0f, 0.0f, 1.0f, 0.1f, -3.0f },
+    };
+    auto offsets = computeQuantOffsets(regions, 80, 45);
+    REQUIRE(offsets.size() == 80 * 45);
+    auto sum = std::accumulate(offsets.begin(), offsets.end(), 0.0);
+    CHECK(sum / offsets.size() == doctest::Approx(0.0));
+}
+
+TEST_CASE("Overlapping regions take the lowest offset") {
+    std::vector<caff_VideoRegion> const regions = {
+        { 0.0f, 0.0f, 1.0f, 1.0f, 2.0f },
+        { 0.0f, 0.0f, 0.5f, 1.0f, -2.0f },
+    };
+    auto offsets = computeQuantOffsets(regions, 2, 1);
+    REQUIRE(offsets.size() == 2);
+    CHECK(offsets[0] == doctest::Approx(-2.0f));
+    CHECK(offsets[1] == doctest::Approx(2.0f));
+}
+
+TEST_CASE("Regions that cover nothing give no offsets") {
+    CHECK(computeQuantOffsets({}, 80, 45).empty());
+    CHECK(computeQuantOffsets({ { 0.0f, 0.0f, 0.001f, 0.001f, -4.0f } }, 80, 45).empty());
+    CHECK(computeQuantOffsets({ { 0.0f, 0.0f, 1.0f, 1.0f, 0.0f } }, 80, 45).empty());
+    CHECK(computeQuantOffsets({ { 1.5f, 0.0f, 1.0f, 1.0f, -4.0f } }, 80, 45).empty());
+}
+
+TEST_CASE("Regions with non-finite fields are ignored") {
+    float const nan = std::numeric_limits<float>::quiet_NaN();
+    float const infinity = std::numeric_limits<float>::infinity();
+    std::vector<caff_VideoRegion> const invalid[] = {
+        { { nan, 0.0f, 1.0f, 1.0f, -4.0f } },
+        { { 0.0f, infinity, 1.0f, 1.0f, -4.0f } },
+        { { 0.0f, 0.0f, -infinity, 1.0f, -4.0f } },
+        { { 0.0f, 0.0f, 1.0f, nan, -4.0f } },
+        { { 0.0f, 0.0f, 1.0f, 1.0f, infinity } },
+    };
+    for (auto const & regions : invalid) {
+        CHECK(computeQuantOffsets(regions, 80, 45).empty());
+    }
+}
+
+TEST_CASE("Regions reaching past the frame are cut off at its edges") {
+    float const huge = std::numeric_limits<float>::max();
+    auto offsets = computeQuantOffsets({ { -huge, -huge, huge, huge, -4.0f } }, 2, 1);
+    CHECK(offsets.empty());
+
+    // Covers the right macroblock only, out to any distance
+    offsets = computeQuantOffsets({ { 0.5f, -1.0f, huge, huge, -2.0f } }, 2, 1);
+    REQUIRE(offsets.size() == 2);
+    CHECK(offsets[0] == doctest::Approx(1.0f));
+    CHECK(offsets[1] == doctest::Approx(-1.0f));
+
+    offsets = computeQuantOffsets({ { -1e30f, 0.0f, 1e30f + 1e30f, 1.0f, -2.0f } }, 2, 1);
+    REQUIRE(offsets.size() == 2);
+    CHECK(offsets[0] == doctest::Approx(0.0f));
+}
@@ -0,0 +1,85 @@
+#include "doctest.h"
+
+#include "RepeatedFrameFilter.hpp"
+#include "VideoConversion.hpp"
+
+#include <vector>
+
+using namespace caff;
+
+namespace {
+    using Decision = RepeatedFrameFilter::Decision;
+
+    int64_t constexpr frameInterval = 16667;
+
+    // Feeds a frame hashing to |frameHash|, recording a conversion when there is one
+    Decision send(RepeatedFrameFilter & filter, int64_t & now, uint64_t frameHash) {
+        auto decision = filter.onFrame(frameHash, now, true);
+        if (decision == Decision::Convert) {
+            filter.onConverted(now);
+        }
+        now += frameInterval;
+        return decision;
+    }
+} // namespace
+
+TEST_CASE("Repeated frame filter compares each frame with the one before") {
+    RepeatedFrameFilter filter;
+    int64_t now = 1'000'000;
+    CHECK(send(filter, now, 100) == Decision::Convert);
+    CHECK(send(filter, now, 100) != Decision::Convert);
+    CHECK(send(filter, now, 101) == Decision::Convert);
+    CHECK(send(filter, now, 100) == Decision::Convert);
+    CHECK(send(filter, now, 100) != Decision::Convert);
+}
+
+TEST_CASE("Repeated frame filter sees a change to a single row on the next frame") {
+    int constexpr width = 1920 * 4;
+    int constexpr height = 1080;
+    std::vector<uint8_t> frame(width * height, 0);
+
+    RepeatedFrameFilter filter;
+    int64_t now = 1'000'000;
+    CHECK(send(filter, now, hashRows(frame.data(), width, width, height, 0)) == Decision::Convert);
+    CHECK(send(filter, now, hashRows(frame.data(), width, width, height, 0)) != Decision::Convert);
+
+    // A blinking caret: one row on, then off again
+    for (int row : { 5, 517, 1079 }) {
+        CAPTURE(row);
+        frame[row * width + 100] = 255;
+        CHECK(send(filter, now, hashRows(frame.data(), width, width, height, 0)) == Decision::Convert);
+        frame[row * width + 100] = 0;
+        CHECK(send(filter, now, hashRows(frame.data(), width, width, height, 0)) == Decision::Convert);
+    }
+}
+
+TEST_CASE("Repeated frame filter drops repeats and sends a few on") {
+    RepeatedFrameFilter filter;
+    int64_t now = 1'000'000;
+    send(filter, now, 7);
+
+    // At 60 fps, one repeat in twelve goes out again, every 200 ms
+    int repeats = 0;
+    int elided = 0;
+    for (int i = 0; i < 24; ++i) {
+        auto decision = send(filter, now, 7);
+        repeats += decision == Decision::Repeat;
+        elided += decision == Decision::Elide;
+    }
+    CHECK(repeats == 2);
+    CHECK(elided == 22);
+    CHECK(filter.getRepeatedFrames() == 2);
+    CHECK(filter.getElidedFrames() == 22);
+
+    SUBCASE("but converts one for real every second") {
+        bool converted = false;
+        for (int i = 0; i < 60 && !converted; ++i) {
+            converted = send(filter, now, 7) == Decision::Convert;
+        }
+        CHECK(converted);
+    }
+
+    SUBCASE("unless there is no buffer to repeat") {
+        CHECK(filter.onFrame(7, now, false) == Decision::Convert);
+    }
+}
@@ -0,0 +1,49 @@
+#include "doctest.h"
+
+#include "ScreenContentDetector.hpp"
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+TEST_CASE("Changed row fraction compares rows one by one") {
+    std::vector<uint64_t> const previous = { 1, 2, 3, 4 };
+    CHECK(changedRowFraction(previous, { 1, 2, 3, 4 }) == 0.0);
+    CHECK(changedRowFraction(previous, { 1, 9, 3, 4 }) == 0.25);
+    CHECK(changedRowFraction(previous, { 1, 2, 3 }) == 1.0);
+    CHECK(changedRowFraction({}, {}) == 1.0);
+}
+
+TEST_CASE("Screen content detector turns on for a quiet picture and off for a busy one") {
+    ScreenContentDetector detector;
+    auto now = 1s + 0us;
+    for (; now < 10s; now += 33333us) {
+        detector.onFrame(now, 0.05);
+    }
+    CHECK(detector.isScreenContent());
+    for (auto end = now + 2s; now < end; now += 33333us) {
+        detector.onFrame(now, 0.9);
+    }
+    CHECK_FALSE(detector.isScreenContent());
+}
+
+TEST_CASE("Screen content detector compares row hashes with the frame just before") {
+    ScreenContentDetector detector;
+    auto now = 1s + 0us;
+
+    // Every row alternates between two values, so consecutive frames differ everywhere even though every other frame
+    // is the same
+    std::vector<uint64_t> const even(1080, 1);
+    std::vector<uint64_t> const odd(1080, 2);
+    for (int i = 0; now < 10s; ++i, now += 33333us) {
+        auto rows = i % 2 == 0 ? even : odd;
+        detector.onFrame(now, rows);
+    }
+    CHECK(detector.getChangedFraction() > 0.99);
+    CHECK_FALSE(detector.isScreenContent());
+
+    SUBCASE("and hands back the previous frame's hashes") {
+        std::vector<uint64_t> rows(4, 7);
+        detector.onFrame(now, rows);
+        CHECK(rows.size() == 1080);
+    }
+}
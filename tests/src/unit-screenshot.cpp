@@ -0,0 +1,78 @@
+#include "doctest.h"
+
+#include "Screenshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "api/video/i420_buffer.h"
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    // 20x20 pixel cells
+    int constexpr width = lumaSignatureColumns * 20;
+    int constexpr height = lumaSignatureRows * 20;
+
+    // A frame whose luma is |left| in the left half and |right| in the right half
+    rtc::scoped_refptr<webrtc::I420Buffer> splitFrame(uint8_t left, uint8_t right) {
+        auto buffer = webrtc::I420Buffer::Create(width, height);
+        for (int y = 0; y < height; ++y) {
+            auto * line = buffer->MutableDataY() + y * buffer->StrideY();
+            std::memset(line, left, width / 2);
+            std::memset(line + width / 2, right, width - width / 2);
+        }
+        return buffer;
+    }
+
+    LumaSignature uniformSignature(uint8_t luma) {
+        LumaSignature signature;
+        signature.fill(luma);
+        return signature;
+    }
+} // namespace
+
+TEST_CASE("Luma signature averages each cell of the frame") {
+    auto signature = computeLumaSignature(*splitFrame(200, 40));
+    for (int row = 0; row < lumaSignatureRows; ++row) {
+        for (int column = 0; column < lumaSignatureColumns; ++column) {
+            CHECK(signature[row * lumaSignatureColumns + column] == (column < lumaSignatureColumns / 2 ? 200 : 40));
+        }
+    }
+    CHECK(lumaSignatureBrightness(signature) == 120);
+}
+
+TEST_CASE("Luma signature distance is the mean difference between cells") {
+    auto const base = uniformSignature(100);
+    CHECK(lumaSignatureDistance(base, base) == 0.0);
+    CHECK(lumaSignatureDistance(base, uniformSignature(112)) == 12.0);
+    CHECK(lumaSignatureDistance(uniformSignature(112), base) == 12.0);
+
+    // Small changes aren't rounded away
+    auto oneCell = base;
+    oneCell[0] = 101;
+    CHECK(lumaSignatureDistance(base, oneCell) == doctest::Approx(1.0 / oneCell.size()));
+}
+
+TEST_CASE("Luma signature brightness is the mean of all cells") {
+    CHECK(lumaSignatureBrightness(uniformSignature(0)) == 0);
+    CHECK(lumaSignatureBrightness(uniformSignature(255)) == 255);
+
+    auto signature = uniformSignature(10);
+    std::fill(signature.begin(), signature.begin() + signature.size() / 2, 30);
+    CHECK(lumaSignatureBrightness(signature) == 20);
+}
+
+TEST_CASE("Screenshot refreshes only for a bright new scene at most once a minute") {
+    auto const last = uniformSignature(100);
+
+    CHECK(isScreenshotRefreshWanted(uniformSignature(112), last, 60s));
+    CHECK_FALSE(isScreenshotRefreshWanted(uniformSignature(111), last, 60s));
+    CHECK_FALSE(isScreenshotRefreshWanted(uniformSignature(112), last, 59s));
+    CHECK_FALSE(isScreenshotRefreshWanted(last, last, 10 * 60s));
+
+    auto const bright = uniformSignature(60);
+    CHECK(isScreenshotRefreshWanted(uniformSignature(16), bright, 60s));
+    CHECK_FALSE(isScreenshotRefreshWanted(uniformSignature(15), bright, 60s));
+}
@@ -0,0 +1,89 @@
+#include "doctest.h"
+
+#include "SmoothedThreshold.hpp"
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    using Level = SmoothedThreshold::Level;
+
+    SmoothedThreshold::Settings const settings{ 1s, 0.2, 2s, 0.6 };
+
+    // Feeds |sample| every 100 ms until |until|, and returns the last level
+    Level feed(
+            SmoothedThreshold & threshold,
+            std::chrono::microseconds & now,
+            std::chrono::microseconds until,
+            double sample) {
+        Level level = Level::Between;
+        for (; now < until; now += 100ms) {
+            level = threshold.update(now, sample);
+        }
+        return level;
+    }
+} // namespace
+
+TEST_CASE("Smoothed threshold takes the first sample as is") {
+    SmoothedThreshold threshold(settings);
+    CHECK(threshold.update(1s, 0.9) == Level::High);
+    CHECK(threshold.getValue() == 0.9);
+}
+
+TEST_CASE("Smoothed threshold weights samples by the time between them") {
+    SmoothedThreshold threshold(settings);
+    threshold.update(1s, 0.0);
+    threshold.update(1250ms, 1.0);
+    CHECK(threshold.getValue() == doctest::Approx(0.25));
+
+    // Gaps longer than the smoothing time replace the value outright
+    threshold.update(5s, 0.5);
+    CHECK(threshold.getValue() == doctest::Approx(0.5));
+
+    // A sample out of order doesn't move it
+    threshold.update(4s, 1.0);
+    CHECK(threshold.getValue() == doctest::Approx(0.5));
+}
+
+TEST_CASE("Smoothed threshold reports a high value as soon as it passes") {
+    SmoothedThreshold threshold(settings);
+    auto now = 1s + 0us;
+    CHECK(feed(threshold, now, 3s, 0.4) == Level::Between);
+
+    SUBCASE("but not for a single spike") {
+        CHECK(threshold.update(now, 1.0) == Level::Between);
+        CHECK(feed(threshold, now, 5s, 0.4) == Level::Between);
+    }
+
+    SUBCASE("within a fraction of the smoothing time") {
+        CHECK(feed(threshold, now, 3300ms, 1.0) == Level::Between);
+        CHECK(feed(threshold, now, 3400ms, 1.0) == Level::High);
+    }
+}
+
+TEST_CASE("Smoothed threshold reports a low value only once it has lasted the hold time") {
+    SmoothedThreshold threshold(settings);
+    auto now = 1s + 0us;
+    threshold.update(now, 0.0);
+    CHECK(feed(threshold, now, 2s, 0.0) == Level::Between);
+    CHECK(feed(threshold, now, 3s, 0.0) == Level::Between);
+    CHECK(feed(threshold, now, 3100ms, 0.0) == Level::SustainedLow);
+
+    SUBCASE("and starts the hold again after rising above it") {
+        CHECK(feed(threshold, now, 4s, 0.5) == Level::Between);
+        CHECK(feed(threshold, now, 5s, 0.0) == Level::Between);
+        CHECK(feed(threshold, now, 6s, 0.0) == Level::Between);
+        CHECK(feed(threshold, now, 8s, 0.0) == Level::SustainedLow);
+    }
+}
+
+TEST_CASE("Smoothed threshold forgets everything on reset") {
+    SmoothedThreshold threshold(settings);
+    auto now = 1s + 0us;
+    REQUIRE(feed(threshold, now, 5s, 0.0) == Level::SustainedLow);
+    threshold.reset();
+    CHECK(threshold.getValue() == 0.0);
+    CHECK(threshold.update(now, 0.0) == Level::Between);
+    CHECK(threshold.update(now + 1s, 0.4) == Level::Between);
+    CHECK(threshold.getValue() == doctest::Approx(0.4));
+}
@@ -0,0 +1,143 @@
+#include "doctest.h"
+
+#include "VideoConversion.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace caff;
+
+namespace {
+    int constexpr width = 75;   // not a whole number of hashing lanes
+    int constexpr height = 1080;
+    int constexpr stride = 80;  // padded, and the padding must not be hashed
+} // namespace
+
+TEST_CASE("Row hashing") {
+    std::vector<uint8_t> frame(stride * height, 0);
+
+    std::vector<uint64_t> rowHashes;
+    auto const hash = hashRows(frame.data(), stride, width, height, 0, &rowHashes);
+    CHECK(rowHashes.size() == height);
+
+    SUBCASE("ignores the padding past each row") {
+        frame[width] = 1;
+        CHECK(hashRows(frame.data(), stride, width, height, 0) == hash);
+    }
+
+    SUBCASE("depends on the seed") {
+        CHECK(hashRows(frame.data(), stride, width, height, 1) != hash);
+    }
+
+    SUBCASE("sees a change to any byte of any row") {
+        auto const unchanged = frame;
+        for (int row : { 0, 1, 5, 15, 1079 }) {
+            for (int column : { 0, 7, 8, 31, 32, 63, 64, 74 }) {
+                CAPTURE(row);
+                CAPTURE(column);
+                frame = unchanged;
+                frame[row * stride + column] = 1;
+                CHECK(hashRows(frame.data(), stride, width, height, 0) != hash);
+            }
+        }
+    }
+
+    SUBCASE("hashes each row on its own") {
+        frame[16 * stride] = 1;
+        std::vector<uint64_t> changedRowHashes;
+        CHECK(hashRows(frame.data(), stride, width, height, 0, &changedRowHashes) != hash);
+        REQUIRE(changedRowHashes.size() == rowHashes.size());
+        for (size_t i = 0; i < rowHashes.size(); ++i) {
+            CAPTURE(i);
+            CHECK((changedRowHashes[i] != rowHashes[i]) == (i == 16));
+        }
+    }
+
+    SUBCASE("tells words apart by their place in the row") {
+        frame[0] = 1;
+        auto const first = hashRows(frame.data(), stride, width, height, 0);
+        frame[0] = 0;
+        frame[8] = 1;
+        CHECK(hashRows(frame.data(), stride, width, height, 0) != first);
+    }
+}
+
+namespace {
+    // A frame of random noise, so any seam between bands shows up as a difference
+    rtc::scoped_refptr<webrtc::I420Buffer> noiseFrame(int frameWidth, int frameHeight) {
+        auto buffer = webrtc::I420Buffer::Create(frameWidth, frameHeight);
+        std::mt19937 random(frameWidth * frameHeight);
+        std::uniform_int_distribution<int> byte(0, 255);
+        auto fill = [&](uint8_t * plane, int planeStride, int planeWidth, int planeHeight) {
+            for (int y = 0; y < planeHeight; ++y) {
+                for (int x = 0; x < planeWidth; ++x) {
+                    plane[y * planeStride + x] = static_cast<uint8_t>(byte(random));
+                }
+            }
+        };
+        fill(buffer->MutableDataY(), buffer->StrideY(), buffer->width(), buffer->height());
+        fill(buffer->MutableDataU(), buffer->StrideU(), buffer->ChromaWidth(), buffer->ChromaHeight());
+        fill(buffer->MutableDataV(), buffer->StrideV(), buffer->ChromaWidth(), buffer->ChromaHeight());
+        return buffer;
+    }
+
+    bool isSamePlane(
+            uint8_t const * left,
+            int leftStride,
+            uint8_t const * right,
+            int rightStride,
+            int planeWidth,
+            int planeHeight) {
+        for (int y = 0; y < planeHeight; ++y) {
+            if (!std::equal(left + y * leftStride, left + y * leftStride + planeWidth, right + y * rightStride)) {
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace
+
+TEST_CASE("Banded scaling matches scaling in one call") {
+    WorkerPool workerPool(3);
+    struct Size {
+        int width;
+        int height;
+    };
+    // 1.5x uses bilinear filtering, 2x averages 2x2 blocks and 3x is a box filter
+    for (auto sizes : { std::make_pair(Size{ 1920, 1080 }, Size{ 1280, 720 }),
+                        std::make_pair(Size{ 1920, 1080 }, Size{ 960, 540 }),
+                        std::make_pair(Size{ 1920, 1080 }, Size{ 640, 360 }) }) {
+        CAPTURE(sizes.second.height);
+        auto source = noiseFrame(sizes.first.width, sizes.first.height);
+
+        auto expected = webrtc::I420Buffer::Create(sizes.second.width, sizes.second.height);
+        expected->ScaleFrom(*source);
+        auto banded = webrtc::I420Buffer::Create(sizes.second.width, sizes.second.height);
+        REQUIRE(scaleI420(*source, banded.get(), &workerPool) == 0);
+
+        CHECK(isSamePlane(
+                expected->DataY(),
+                expected->StrideY(),
+                banded->DataY(),
+                banded->StrideY(),
+                expected->width(),
+                expected->height()));
+        CHECK(isSamePlane(
+                expected->DataU(),
+                expected->StrideU(),
+                banded->DataU(),
+                banded->StrideU(),
+                expected->ChromaWidth(),
+                expected->ChromaHeight()));
+        CHECK(isSamePlane(
+                expected->DataV(),
+                expected->StrideV(),
+                banded->DataV(),
+                banded->StrideV(),
+                expected->ChromaWidth(),
+                expected->ChromaHeight()));
+    }
+}
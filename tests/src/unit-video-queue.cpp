@@ -0,0 +1,118 @@
+#include "doctest.h"
+
+#include "VideoQueue.hpp"
+
+#include <future>
+#include <thread>
+
+using namespace caff;
+using namespace std::chrono_literals;
+
+namespace {
+    // Holds the consumer inside the first frame so the test controls how full the queue gets
+    struct BlockingHandler {
+        std::promise<void> firstFrameStarted;
+        std::promise<void> release;
+        std::shared_future<void> released{ release.get_future().share() };
+        std::mutex mutex;
+        std::vector<int64_t> handled;
+
+        void operator()(QueuedFrame const & frame) {
+            bool isFirst;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                isFirst = handled.empty();
+                handled.push_back(frame.timestamp.count());
+            }
+            if (isFirst) {
+                firstFrameStarted.set_value();
+                released.wait();
+            }
+        }
+    };
+
+    void push(VideoQueue & queue, int64_t id) {
+        uint8_t pixels[4] = {};
+        queue.pushFrame(caff_VideoFormatBgra, pixels, sizeof(pixels), 1, 1, std::chrono::microseconds(id));
+    }
+
+    void drain(VideoQueue & queue) {
+        while (queue.getStats().depth > 0) {
+            std::this_thread::sleep_for(1ms);
+        }
+        queue.stop();
+    }
+} // namespace
+
+TEST_CASE("Video queue drops the oldest frame when full") {
+    BlockingHandler handler;
+    VideoQueue queue(2, caff_VideoDropPolicyOldest, std::ref(handler));
+
+    push(queue, 1);
+    handler.firstFrameStarted.get_future().wait();
+    push(queue, 2);
+    push(queue, 3);
+    push(queue, 4);
+
+    auto stats = queue.getStats();
+    CHECK(stats.depth == 2);
+    CHECK(stats.droppedFrames == 1);
+
+    handler.release.set_value();
+    drain(queue);
+    CHECK(handler.handled == std::vector<int64_t>{ 1, 3, 4 });
+}
+
+TEST_CASE("Video queue drops the newest frame when full") {
+    BlockingHandler handler;
+    VideoQueue queue(2, caff_VideoDropPolicyNewest, std::ref(handler));
+
+    push(queue, 1);
+    handler.firstFrameStarted.get_future().wait();
+    push(queue, 2);
+    push(queue, 3);
+    push(queue, 4);
+
+    auto stats = queue.getStats();
+    CHECK(stats.depth == 2);
+    CHECK(stats.droppedFrames == 1);
+
+    handler.release.set_value();
+    drain(queue);
+    CHECK(handler.handled == std::vector<int64_t>{ 1, 2, 3 });
+}
+
+TEST_CASE("Video queue releases planes of dropped and discarded frames") {
+    BlockingHandler handler;
+    VideoQueue queue(1, caff_VideoDropPolicyOldest, std::ref(handler));
+
+    int released = 0;
+    auto pushPlanes = [&](int64_t id) {
+        uint8_t plane[1] = {};
+        uint8_t const * planes[3] = { plane, plane, plane };
+        int32_t strides[3] = { 1, 1, 1 };
+        std::shared_ptr<void> owner(nullptr, [&](void *) { ++released; });
+        queue.pushPlanes(caff_VideoFormatI420, planes, strides, 1, 1, std::chrono::microseconds(id), owner);
+    };
+
+    pushPlanes(1);
+    handler.firstFrameStarted.get_future().wait();
+    pushPlanes(2);
+    pushPlanes(3);
+    CHECK(released == 1);
+
+    handler.release.set_value();
+    queue.stop();
+    CHECK(released == 3);
+}
+
+TEST_CASE("Video queue drops row padding from strided frames") {
+    std::promise<std::vector<uint8_t>> handled;
+    VideoQueue queue(1, caff_VideoDropPolicyOldest, [&](QueuedFrame const & frame) { handled.set_value(frame.data); });
+
+    uint8_t const padded[] = { 1, 2, 0xff, 3, 4, 0xff, 5, 6 };
+    queue.pushStridedFrame(caff_VideoFormatRgb565, padded, 3, 2, 1, 3, 0us);
+
+    CHECK(handled.get_future().get() == std::vector<uint8_t>{ 1, 2, 3, 4, 5, 6 });
+    queue.stop();
+}
@@ -0,0 +1,373 @@
+#include "doctest.h"
+
+#include "X264Encoder.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "api/video/i420_buffer.h"
+#include "media/base/mediaconstants.h"
+
+using namespace caff;
+
+namespace {
+    int constexpr width = 640;
+    int constexpr height = 360;
+    int constexpr fps = 30;
+
+    // Collects the size of every encoded frame
+    class SizeCallback : public webrtc::EncodedImageCallback {
+    public:
+        virtual Result OnEncodedImage(
+                webrtc::EncodedImage const & encodedImage,
+                webrtc::CodecSpecificInfo const * codecSpecificInfo,
+                webrtc::RTPFragmentationHeader const * fragmentation) override {
+            frameBytes.push_back(encodedImage._length);
+            frameSizes.push_back({ static_cast<int>(encodedImage._encodedWidth),
+                                   static_cast<int>(encodedImage._encodedHeight) });
+            frameTypes.push_back(encodedImage._frameType);
+            contentTypes.push_back(encodedImage.content_type_);
+            if (firstFrame.empty()) {
+                firstFrame.assign(encodedImage._buffer, encodedImage._buffer + encodedImage._length);
+            }
+            return Result(Result::OK);
+        }
+
+        // Mean bitrate of the last |count| frames, if they were captured at |frameRate|
+        double recentKbps(size_t count, double frameRate = fps) const {
+            REQUIRE(frameBytes.size() >= count);
+            auto bytes = std::accumulate(frameBytes.end() - count, frameBytes.end(), size_t(0));
+            return bytes * 8.0 * frameRate / count / 1000.0;
+        }
+
+        std::vector<size_t> frameBytes;
+        std::vector<std::pair<int, int>> frameSizes;
+        std::vector<webrtc::FrameType> frameTypes;
+        std::vector<webrtc::VideoContentType> contentTypes;
+        std::vector<uint8_t> firstFrame;
+    };
+
+    struct NoiseSource {
+        std::mt19937 generator{ 42 };
+        int64_t timestampUs = 0;
+        double frameRate = fps;
+    };
+
+    // Fresh noise every frame, so the encoder always wants more bits than it is allowed
+    void encodeNoise(
+            X264Encoder & encoder,
+            int count,
+            NoiseSource & source,
+            int frameWidth = width,
+            int frameHeight = height) {
+        std::uniform_int_distribution<int> distribution(0, 255);
+        for (int i = 0; i < count; ++i) {
+            auto buffer = webrtc::I420Buffer::Create(frameWidth, frameHeight);
+            for (int y = 0; y < frameHeight; ++y) {
+                uint8_t * row = buffer->MutableDataY() + y * buffer->StrideY();
+                for (int x = 0; x < frameWidth; ++x) {
+                    row[x] = static_cast<uint8_t>(distribution(source.generator));
+                }
+            }
+            for (int y = 0; y < buffer->ChromaHeight(); ++y) {
+                std::fill_n(buffer->MutableDataU() + y * buffer->StrideU(), buffer->ChromaWidth(), uint8_t(128));
+                std::fill_n(buffer->MutableDataV() + y * buffer->StrideV(), buffer->ChromaWidth(), uint8_t(128));
+            }
+            webrtc::VideoFrame frame(buffer, webrtc::kVideoRotation_0, source.timestampUs);
+            REQUIRE(encoder.Encode(frame, nullptr, nullptr) == WEBRTC_VIDEO_CODEC_OK);
+            source.timestampUs += static_cast<int64_t>(1'000'000 / source.frameRate);
+        }
+    }
+
+    webrtc::VideoCodec codecSettings(unsigned int kbps) {
+        webrtc::VideoCodec settings;
+        settings.codecType = webrtc::kVideoCodecH264;
+        settings.width = width;
+        settings.height = height;
+        settings.maxFramerate = fps;
+        settings.startBitrate = kbps;
+        settings.maxBitrate = kbps;
+        return settings;
+    }
+
+    // An encoder for the H.264 codec WebRTC negotiates, delivering to its own callback. |profileLevelId| is the SDP
+    // profile-level-id, or null for the default
+    struct TestEncoder {
+        explicit TestEncoder(
+                std::shared_ptr<EncoderControl> encoderControl = nullptr, char const * profileLevelId = nullptr)
+            : encoder(h264Codec(profileLevelId), std::move(encoderControl)) {
+            encoder.RegisterEncodeCompleteCallback(&callback);
+        }
+
+        static cricket::VideoCodec h264Codec(char const * profileLevelId) {
+            cricket::VideoCodec codec(cricket::kH264CodecName);
+            codec.SetParam(cricket::kH264FmtpPacketizationMode, "1");
+            if (profileLevelId) {
+                codec.SetParam(cricket::kH264FmtpProfileLevelId, profileLevelId);
+            }
+            return codec;
+        }
+
+        // Initializes the encoder the way WebRTC does for the first frame
+        void init(webrtc::VideoCodec settings) {
+            REQUIRE(encoder.InitEncode(&settings, 1, 1200) == WEBRTC_VIDEO_CODEC_OK);
+        }
+
+        SizeCallback callback;
+        X264Encoder encoder;
+        NoiseSource source;
+    };
+
+    void setBitrate(X264Encoder & encoder, uint32_t kbps) {
+        webrtc::BitrateAllocation allocation;
+        allocation.SetBitrate(0, 0, kbps * 1000);
+        REQUIRE(encoder.SetRateAllocation(allocation, fps) == WEBRTC_VIDEO_CODEC_OK);
+    }
+} // namespace
+
+TEST_CASE("Small bitrate changes do not reconfigure the encoder") {
+    CHECK_FALSE(shouldReconfigureBitrate(2000, 2000));
+    CHECK_FALSE(shouldReconfigureBitrate(2000, 1950));
+    CHECK_FALSE(shouldReconfigureBitrate(2000, 2200));
+
+    CHECK(shouldReconfigureBitrate(2000, 1800));
+    CHECK(shouldReconfigureBitrate(2000, 2400));
+    CHECK(shouldReconfigureBitrate(0, 500));
+}
+
+TEST_CASE("Encoder output follows a drop in target bitrate") {
+    TestEncoder test;
+    test.init(codecSettings(2000));
+
+    setBitrate(test.encoder, 2000);
+    encodeNoise(test.encoder, 2 * fps, test.source);
+    auto before = test.callback.recentKbps(fps);
+
+    setBitrate(test.encoder, 500);
+    // Give VBV a second to drain, then measure the following second
+    encodeNoise(test.encoder, 2 * fps, test.source);
+    auto after = test.callback.recentKbps(fps);
+
+    CHECK(before > 1000.0);
+    CHECK(after < 500.0 * 1.25);
+    CHECK(after > 500.0 * 0.5);
+}
+
+TEST_CASE("Encoder chooses the CRF again when the target bitrate changes") {
+    TestEncoder test;
+    test.init(codecSettings(2000));
+    setBitrate(test.encoder, 2000);
+    encodeNoise(test.encoder, 1, test.source);
+    auto const highBitrateCrf = test.encoder.getCrf();
+
+    // Below 1 Mbps, frames under 720p lose the high quality CRF
+    setBitrate(test.encoder, 500);
+    CHECK(test.encoder.getCrf() > highBitrateCrf);
+
+    setBitrate(test.encoder, 2000);
+    CHECK(test.encoder.getCrf() == highBitrateCrf);
+}
+
+TEST_CASE("Encoder reopens with a key frame when the frame size changes") {
+    TestEncoder test;
+    test.init(codecSettings(1000));
+    encodeNoise(test.encoder, 5, test.source);
+    encodeNoise(test.encoder, 5, test.source, 960, 540);
+    encodeNoise(test.encoder, 5, test.source);
+
+    auto const & callback = test.callback;
+    REQUIRE(callback.frameSizes.size() == 15);
+    CHECK(callback.frameSizes[4] == std::make_pair(width, height));
+    CHECK(callback.frameSizes[5] == std::make_pair(960, 540));
+    CHECK(callback.frameSizes[10] == std::make_pair(width, height));
+    CHECK(callback.frameTypes[5] == webrtc::kVideoFrameKey);
+    CHECK(callback.frameTypes[6] == webrtc::kVideoFrameDelta);
+    CHECK(callback.frameTypes[10] == webrtc::kVideoFrameKey);
+}
+
+TEST_CASE("Fragmentizing replaces length prefixes with start codes") {
+    std::vector<uint8_t> output = { 0, 0, 0, 2, 0x67, 0x42, 0, 0, 0, 3, 0x65, 0x88, 0x80 };
+    x264_nal_t nals[2] = {};
+    nals[0].p_payload = output.data();
+    nals[0].i_payload = 6;
+    nals[1].p_payload = output.data() + 6;
+    nals[1].i_payload = 7;
+
+    webrtc::EncodedImage encodedImage;
+    webrtc::RTPFragmentationHeader fragHeader;
+    std::vector<uint8_t> copyBuffer;
+
+    SUBCASE("in place when contiguous") {
+        rtpFragmentize(&encodedImage, &copyBuffer, 2, nals, &fragHeader);
+        CHECK(encodedImage._buffer == output.data());
+        CHECK(copyBuffer.empty());
+    }
+
+    SUBCASE("copied when not contiguous") {
+        std::vector<uint8_t> second(output.begin() + 6, output.end());
+        nals[1].p_payload = second.data();
+        rtpFragmentize(&encodedImage, &copyBuffer, 2, nals, &fragHeader);
+        CHECK(encodedImage._buffer == copyBuffer.data());
+    }
+
+    std::vector<uint8_t> const expected = { 0, 0, 0, 1, 0x67, 0x42, 0, 0, 0, 1, 0x65, 0x88, 0x80 };
+    REQUIRE(encodedImage._length == expected.size());
+    CHECK(std::equal(expected.begin(), expected.end(), encodedImage._buffer));
+    REQUIRE(fragHeader.fragmentationVectorSize == 2);
+    CHECK(fragHeader.fragmentationOffset[0] == 4);
+    CHECK(fragHeader.fragmentationLength[0] == 2);
+    CHECK(fragHeader.fragmentationOffset[1] == 10);
+    CHECK(fragHeader.fragmentationLength[1] == 3);
+}
+
+TEST_CASE("Encoder uses the negotiated H.264 profile") {
+    struct ProfileCase {
+        char const * profileLevelId;
+        uint8_t profileIdc;
+    };
+    ProfileCase const cases[] = { { "42e01f", 66 }, { "4d001f", 77 }, { "64001f", 100 } };
+
+    for (auto const & profileCase : cases) {
+        CAPTURE(profileCase.profileLevelId);
+        TestEncoder test(nullptr, profileCase.profileLevelId);
+        test.init(codecSettings(1000));
+        encodeNoise(test.encoder, 1, test.source);
+
+        // The key frame starts with the SPS: start code, NAL header, then profile_idc
+        auto const & frame = test.callback.firstFrame;
+        REQUIRE(frame.size() > 5);
+        CHECK((frame[4] & 0x1f) == 7);
+        CHECK(frame[5] == profileCase.profileIdc);
+    }
+}
+
+TEST_CASE("Encoder budgets bits by capture time") {
+    TestEncoder test;
+    test.init(codecSettings(1000));
+
+    // x264 is configured for 30 fps, but frames arrive half as often. Each must get twice the bits to hold the rate
+    test.source.frameRate = fps / 2.0;
+    encodeNoise(test.encoder, 3 * fps, test.source);
+
+    auto kbps = test.callback.recentKbps(fps, test.source.frameRate);
+    CHECK(kbps > 1000.0 * 0.75);
+    CHECK(kbps < 1000.0 * 1.25);
+}
+
+TEST_CASE("Encoder marks video as screen content in screensharing mode") {
+    TestEncoder test;
+    auto settings = codecSettings(1000);
+    test.init(settings);
+    encodeNoise(test.encoder, 1, test.source);
+
+    // WebRTC switches modes by initializing the encoder again
+    settings.mode = webrtc::VideoCodecMode::kScreensharing;
+    test.init(settings);
+    encodeNoise(test.encoder, 1, test.source);
+
+    auto const & contentTypes = test.callback.contentTypes;
+    REQUIRE(contentTypes.size() == 2);
+    CHECK(contentTypes[0] == webrtc::VideoContentType::UNSPECIFIED);
+    CHECK(contentTypes[1] == webrtc::VideoContentType::SCREENSHARE);
+}
+
+TEST_CASE("Encoder prepared ahead of InitEncode encodes at the size WebRTC asks for") {
+    auto encoderControl = std::make_shared<EncoderControl>();
+    encoderControl->setExpectedVideo({ width, height, 1000, fps, false });
+
+    TestEncoder test(encoderControl);
+    auto & encoder = test.encoder;
+    auto const & callback = test.callback;
+    REQUIRE(encoder.prepare(1, 1200));
+    REQUIRE(encoder.getOpenCount() == 1);
+
+    SUBCASE("keeping the prepared encoder when the settings match") {
+        test.init(codecSettings(1500));
+        CHECK(encoder.getOpenCount() == 1);
+        encodeNoise(encoder, 2, test.source);
+        REQUIRE(callback.frameSizes.size() == 2);
+        CHECK(callback.frameSizes[0] == std::make_pair(width, height));
+        CHECK(callback.frameTypes[0] == webrtc::kVideoFrameKey);
+    }
+
+    SUBCASE("opening a new one when the frame size doesn't match") {
+        auto settings = codecSettings(1500);
+        settings.width = 960;
+        settings.height = 540;
+        test.init(settings);
+        CHECK(encoder.getOpenCount() == 2);
+        encodeNoise(encoder, 2, test.source, 960, 540);
+        REQUIRE(callback.frameSizes.size() == 2);
+        CHECK(callback.frameSizes[0] == std::make_pair(960, 540));
+        CHECK(callback.frameTypes[0] == webrtc::kVideoFrameKey);
+    }
+
+    SUBCASE("opening a new one when the mode or limits don't match") {
+        auto settings = codecSettings(1500);
+        SUBCASE("mode") {
+            settings.mode = webrtc::VideoCodecMode::kScreensharing;
+            test.init(settings);
+        }
+        SUBCASE("cores") {
+            REQUIRE(encoder.InitEncode(&settings, 2, 1200) == WEBRTC_VIDEO_CODEC_OK);
+        }
+        SUBCASE("payload size") {
+            REQUIRE(encoder.InitEncode(&settings, 1, 1000) == WEBRTC_VIDEO_CODEC_OK);
+        }
+        CHECK(encoder.getOpenCount() == 2);
+    }
+}
+
+TEST_CASE("Preset ladder levels take effect in both directions") {
+    x264_param_t params;
+    REQUIRE(x264_param_default_preset(&params, "veryfast", "zerolatency") == 0);
+    params.i_csp = X264_CSP_I420;
+    params.i_width = width;
+    params.i_height = height;
+    params.i_fps_num = fps;
+    params.i_fps_den = 1;
+    params.i_threads = 1;
+    params.i_log_level = X264_LOG_NONE;
+    applySpeedLevel(&params, speedLadderSize() - 1);
+    x264_t * encoder = x264_encoder_open(&params);
+    REQUIRE(encoder);
+
+    x264_picture_t picture;
+    REQUIRE(x264_picture_alloc(&picture, X264_CSP_I420, width, height) == 0);
+    std::fill_n(picture.img.plane[0], width * height, uint8_t(16));
+    std::fill_n(picture.img.plane[1], width * height / 4, uint8_t(128));
+    std::fill_n(picture.img.plane[2], width * height / 4, uint8_t(128));
+
+    // Down to the fastest level and back up again, one frame per level as the encoder does
+    std::vector<int32_t> levels;
+    for (int32_t level = speedLadderSize() - 2; level >= 0; --level) {
+        levels.push_back(level);
+    }
+    for (int32_t level = 1; level < speedLadderSize(); ++level) {
+        levels.push_back(level);
+    }
+
+    int64_t pts = 0;
+    for (auto level : levels) {
+        CAPTURE(level);
+        x264_encoder_parameters(encoder, &params);
+        applySpeedLevel(&params, level);
+        REQUIRE(x264_encoder_reconfig(encoder, &params) == 0);
+
+        x264_picture_t pictureOut;
+        x264_nal_t * nal = nullptr;
+        int numNals = 0;
+        picture.i_pts = pts++;
+        REQUIRE(x264_encoder_encode(encoder, &nal, &numNals, &picture, &pictureOut) >= 0);
+
+        x264_encoder_parameters(encoder, &params);
+        CHECK(isAtSpeedLevel(params, level));
+        CHECK(params.analyse.i_subpel_refine >= 1);
+    }
+
+    x264_picture_clean(&picture);
+    x264_encoder_close(encoder);
+}